@@ -0,0 +1,291 @@
+/*
+ * AsyncRun.hpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#ifndef ASYNCRUN_HPP_
+#define ASYNCRUN_HPP_
+
+#include "Maxfiles.h"
+#include "MaxSLiCInterface.h"
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "Types.h"
+#include "Results.hpp"
+#include "Status.hpp"
+#include "SPSCQueue.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ASYNC_RUN_PAUSE() _mm_pause()
+#else
+#define ASYNC_RUN_PAUSE()
+#endif
+
+/* A batch of intersections passed from the drain thread to the consumer. Batches come from a fixed pool and are handed back with Release(), so
+ * nothing is allocated while the run is in progress */
+struct result_batch_t
+{
+	intersection_t* intersections;
+	size_t count;
+	size_t capacity;
+};
+
+/* Owns the result and status streams of one run and drains them on a dedicated thread, so the thread that started the run is free to do other work
+ * (e.g. set up the next job) and consume results when it is ready.
+ *
+ * The drain thread spins while data is arriving, then yields, then sleeps for progressively longer (up to max_sleep_us) when the streams are idle.
+ * Full batches go to the consumer through a lock-free single producer / single consumer queue. If the consumer falls behind and the batch pool runs
+ * dry, the drain thread stops reading the ring; the ring fills and the DFE stalls, rather than the host buffering without limit. */
+class AsyncRun
+{
+public:
+	int m_spin_rounds;		//idle polls spent spinning before yielding
+	int m_yield_rounds;		//idle polls spent yielding before sleeping
+	int m_max_sleep_us;
+
+private:
+	Results m_results;
+	Status m_status;
+
+	std::vector<result_batch_t> m_batches;
+	SPSCQueue<result_batch_t*> m_full;
+	SPSCQueue<result_batch_t*> m_free;
+	result_batch_t* m_current;
+
+	max_run_t* m_run;
+	std::thread m_thread;
+	std::atomic<bool> m_complete;
+	bool m_waited;
+
+public:
+	AsyncRun(max_file_t* maxfile, max_engine_t* engine, int ring_slots = 512, int num_batches = 8) :
+		m_results(maxfile, engine, ring_slots),
+		m_status(maxfile, engine),
+		m_full(num_batches),
+		m_free(num_batches)
+	{
+		m_spin_rounds = 256;
+		m_yield_rounds = 1024;
+		m_max_sleep_us = 1000;
+
+		m_current = NULL;
+		m_run = NULL;
+		m_complete.store(false);
+		m_waited = false;
+
+		/* one batch holds a whole ring's worth of intersections */
+
+		m_batches.resize(num_batches);
+		for(int i = 0; i < num_batches; i++)
+		{
+			m_batches[i].capacity = ring_slots * 2;
+			m_batches[i].count = 0;
+			m_batches[i].intersections = new intersection_t[m_batches[i].capacity];
+			m_free.Push(&m_batches[i]);
+		}
+
+		m_results.SetConsumer([this](const intersection_t* intersections, size_t count){ Append(intersections, count); });
+	}
+
+	~AsyncRun()
+	{
+		Wait();
+		for(size_t i = 0; i < m_batches.size(); i++){
+			delete[] m_batches[i].intersections;
+		}
+	}
+
+	/* runs the actions on the engine and starts draining their output. the object may be started again once the previous run has been waited on,
+	 * reusing the same streams. runs with an encoding other than pairs must give the run's total_triangles and total_rays (see
+	 * CreateIntersectionActions), which the hits are decoded against */
+	void Start(max_engine_t* engine, max_actions_t* actions, result_encoding_t encoding = RESULT_ENCODING_PAIRS, u_int64_t total_triangles = 0,
+			u_int64_t total_rays = 0)
+	{
+		Wait();
+
+		m_results.BeginRun(encoding, total_triangles, total_rays);
+
+		m_complete.store(false);
+		m_waited = false;
+
+		m_run = max_run_nonblock(engine, actions);
+		m_thread = std::thread(&AsyncRun::DrainLoop, this);
+	}
+
+	/* true once the status has arrived and every batch has been handed to the consumer */
+	bool Done() const
+	{
+		return m_complete.load(std::memory_order_acquire) && m_full.Empty();
+	}
+
+	/* Non-blocking. If a batch is ready it is returned, and must be given back with Release() once the consumer is finished with it */
+	bool TryPop(result_batch_t*& batch)
+	{
+		return m_full.Pop(batch);
+	}
+
+	void Release(result_batch_t* batch)
+	{
+		batch->count = 0;
+		m_free.Push(batch);
+	}
+
+	/* Blocks, calling consumer for every batch, until the run is complete */
+	void Consume(std::function<void(const intersection_t*, size_t)> consumer)
+	{
+		int idle = 0;
+		while(true)
+		{
+			bool complete = m_complete.load(std::memory_order_acquire);
+
+			result_batch_t* batch;
+			if(TryPop(batch))
+			{
+				consumer(batch->intersections, batch->count);
+				Release(batch);
+				idle = 0;
+				continue;
+			}
+
+			if(complete){
+				break;
+			}
+
+			Backoff(idle++);
+		}
+	}
+
+	/* waits for the drain thread and the run itself to finish */
+	void Wait()
+	{
+		if(m_waited || m_run == NULL){
+			return;
+		}
+		m_waited = true;
+
+		m_thread.join();
+		max_wait(m_run);
+	}
+
+	const report_t& Report() const
+	{
+		return m_status.status_report;
+	}
+
+	Results& GetResults()
+	{
+		return m_results;
+	}
+
+	Status& GetStatus()
+	{
+		return m_status;
+	}
+
+private:
+	void Backoff(int idle)
+	{
+		if(idle < m_spin_rounds)
+		{
+			ASYNC_RUN_PAUSE();
+		}
+		else if(idle < m_spin_rounds + m_yield_rounds)
+		{
+			std::this_thread::yield();
+		}
+		else
+		{
+			int doublings = std::min(idle - (m_spin_rounds + m_yield_rounds), 10);
+			int sleep_us = std::min(m_max_sleep_us, 1 << doublings);
+			std::this_thread::sleep_for(std::chrono::microseconds(sleep_us));
+		}
+	}
+
+	/* gets an empty batch from the pool, waiting for the consumer if there is none. while this waits the ring is not being read, which is what
+	 * applies the backpressure to the DFE */
+	result_batch_t* AcquireBatch()
+	{
+		result_batch_t* batch;
+		int idle = 0;
+		while(!m_free.Pop(batch)){
+			Backoff(idle++);
+		}
+		return batch;
+	}
+
+	void PushBatch(result_batch_t* batch)
+	{
+		int idle = 0;
+		while(!m_full.Push(batch)){
+			Backoff(idle++);
+		}
+	}
+
+	/* called by Results on the drain thread. a full batch is only pushed when more data needs the space, and the last once the run is complete */
+	void Append(const intersection_t* intersections, size_t count)
+	{
+		while(count > 0)
+		{
+			if(m_current == NULL){
+				m_current = AcquireBatch();
+			}
+			else if(m_current->count == m_current->capacity)
+			{
+				PushBatch(m_current);
+				m_current = AcquireBatch();
+			}
+
+			size_t n = std::min(count, m_current->capacity - m_current->count);
+			memcpy(m_current->intersections + m_current->count, intersections, n * sizeof(intersection_t));
+			m_current->count += n;
+
+			intersections += n;
+			count -= n;
+		}
+	}
+
+	void DrainLoop()
+	{
+		int idle = 0;
+		while(true)
+		{
+			size_t slots = m_results.ReadResults();
+
+			if(m_status.ReadStatus())
+			{
+				m_results.ReadResults();
+				break;
+			}
+
+			if(slots > 0){
+				idle = 0;
+			}else{
+				Backoff(idle++);
+			}
+		}
+
+		/* Results holds back the last intersection of a pairs run, which is the serialiser's padding when the count is odd, until it is given the
+		 * count. the encoded modes decode their padding to nothing */
+
+		m_results.TrimToCount(m_status.status_report.intersections);
+
+		/* an empty batch is kept as the current one for the next run, rather than returned to the pool, as only the consumer pushes to m_free */
+
+		if(m_current != NULL && m_current->count > 0)
+		{
+			PushBatch(m_current);
+			m_current = NULL;
+		}
+
+		m_complete.store(true, std::memory_order_release);
+	}
+
+	AsyncRun(const AsyncRun&);
+	AsyncRun& operator=(const AsyncRun&);
+};
+
+#endif /* ASYNCRUN_HPP_ */
@@ -0,0 +1,115 @@
+/*
+ * ClosestHits.hpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#ifndef CLOSESTHITS_HPP_
+#define CLOSESTHITS_HPP_
+
+#include "Maxfiles.h"
+#include "MaxSLiCInterface.h"
+#include <errno.h>
+#include <stdio.h>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include "Types.h"
+#include "Instrumentation.hpp"
+
+/* Receives the output of a closest hit run: one closest_hit_t per ray, in ray order, on the closest_out stream. The run sends exactly one record for
+ * every ray queued (including the padding rays), and nothing on results_out or status_out, so the run is complete once that many have arrived. */
+class ClosestHits
+{
+public:
+	std::vector<closest_hit_t> m_hits;
+
+private:
+	int m_slotSize;
+	int m_numSlots;
+
+	void* m_buffer;
+
+	max_llstream_t* m_stream;
+
+public:
+	ClosestHits(max_file_t* maxfile, max_engine_t* engine, int num_slots = 512)
+	{
+		m_slotSize = 16;
+		m_numSlots = num_slots;
+		m_stream = NULL;
+
+		if(sizeof(closest_hit_t) != (size_t)m_slotSize)
+		{
+			printf("ERROR: closest_hit_t does not match the closest_out slot layout.\n");
+		}
+
+		m_buffer = NULL;
+		if(posix_memalign(&m_buffer, 4096, m_slotSize * m_numSlots) == ENOMEM){
+			printf("Could not allocate memory.");
+		}
+
+		memset(m_buffer, 0, m_slotSize * m_numSlots);
+
+		if(!max_has_handle_stream(maxfile, "closest_out"))
+		{
+			printf("Maxfile does not have a closest_out stream.\n");
+			return;
+		}
+
+		m_stream = max_llstream_setup(engine, "closest_out", m_numSlots, m_slotSize, m_buffer);
+	}
+
+	/* Drains every record currently in the ring into m_hits. Returns the number read */
+	size_t ReadClosestHits()
+	{
+		size_t slots_read = 0;
+
+		while(true)
+		{
+			void* data;
+			ssize_t num_slots_read = max_llstream_read(m_stream, m_numSlots, &data);
+			if(num_slots_read <= 0){
+				break;
+			}
+
+			m_hits.insert(m_hits.end(), (closest_hit_t*)data, ((closest_hit_t*)data) + num_slots_read);
+
+			max_llstream_read_discard(m_stream, num_slots_read);
+			slots_read += num_slots_read;
+		}
+
+		return slots_read;
+	}
+
+	/* Blocks until num_rays more records have arrived, then drops any beyond num_real_rays (the records of the padding rays) */
+	void Collect(size_t num_rays, size_t num_real_rays)
+	{
+		INSTRUMENT_SCOPE("ClosestHits::Collect");
+
+		size_t begin = m_hits.size();
+		while(m_hits.size() < begin + num_rays)
+		{
+			if(ReadClosestHits() == 0){
+				std::this_thread::yield();
+			}
+		}
+
+		m_hits.resize(begin + std::min(num_rays, num_real_rays));
+	}
+
+	void PrintClosestHits()
+	{
+		for(size_t i = 0; i < m_hits.size(); i++)
+		{
+			if(m_hits[i].triangle == CLOSEST_HIT_NONE){
+				printf("Ray: %zu Miss\n", i);
+			}else{
+				printf("Ray: %zu Triangle: %u t: %f u: %f v: %f\n", i, m_hits[i].triangle, m_hits[i].t, m_hits[i].u, m_hits[i].v);
+			}
+		}
+	}
+};
+
+#endif /* CLOSESTHITS_HPP_ */
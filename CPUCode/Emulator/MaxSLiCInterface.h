@@ -0,0 +1,73 @@
+/*
+ * MaxSLiCInterface.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#ifndef MAXSLICINTERFACE_H_
+#define MAXSLICINTERFACE_H_
+
+/* The subset of the SLiC API used by the host code, implemented in software by SLiCEmulator.cpp. The Emulation run rule puts this directory on the
+ * include path ahead of MaxCompiler's own headers, so the host code builds unchanged against either.
+ *
+ * The signatures follow SLiC. As with SLiC, buffers passed to max_queue_input must stay valid until the run has completed. */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct max_file max_file_t;
+typedef struct max_engine max_engine_t;
+typedef struct max_actions max_actions_t;
+typedef struct max_run max_run_t;
+typedef struct max_llstream max_llstream_t;
+typedef struct max_group max_group_t;
+typedef struct max_engarray max_engarray_t;
+
+/* engines */
+
+max_engine_t* max_load(max_file_t* maxfile, const char* engine_id_pattern);
+void max_unload(max_engine_t* engine);
+
+/* maxfile queries */
+
+uint64_t max_get_constant_uint64t(max_file_t* maxfile, const char* name);
+int max_get_burst_size(max_file_t* maxfile, const char* name);
+int max_has_handle_stream(max_file_t* maxfile, const char* name);
+
+/* actions */
+
+max_actions_t* max_actions_init(max_file_t* maxfile, const char* interface_name);
+void max_actions_free(max_actions_t* actions);
+
+void max_set_ticks(max_actions_t* actions, const char* kernel_name, int ticks);
+void max_set_uint64t(max_actions_t* actions, const char* block_name, const char* name, uint64_t value);
+void max_set_param_uint64t(max_actions_t* actions, const char* name, uint64_t value);
+void max_queue_input(max_actions_t* actions, const char* stream_name, const void* data, size_t length);
+void max_ignore_lmem(max_actions_t* actions, const char* stream_name);
+void max_lmem_linear(max_actions_t* actions, const char* stream_name, size_t address, size_t size);
+
+/* running */
+
+void max_run(max_engine_t* engine, max_actions_t* actions);
+max_run_t* max_run_nonblock(max_engine_t* engine, max_actions_t* actions);
+void max_wait(max_run_t* run);
+void max_nowait(max_run_t* run);
+
+/* low latency streams */
+
+max_llstream_t* max_llstream_setup(max_engine_t* engine, const char* stream_name, size_t slots, size_t slot_size, void* buffer);
+ssize_t max_llstream_read(max_llstream_t* llstream, size_t max_slots, void** slot_ptr);
+void max_llstream_read_discard(max_llstream_t* llstream, size_t number_of_slots);
+void max_llstream_release(max_llstream_t* llstream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MAXSLICINTERFACE_H_ */
@@ -0,0 +1,766 @@
+/*
+ * RayTracerModel.hpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#ifndef RAYTRACERMODEL_HPP_
+#define RAYTRACERMODEL_HPP_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include "../Types.h"
+
+/* Functional model of the RayTracer maxfile: MemoryCommandGenerator, RayTracerKernel and ResultsSerialiserKernel. It is tick accurate in what it
+ * computes (which ray and triangle words are tested on each tick, and so which ids the results carry) but not in timing. The kernel ticks are
+ * farmed out to a pool of threads in chunks, and the serialiser emits the chunks in tick order. */
+
+/* the maxfile constants, as RayTracerKernel.AddConstantsToMaxFile sets them */
+#define MODEL_TRIANGLES_IN_WIDTH_IN_BITS	3072
+#define MODEL_TRIANGLES_PER_TICK			10
+#define MODEL_TRIANGLE_WIDTH_IN_BYTES		36
+#define MODEL_RAYS_WORD_WIDTH_IN_BITS		512
+#define MODEL_RAYS_PER_WORD					2
+#define MODEL_RAYS_PER_TICK					2
+#define MODEL_MAX_BURSTS_PER_COMMAND		128
+#define MODEL_BURST_SIZE_IN_BYTES			384
+#define MODEL_OUTPUT_COUNT					(MODEL_TRIANGLES_PER_TICK * MODEL_RAYS_PER_TICK)
+
+/* the triangle format the model is built for, as the triangleFormat engine parameter selects for the DFE (see triangle_format_t). the Emulation run
+ * rule sets it from EMULATED_TRIANGLE_FORMAT */
+#define MODEL_TRIANGLE_FORMAT_VERTICES		0
+#define MODEL_TRIANGLE_FORMAT_EDGES			1
+#ifndef MODEL_TRIANGLE_FORMAT
+#define MODEL_TRIANGLE_FORMAT				MODEL_TRIANGLE_FORMAT_VERTICES
+#endif
+
+/* how the triangles are laid out in LMem, as the trianglePacking engine parameter selects (see triangle_packing_t). the Emulation run rule sets it
+ * from EMULATED_TRIANGLE_PACKING */
+#define MODEL_TRIANGLE_PACKING_PER_BURST	0
+#define MODEL_TRIANGLE_PACKING_CONTINUOUS	1
+#ifndef MODEL_TRIANGLE_PACKING
+#define MODEL_TRIANGLE_PACKING				MODEL_TRIANGLE_PACKING_PER_BURST
+#endif
+
+#define MODEL_RESULT_SLOT_SIZE				16
+#define MODEL_STATUS_SLOT_SIZE				16
+#define MODEL_CLOSEST_SLOT_SIZE				16
+#define MODEL_OCCLUSION_SLOT_SIZE			16
+#define MODEL_OCCLUSION_RAYS_PER_SLOT		128
+
+/* values of the RayTracerKernel query_mode scalar */
+#define MODEL_QUERY_ALL_HITS				0
+#define MODEL_QUERY_CLOSEST_HIT				1
+#define MODEL_QUERY_OCCLUSION				2
+
+/* values of the RayTracerKernel result_encoding scalar */
+#define MODEL_RESULT_ENCODING_PAIRS			0
+#define MODEL_RESULT_ENCODING_MASKS			1
+#define MODEL_RESULT_ENCODING_DELTAS		2
+
+/* a delta record holds a tick's mask in its low bits, and the ticks since the previous record above it */
+#define MODEL_MASK_BITS						MODEL_OUTPUT_COUNT
+#define MODEL_MAX_DELTA						((1u << (32 - MODEL_MASK_BITS)) - 1)
+
+/* the serialiser pads an odd number of results to a whole slot. on the DFE the padding is whatever the selected input holds; the model uses an id
+ * no real job can have, so an untrimmed pad is easy to spot. the encoded modes pad with zeros, on both */
+#define MODEL_PADDING_ID					0xFFFFFFFF
+
+/* everything one default mode run of the maxfile needs */
+struct model_job_t
+{
+	/* MemoryCommandGenerator */
+	u_int64_t command_ticks;
+	u_int64_t triangles_to_read_in_bursts;
+	u_int64_t triangles_offset_in_bursts;
+
+	/* RayTracerKernel */
+	u_int64_t kernel_ticks;
+	u_int64_t total_triangles;
+	u_int64_t total_rays;
+	u_int64_t query_mode;
+	u_int64_t result_encoding;
+
+	const char* lmem;
+	size_t lmem_size;
+
+	const char* rays;
+	size_t rays_size;
+};
+
+/* matches report_t on the host */
+struct model_report_t
+{
+	u_int32_t ticks;
+	u_int32_t intersections;
+	u_int32_t flush_ticks;
+	u_int32_t reserved;
+};
+
+/* blocks until all of the slots have been written to the stream */
+typedef std::function<void(const void* slots, size_t num_slots)> model_stream_writer_t;
+
+struct model_outputs_t
+{
+	model_stream_writer_t results_out;
+	model_stream_writer_t status_out;
+	model_stream_writer_t closest_out;
+	model_stream_writer_t occlusion_out;
+};
+
+class RayTracerModel
+{
+public:
+	int m_num_threads;
+	u_int64_t m_ticks_per_chunk;
+
+private:
+	/* the results of a range of kernel ticks, in the order the serialiser will send them. in the encoded modes hits holds a (tick, mask) pair for
+	 * each tick that hit anything */
+	struct chunk_t
+	{
+		std::vector<intersection_t> hits;
+		std::vector<closest_hit_t> closest;
+		std::vector<u_int64_t> occlusion;
+		bool ready;
+	};
+
+public:
+	RayTracerModel()
+	{
+		m_num_threads = std::max(1, (int)std::thread::hardware_concurrency());
+		m_ticks_per_chunk = 16384;
+
+		const char* threads = getenv("RAYTRACER_EMULATOR_THREADS");
+		if(threads != NULL && atoi(threads) > 0){
+			m_num_threads = atoi(threads);
+		}
+	}
+
+	/* The RayTracerKernel datapath, operation for operation (see PerformIntersectionTest and KernelVectorMath). Note the bounds are not the same
+	 * as the CPU engine's: there is no epsilon, and u and v must be strictly positive. An edges build reads the edges from LMem, in place of v1 and
+	 * v2. */
+	static bool IntersectionTest(const ray_t& ray, const triangle_t& triangle, float* t_out = NULL, float* u_out = NULL, float* v_out = NULL)
+	{
+#if MODEL_TRIANGLE_FORMAT == MODEL_TRIANGLE_FORMAT_EDGES
+		vector3 e1 = triangle.v1;
+		vector3 e2 = triangle.v2;
+#else
+		vector3 e1 = Sub(triangle.v1, triangle.v0);
+		vector3 e2 = Sub(triangle.v2, triangle.v0);
+#endif
+
+		vector3 P = Cross(ray.direction, e2);
+		float det = Dot(e1, P);
+
+		bool valid = (det != 0.f);
+
+		float inv_det = 1.f / det;
+
+		vector3 T = Sub(ray.origin, triangle.v0);
+
+		float u = Dot(T, P) * inv_det;
+		valid = valid & (u > 0.f) & (u <= 1.f);
+
+		vector3 Q = Cross(T, e1);
+
+		float v = Dot(ray.direction, Q) * inv_det;
+		valid = valid & (v > 0.f) & (u + v <= 1.f);
+
+		float t = Dot(e2, Q) * inv_det;
+		valid = valid & (t > 0.f);
+
+		if(t_out) *t_out = t;
+		if(u_out) *u_out = u;
+		if(v_out) *v_out = v;
+
+		return valid;
+	}
+
+	/* Runs the job. For all hits, writes the results and then the status report; for closest hit, one record per ray and nothing else. Returns
+	 * false if the kernel would have stalled waiting for input that was never queued - on the DFE the run would never complete. */
+	bool Run(const model_job_t& job, const model_outputs_t& outputs)
+	{
+		bool closest = (job.query_mode == MODEL_QUERY_CLOSEST_HIT);
+		bool occlusion = (job.query_mode == MODEL_QUERY_OCCLUSION);
+		bool masks = !closest && !occlusion && (job.result_encoding == MODEL_RESULT_ENCODING_MASKS);
+		bool deltas = !closest && !occlusion && (job.result_encoding == MODEL_RESULT_ENCODING_DELTAS);
+
+		bool complete = true;
+
+		u_int64_t ticks = job.kernel_ticks;
+		u_int64_t available = AvailableTicks(job);
+		if(available < ticks)
+		{
+			printf("EMULATOR ERROR: RayTracerKernel was set to run for %llu ticks, but its inputs only cover %llu. On the DFE this run would stall.\n",
+					(unsigned long long)ticks, (unsigned long long)available);
+			ticks = available;
+			complete = false;
+		}
+
+		/* closest hit reduces over a whole pass of the triangles, so its chunks are whole passes. occlusion chunks are whole batches of passes,
+		 * one mask slot each */
+
+		u_int64_t ticks_per_chunk = m_ticks_per_chunk;
+		if(closest || occlusion)
+		{
+			u_int64_t words_per_pass = std::max((u_int64_t)1, job.total_triangles / MODEL_TRIANGLES_PER_TICK);
+			u_int64_t passes_per_unit = occlusion ? (MODEL_OCCLUSION_RAYS_PER_SLOT / MODEL_RAYS_PER_TICK) : 1;
+			u_int64_t ticks_per_unit = words_per_pass * passes_per_unit;
+			ticks_per_chunk = std::max((u_int64_t)1, ticks_per_chunk / ticks_per_unit) * ticks_per_unit;
+		}
+
+		u_int64_t num_chunks = (ticks + ticks_per_chunk - 1) / ticks_per_chunk;
+		std::vector<chunk_t> chunks(num_chunks);
+		for(size_t i = 0; i < chunks.size(); i++){
+			chunks[i].ready = false;
+		}
+
+		/* workers stay at most a few chunks ahead of the serialiser, so a slow reader bounds the memory used rather than the model buffering the
+		 * whole result set */
+
+		std::mutex mutex;
+		std::condition_variable changed;
+		std::atomic<u_int64_t> next_chunk(0);
+		u_int64_t serialised = 0;
+		u_int64_t window = 2 * m_num_threads;
+
+		auto worker = [&]()
+		{
+			while(true)
+			{
+				u_int64_t c = next_chunk++;
+				if(c >= num_chunks){
+					break;
+				}
+
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					changed.wait(lock, [&]{ return c < serialised + window; });
+				}
+
+				u_int64_t begin = c * ticks_per_chunk;
+				u_int64_t end = std::min(ticks, begin + ticks_per_chunk);
+				if(closest){
+					RunClosestTicks(job, begin, end, chunks[c].closest);
+				}else if(occlusion){
+					RunOcclusionTicks(job, begin, end, chunks[c].occlusion);
+				}else if(masks || deltas){
+					RunMaskTicks(job, begin, end, chunks[c].hits);
+				}else{
+					RunTicks(job, begin, end, chunks[c].hits);
+				}
+
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					chunks[c].ready = true;
+				}
+				changed.notify_all();
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for(int i = 0; i < m_num_threads; i++){
+			threads.push_back(std::thread(worker));
+		}
+
+		/* ResultsSerialiserKernel: two results per slot, padding the last slot if the count is odd, then the report */
+
+		u_int64_t intersections = 0;
+		bool pending = false;
+		intersection_t held;
+
+		/* for deltas, the kernel pairs up 32 bit records into the units the serialiser sends */
+
+		delta_state_t delta_state;
+		std::vector<intersection_t> units;
+
+		for(u_int64_t c = 0; c < num_chunks; c++)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				changed.wait(lock, [&]{ return chunks[c].ready; });
+			}
+
+			if(closest)
+			{
+				if(!chunks[c].closest.empty()){
+					outputs.closest_out(&chunks[c].closest[0], chunks[c].closest.size());
+				}
+				std::vector<closest_hit_t>().swap(chunks[c].closest);
+			}
+
+			if(occlusion)
+			{
+				if(!chunks[c].occlusion.empty()){
+					outputs.occlusion_out(&chunks[c].occlusion[0], chunks[c].occlusion.size() / (MODEL_OCCLUSION_SLOT_SIZE / sizeof(u_int64_t)));
+				}
+				std::vector<u_int64_t>().swap(chunks[c].occlusion);
+			}
+
+			if(deltas)
+			{
+				units.clear();
+				EncodeDeltas(chunks[c].hits, delta_state, units);
+				chunks[c].hits.swap(units);
+			}
+
+			std::vector<intersection_t>& hits = chunks[c].hits;
+			intersections += hits.size();
+
+			/* a result held over from the previous chunk is paired with the first of this one */
+
+			size_t first = 0;
+			if(pending && !hits.empty())
+			{
+				intersection_t slot[2] = { held, hits[0] };
+				outputs.results_out(slot, 1);
+				pending = false;
+				first = 1;
+			}
+
+			size_t whole_slots = (hits.size() - first) / 2;
+			if(whole_slots > 0){
+				outputs.results_out(&hits[first], whole_slots);
+			}
+
+			if(first + whole_slots * 2 < hits.size())
+			{
+				held = hits.back();
+				pending = true;
+			}
+
+			std::vector<intersection_t>().swap(hits);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				serialised = c + 1;
+			}
+			changed.notify_all();
+		}
+
+		for(size_t i = 0; i < threads.size(); i++){
+			threads[i].join();
+		}
+
+		/* the serialiser only flushes and reports when the kernel signals completion, which closest hit and occlusion runs do not */
+
+		if(closest || occlusion){
+			return complete;
+		}
+
+		/* the last delta records: the empty ones up to the end of the run, and the one left without a partner */
+
+		if(deltas)
+		{
+			units.clear();
+			FinishDeltas(ticks, delta_state, units);
+			intersections += units.size();
+
+			if(pending && !units.empty())
+			{
+				intersection_t slot[2] = { held, units[0] };
+				outputs.results_out(slot, 1);
+				units.erase(units.begin());
+				pending = false;
+			}
+			if(units.size() >= 2){
+				outputs.results_out(&units[0], units.size() / 2);
+			}
+			if(units.size() % 2 == 1)
+			{
+				held = units.back();
+				pending = true;
+			}
+		}
+
+		if(pending)
+		{
+			intersection_t slot[2] = { held, held };
+			slot[1].ray = (masks || deltas) ? 0 : MODEL_PADDING_ID;
+			slot[1].triangle = (masks || deltas) ? 0 : MODEL_PADDING_ID;
+			outputs.results_out(slot, 1);
+		}
+
+		/* the tick counts are an estimate, as the model is not cycle accurate: the serialiser sends at most one result a tick, so once the kernel is
+		 * done it drains whatever it could not keep up with, then goes round the empty inputs three times before reporting */
+
+		u_int64_t backlog = (intersections > ticks) ? (intersections - ticks) : 0;
+		u_int64_t flush_ticks = backlog + MODEL_OUTPUT_COUNT * 3 + 2;
+
+		model_report_t report;
+		report.ticks = (u_int32_t)std::min((u_int64_t)0xFFFFFFFF, ticks + flush_ticks);
+		report.intersections = (u_int32_t)intersections;
+		report.flush_ticks = (u_int32_t)std::min((u_int64_t)0xFFFFFFFF, flush_ticks);
+		report.reserved = 0;
+		outputs.status_out(&report, 1);
+
+		return complete;
+	}
+
+private:
+	/* the kernel reads one triangle word every tick and one ray word every time the triangle counter wraps. returns how many ticks the queued rays
+	 * and the memory commands can feed */
+	static u_int64_t AvailableTicks(const model_job_t& job)
+	{
+		u_int64_t words_per_pass = job.total_triangles / MODEL_TRIANGLES_PER_TICK;
+		u_int64_t triangle_words = (job.command_ticks * job.triangles_to_read_in_bursts * MODEL_BURST_SIZE_IN_BYTES) / TriangleTickSize();
+		u_int64_t ray_words = job.rays_size / (MODEL_RAYS_WORD_WIDTH_IN_BITS / 8);
+
+		if(words_per_pass == 0){
+			return 0;
+		}
+
+		return std::min(triangle_words, ray_words * words_per_pass);
+	}
+
+	static size_t TriangleWordSize()
+	{
+		return MODEL_TRIANGLES_IN_WIDTH_IN_BITS / 8;
+	}
+
+	/* the bytes of the stream the triangles of one tick take: a whole word per burst, or just the triangles when they are packed continuously */
+	static size_t TriangleTickSize()
+	{
+#if MODEL_TRIANGLE_PACKING == MODEL_TRIANGLE_PACKING_CONTINUOUS
+		return MODEL_TRIANGLES_PER_TICK * MODEL_TRIANGLE_WIDTH_IN_BYTES;
+#else
+		return TriangleWordSize();
+#endif
+	}
+
+	/* The kernel's unpack stage for continuous packing (RayTracerKernel.UnpackTriangles), as tables over the ticks of a period: whether a word is
+	 * read on each, how many have been read by the end of it, and where in the last two words read its triangles start */
+	struct unpack_tables_t
+	{
+		u_int64_t period;
+		u_int64_t words_per_period;
+		std::vector<bool> reads;
+		std::vector<u_int64_t> words_read;
+		std::vector<u_int64_t> offsets;
+
+		unpack_tables_t()
+		{
+			u_int64_t word_size = TriangleWordSize();
+			u_int64_t tick_size = TriangleTickSize();
+
+			period = LeastCommonMultiple(tick_size, word_size) / tick_size;
+			words_per_period = LeastCommonMultiple(tick_size, word_size) / word_size;
+
+			u_int64_t read = 0;
+			for(u_int64_t k = 0; k < period; k++)
+			{
+				u_int64_t begin = k * tick_size;
+				u_int64_t words_before = (begin + word_size - 1) / word_size;
+				u_int64_t words_after = (begin + tick_size + word_size - 1) / word_size;
+
+				reads.push_back(words_after > words_before);
+				read += reads.back() ? 1 : 0;
+				words_read.push_back(read);
+				offsets.push_back(begin + (2 * word_size) - (words_after * word_size));
+			}
+		}
+	};
+
+	/* where in the stream the triangles of a tick start. continuously packed, this follows the unpack stage's tables, the words it has read and the
+	 * offset into the last two, rather than simply tick * TriangleTickSize(), so emulated runs check the tables the kernel is built from */
+	static u_int64_t TickPosition(u_int64_t tick)
+	{
+#if MODEL_TRIANGLE_PACKING == MODEL_TRIANGLE_PACKING_CONTINUOUS
+		static const unpack_tables_t tables;
+
+		u_int64_t k = tick % tables.period;
+		u_int64_t words_read = ((tick / tables.period) * tables.words_per_period) + tables.words_read[k];
+		return ((words_read - 2) * TriangleWordSize()) + tables.offsets[k];
+#else
+		return tick * TriangleWordSize();
+#endif
+	}
+
+	/* The triangle stream is the concatenation of the bursts read by each memory command; every command reads the same range of LMem. Returns a
+	 * pointer to the triangles tested on the given tick, copying them into scratch if they straddle two commands. Reads past the end of LMem return
+	 * zeros, as unwritten memory would. */
+	static const triangle_t* TriangleWord(const model_job_t& job, u_int64_t tick, char* scratch)
+	{
+		size_t word_size = TriangleTickSize();
+		u_int64_t command_size = job.triangles_to_read_in_bursts * MODEL_BURST_SIZE_IN_BYTES;
+		u_int64_t base = job.triangles_offset_in_bursts * MODEL_BURST_SIZE_IN_BYTES;
+
+		u_int64_t position = TickPosition(tick);
+		u_int64_t within = position % command_size;
+
+		if(within + word_size <= command_size && base + within + word_size <= job.lmem_size){
+			return (const triangle_t*)(job.lmem + base + within);
+		}
+
+		for(size_t i = 0; i < word_size; i++)
+		{
+			u_int64_t address = base + ((position + i) % command_size);
+			scratch[i] = (address < job.lmem_size) ? job.lmem[address] : 0;
+		}
+		return (const triangle_t*)scratch;
+	}
+
+	static void RunTicks(const model_job_t& job, u_int64_t begin, u_int64_t end, std::vector<intersection_t>& hits)
+	{
+		u_int64_t words_per_pass = job.total_triangles / MODEL_TRIANGLES_PER_TICK;
+		size_t ray_word_size = MODEL_RAYS_WORD_WIDTH_IN_BITS / 8;
+
+		std::vector<char> scratch(TriangleWordSize());
+
+		for(u_int64_t tick = begin; tick < end; tick++)
+		{
+			/* the counter chain: the ray counter is the outer one, the triangle counter the inner */
+
+			u_int64_t pass = tick / words_per_pass;
+			u_int32_t ray_offset = (u_int32_t)(pass * MODEL_RAYS_PER_TICK);
+			u_int32_t triangle_offset = (u_int32_t)((tick % words_per_pass) * MODEL_TRIANGLES_PER_TICK);
+
+			const ray_t* rays = (const ray_t*)(job.rays + pass * ray_word_size);
+			const triangle_t* triangles = TriangleWord(job, tick, &scratch[0]);
+
+			for(int r = 0; r < MODEL_RAYS_PER_TICK; r++){
+			for(int t = 0; t < MODEL_TRIANGLES_PER_TICK; t++)
+			{
+				if(IntersectionTest(rays[r], triangles[t]))
+				{
+					intersection_t hit;
+					hit.ray = ray_offset + r;
+					hit.triangle = triangle_offset + t;
+					hits.push_back(hit);
+				}
+			}
+			}
+		}
+	}
+
+	/* Masks and deltas: the tick and a mask of the hits of each tick that hit anything, bit (r * MODEL_TRIANGLES_PER_TICK) + t for ray r and
+	 * triangle t of the tick */
+	static void RunMaskTicks(const model_job_t& job, u_int64_t begin, u_int64_t end, std::vector<intersection_t>& records)
+	{
+		u_int64_t words_per_pass = job.total_triangles / MODEL_TRIANGLES_PER_TICK;
+		size_t ray_word_size = MODEL_RAYS_WORD_WIDTH_IN_BITS / 8;
+
+		std::vector<char> scratch(TriangleWordSize());
+
+		for(u_int64_t tick = begin; tick < end; tick++)
+		{
+			u_int64_t pass = tick / words_per_pass;
+
+			const ray_t* rays = (const ray_t*)(job.rays + pass * ray_word_size);
+			const triangle_t* triangles = TriangleWord(job, tick, &scratch[0]);
+
+			u_int32_t mask = 0;
+			for(int r = 0; r < MODEL_RAYS_PER_TICK; r++){
+			for(int t = 0; t < MODEL_TRIANGLES_PER_TICK; t++)
+			{
+				if(IntersectionTest(rays[r], triangles[t])){
+					mask |= 1u << ((r * MODEL_TRIANGLES_PER_TICK) + t);
+				}
+			}
+			}
+
+			if(mask != 0)
+			{
+				intersection_t record;
+				record.ray = (u_int32_t)tick;
+				record.triangle = mask;
+				records.push_back(record);
+			}
+		}
+	}
+
+	/* the kernel's delta coder: the tick after the last record sent, and a record waiting for its partner */
+	struct delta_state_t
+	{
+		u_int64_t next_tick;
+		bool holding;
+		u_int32_t held;
+
+		delta_state_t()
+		{
+			next_tick = 0;
+			holding = false;
+			held = 0;
+		}
+	};
+
+	static void PushDelta(u_int32_t record, delta_state_t& state, std::vector<intersection_t>& units)
+	{
+		if(!state.holding)
+		{
+			state.held = record;
+			state.holding = true;
+			return;
+		}
+
+		intersection_t unit;
+		unit.ray = state.held;
+		unit.triangle = record;
+		units.push_back(unit);
+		state.holding = false;
+	}
+
+	/* turns (tick, mask) records into delta records, with an empty record whenever MODEL_MAX_DELTA ticks go by without one, paired into units */
+	static void EncodeDeltas(const std::vector<intersection_t>& records, delta_state_t& state, std::vector<intersection_t>& units)
+	{
+		for(size_t i = 0; i < records.size(); i++)
+		{
+			u_int64_t tick = records[i].ray;
+			while(tick + 1 - state.next_tick > MODEL_MAX_DELTA)
+			{
+				PushDelta(MODEL_MAX_DELTA << MODEL_MASK_BITS, state, units);
+				state.next_tick += MODEL_MAX_DELTA;
+			}
+
+			PushDelta((u_int32_t)(((tick + 1 - state.next_tick) << MODEL_MASK_BITS) | records[i].triangle), state, units);
+			state.next_tick = tick + 1;
+		}
+	}
+
+	/* the empty records up to the end of the run, then on the last tick the held record goes out with an empty partner */
+	static void FinishDeltas(u_int64_t ticks, delta_state_t& state, std::vector<intersection_t>& units)
+	{
+		while(state.next_tick + MODEL_MAX_DELTA <= ticks)
+		{
+			PushDelta(MODEL_MAX_DELTA << MODEL_MASK_BITS, state, units);
+			state.next_tick += MODEL_MAX_DELTA;
+		}
+
+		if(state.holding){
+			PushDelta(0, state, units);
+		}
+	}
+
+	/* Closest hit: each tick the nearest of the ten candidates of each ray is found, and folded into the nearest so far for that ray. The DFE
+	 * interleaves this over several partial results to hide the latency of the loop, but as ties go to the lower triangle index the result is the
+	 * same. On the last word of a pass a record is sent for each ray. begin must be the first tick of a pass. */
+	static void RunClosestTicks(const model_job_t& job, u_int64_t begin, u_int64_t end, std::vector<closest_hit_t>& records)
+	{
+		u_int64_t words_per_pass = job.total_triangles / MODEL_TRIANGLES_PER_TICK;
+		size_t ray_word_size = MODEL_RAYS_WORD_WIDTH_IN_BITS / 8;
+
+		std::vector<char> scratch(TriangleWordSize());
+
+		closest_hit_t none;
+		none.triangle = CLOSEST_HIT_NONE;
+		none.t = 0;
+		none.u = 0;
+		none.v = 0;
+
+		closest_hit_t nearest[MODEL_RAYS_PER_TICK];
+
+		for(u_int64_t tick = begin; tick < end; tick++)
+		{
+			u_int64_t pass = tick / words_per_pass;
+			u_int64_t word = tick % words_per_pass;
+			u_int32_t triangle_offset = (u_int32_t)(word * MODEL_TRIANGLES_PER_TICK);
+
+			if(word == 0){
+				std::fill(nearest, nearest + MODEL_RAYS_PER_TICK, none);
+			}
+
+			const ray_t* rays = (const ray_t*)(job.rays + pass * ray_word_size);
+			const triangle_t* triangles = TriangleWord(job, tick, &scratch[0]);
+
+			for(int r = 0; r < MODEL_RAYS_PER_TICK; r++){
+			for(int t = 0; t < MODEL_TRIANGLES_PER_TICK; t++)
+			{
+				closest_hit_t hit;
+				hit.triangle = triangle_offset + t;
+				if(IntersectionTest(rays[r], triangles[t], &hit.t, &hit.u, &hit.v) && hit.IsNearerThan(nearest[r])){
+					nearest[r] = hit;
+				}
+			}
+			}
+
+			if(word == words_per_pass - 1){
+				records.insert(records.end(), nearest, nearest + MODEL_RAYS_PER_TICK);
+			}
+		}
+	}
+
+	/* Occlusion: a ray is blocked if any triangle in the pass hits it between its tmin and tmax. The bits of consecutive passes fill a mask slot,
+	 * which is sent when full or on the last pass of the job. begin must be the first tick of a batch of passes. */
+	static void RunOcclusionTicks(const model_job_t& job, u_int64_t begin, u_int64_t end, std::vector<u_int64_t>& masks)
+	{
+		u_int64_t words_per_pass = job.total_triangles / MODEL_TRIANGLES_PER_TICK;
+		u_int64_t passes_per_slot = MODEL_OCCLUSION_RAYS_PER_SLOT / MODEL_RAYS_PER_TICK;
+		u_int64_t last_pass = (job.total_rays / MODEL_RAYS_PER_TICK) - 1;
+		size_t ray_word_size = MODEL_RAYS_WORD_WIDTH_IN_BITS / 8;
+
+		std::vector<char> scratch(TriangleWordSize());
+
+		u_int64_t slot[MODEL_OCCLUSION_SLOT_SIZE / sizeof(u_int64_t)];
+		bool occluded[MODEL_RAYS_PER_TICK];
+
+		for(u_int64_t tick = begin; tick < end; tick++)
+		{
+			u_int64_t pass = tick / words_per_pass;
+			u_int64_t word = tick % words_per_pass;
+			u_int64_t pass_in_slot = pass % passes_per_slot;
+
+			if(word == 0)
+			{
+				std::fill(occluded, occluded + MODEL_RAYS_PER_TICK, false);
+				if(pass_in_slot == 0){
+					memset(slot, 0, sizeof(slot));
+				}
+			}
+
+			const ray_t* rays = (const ray_t*)(job.rays + pass * ray_word_size);
+			const triangle_t* triangles = TriangleWord(job, tick, &scratch[0]);
+
+			for(int r = 0; r < MODEL_RAYS_PER_TICK; r++){
+			for(int t = 0; t < MODEL_TRIANGLES_PER_TICK; t++)
+			{
+				float distance;
+				if(IntersectionTest(rays[r], triangles[t], &distance) && distance >= rays[r].tmin && distance <= rays[r].tmax){
+					occluded[r] = true;
+				}
+			}
+			}
+
+			if(word == words_per_pass - 1)
+			{
+				for(int r = 0; r < MODEL_RAYS_PER_TICK; r++)
+				{
+					u_int64_t bit = pass_in_slot * MODEL_RAYS_PER_TICK + r;
+					if(occluded[r]){
+						slot[bit / 64] |= ((u_int64_t)1) << (bit % 64);
+					}
+				}
+
+				if(pass_in_slot == passes_per_slot - 1 || pass == last_pass){
+					masks.insert(masks.end(), slot, slot + (MODEL_OCCLUSION_SLOT_SIZE / sizeof(u_int64_t)));
+				}
+			}
+		}
+	}
+
+	static vector3 Sub(const vector3& a, const vector3& b)
+	{
+		return vector3(a.x - b.x, a.y - b.y, a.z - b.z);
+	}
+
+	static vector3 Cross(const vector3& a, const vector3& b)
+	{
+		return vector3((a.y * b.z) - (a.z * b.y), (a.z * b.x) - (a.x * b.z), (a.x * b.y) - (a.y * b.x));
+	}
+
+	static float Dot(const vector3& a, const vector3& b)
+	{
+		return (a.x * b.x) + (a.y * b.y) + (a.z * b.z);
+	}
+};
+
+#endif /* RAYTRACERMODEL_HPP_ */
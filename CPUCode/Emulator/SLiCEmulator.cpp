@@ -0,0 +1,532 @@
+/*
+ * SLiCEmulator.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+/* Software stand-in for SLiC and the RayTracer maxfile, so the host code can be built and run without a simulator licence or a card. Build with
+ * RUNRULE=Emulation.
+ *
+ * Engines have their own LMem and low latency streams. Runs on an engine execute one at a time, in the order they were started, each on its own
+ * thread; the kernels themselves are modelled by RayTracerModel. Every max_load is a separate engine, whatever the pattern, so several loads behave
+ * as several cards running in parallel, and share the host's cores between their models. As with SLiC, misuse of the API (unknown streams, scalars or constants) is an
+ * error that stops the program. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <map>
+#include <set>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include "MaxSLiCInterface.h"
+#include "RayTracerModel.hpp"
+
+static void Fail(const char* what, const char* name)
+{
+	fprintf(stderr, "EMULATOR ERROR: %s '%s'\n", what, name ? name : "(null)");
+	exit(1);
+}
+
+/* the maxfile: its constants and the names of the blocks and streams the actions may refer to */
+struct max_file
+{
+	std::map<std::string, u_int64_t> constants;
+	std::set<std::string> interfaces;
+	std::set<std::string> scalars;
+	std::set<std::string> kernels;
+	std::set<std::string> input_streams;
+	std::set<std::string> lmem_streams;
+	std::set<std::string> handle_streams;
+	std::set<std::string> params;
+	int burst_size;
+};
+
+struct lmem_access_t
+{
+	size_t address;
+	size_t size;
+};
+
+struct input_t
+{
+	const char* data;
+	size_t size;
+};
+
+struct max_actions
+{
+	max_file_t* maxfile;
+	std::string interface_name;
+
+	std::map<std::string, int> ticks;
+	std::map<std::string, u_int64_t> scalars;
+	std::map<std::string, u_int64_t> params;
+	std::map<std::string, input_t> inputs;
+	std::map<std::string, lmem_access_t> lmem;
+};
+
+/* A host ring buffer. Slots are written by the run thread and read in place by the host; written and discarded only ever increase, and the
+ * writer blocks while the ring is full, which is how a slow host stalls the model just as it would stall the DFE. */
+struct max_llstream
+{
+	char* buffer;
+	size_t slots;
+	size_t slot_size;
+
+	std::atomic<size_t> written;
+	std::atomic<size_t> discarded;
+
+	std::mutex mutex;
+	std::condition_variable space;
+
+	void Write(const void* data, size_t num_slots)
+	{
+		const char* src = (const char*)data;
+		while(num_slots > 0)
+		{
+			size_t w = written.load(std::memory_order_relaxed);
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				space.wait(lock, [&]{ return (w - discarded.load(std::memory_order_acquire)) < slots; });
+			}
+
+			size_t free = slots - (w - discarded.load(std::memory_order_acquire));
+			size_t position = w % slots;
+			size_t n = std::min(num_slots, std::min(free, slots - position));
+
+			memcpy(buffer + position * slot_size, src, n * slot_size);
+			written.store(w + n, std::memory_order_release);
+
+			src += n * slot_size;
+			num_slots -= n;
+		}
+	}
+
+	/* only contiguous slots are returned, so data that wraps around the end of the ring takes two reads, as with SLiC */
+	ssize_t Read(size_t max_slots, void** slot_ptr)
+	{
+		size_t d = discarded.load(std::memory_order_relaxed);
+		size_t available = written.load(std::memory_order_acquire) - d;
+		size_t position = d % slots;
+
+		*slot_ptr = buffer + position * slot_size;
+		return std::min(max_slots, std::min(available, slots - position));
+	}
+
+	void Discard(size_t num_slots)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			discarded.fetch_add(num_slots, std::memory_order_release);
+		}
+		space.notify_all();
+	}
+};
+
+struct max_engine
+{
+	max_file_t* maxfile;
+
+	std::vector<char> lmem;
+	std::map<std::string, max_llstream_t*> llstreams;
+	std::vector<max_llstream_t*> retired;
+
+	/* runs execute in the order they were started */
+	std::mutex mutex;
+	std::condition_variable turn;
+	u_int64_t next_ticket;
+	u_int64_t serving;
+
+	RayTracerModel model;
+	int model_threads;
+};
+
+/* the number of engines loaded, which share the model threads */
+static std::atomic<int> s_num_engines(0);
+
+struct max_run
+{
+	std::thread thread;
+};
+
+/******************************************************************************************************************************************************/
+/* the maxfile */
+
+static max_file_t* s_maxfile = NULL;
+
+extern "C" max_file_t* RayTracer_init(void)
+{
+	if(s_maxfile != NULL){
+		return s_maxfile;
+	}
+
+	max_file_t* maxfile = new max_file_t;
+
+	maxfile->constants["TrianglesInWidthInBits"] = MODEL_TRIANGLES_IN_WIDTH_IN_BITS;
+	maxfile->constants["TrianglesPerTick"] = MODEL_TRIANGLES_PER_TICK;
+	maxfile->constants["TriangleWidthInBytes"] = MODEL_TRIANGLE_WIDTH_IN_BYTES;
+	maxfile->constants["RaysWordWidthInBits"] = MODEL_RAYS_WORD_WIDTH_IN_BITS;
+	maxfile->constants["RaysPerWord"] = MODEL_RAYS_PER_WORD;
+	maxfile->constants["RaysPerTick"] = MODEL_RAYS_PER_TICK;
+	maxfile->constants["MaxBurstsPerCommand"] = MODEL_MAX_BURSTS_PER_COMMAND;
+	maxfile->constants["TriangleFormat"] = MODEL_TRIANGLE_FORMAT;
+	maxfile->constants["TrianglePacking"] = MODEL_TRIANGLE_PACKING;
+	maxfile->constants["PCIE_ALIGNMENT"] = 16;
+
+	maxfile->interfaces.insert("default");
+	maxfile->interfaces.insert("memoryInitialisation");
+
+	maxfile->kernels.insert("MemoryCommandGenerator");
+	maxfile->kernels.insert("RayTracerKernel");
+	maxfile->kernels.insert("ResultsProcessorKernel");
+
+	maxfile->scalars.insert("MemoryCommandGenerator.triangles_to_read_in_bursts");
+	maxfile->scalars.insert("MemoryCommandGenerator.triangles_offset_in_bursts");
+	maxfile->scalars.insert("RayTracerKernel.total_triangles");
+	maxfile->scalars.insert("RayTracerKernel.total_rays");
+	maxfile->scalars.insert("RayTracerKernel.query_mode");
+	maxfile->scalars.insert("RayTracerKernel.result_encoding");
+
+	maxfile->input_streams.insert("triangles_in");
+	maxfile->input_streams.insert("rays_in");
+	maxfile->lmem_streams.insert("triangles_to_mem");
+	maxfile->handle_streams.insert("results_out");
+	maxfile->handle_streams.insert("status_out");
+	maxfile->handle_streams.insert("closest_out");
+	maxfile->handle_streams.insert("occlusion_out");
+
+	maxfile->params.insert("address");
+	maxfile->params.insert("size");
+
+	maxfile->burst_size = MODEL_BURST_SIZE_IN_BYTES;
+
+	s_maxfile = maxfile;
+	return maxfile;
+}
+
+extern "C" void RayTracer_free(void)
+{
+	delete s_maxfile;
+	s_maxfile = NULL;
+}
+
+extern "C" uint64_t max_get_constant_uint64t(max_file_t* maxfile, const char* name)
+{
+	std::map<std::string, u_int64_t>::iterator constant = maxfile->constants.find(name);
+	if(constant == maxfile->constants.end()){
+		Fail("the maxfile has no constant", name);
+	}
+	return constant->second;
+}
+
+extern "C" int max_get_burst_size(max_file_t* maxfile, const char*)
+{
+	return maxfile->burst_size;
+}
+
+extern "C" int max_has_handle_stream(max_file_t* maxfile, const char* name)
+{
+	return maxfile->handle_streams.count(name) > 0;
+}
+
+/******************************************************************************************************************************************************/
+/* engines */
+
+extern "C" max_engine_t* max_load(max_file_t* maxfile, const char*)
+{
+	max_engine_t* engine = new max_engine_t;
+	engine->maxfile = maxfile;
+	engine->next_ticket = 0;
+	engine->serving = 0;
+	engine->model_threads = engine->model.m_num_threads;
+	s_num_engines++;
+	return engine;
+}
+
+extern "C" void max_unload(max_engine_t* engine)
+{
+	/* wait for anything still running */
+
+	{
+		std::unique_lock<std::mutex> lock(engine->mutex);
+		engine->turn.wait(lock, [&]{ return engine->serving == engine->next_ticket; });
+	}
+
+	for(std::map<std::string, max_llstream_t*>::iterator s = engine->llstreams.begin(); s != engine->llstreams.end(); s++){
+		delete s->second;
+	}
+	for(size_t i = 0; i < engine->retired.size(); i++){
+		delete engine->retired[i];
+	}
+	delete engine;
+	s_num_engines--;
+}
+
+/******************************************************************************************************************************************************/
+/* actions */
+
+extern "C" max_actions_t* max_actions_init(max_file_t* maxfile, const char* interface_name)
+{
+	std::string name = (interface_name == NULL) ? "default" : interface_name;
+	if(maxfile->interfaces.count(name) == 0){
+		Fail("the maxfile has no engine interface", interface_name);
+	}
+
+	max_actions_t* actions = new max_actions_t;
+	actions->maxfile = maxfile;
+	actions->interface_name = name;
+	return actions;
+}
+
+extern "C" void max_actions_free(max_actions_t* actions)
+{
+	delete actions;
+}
+
+extern "C" void max_set_ticks(max_actions_t* actions, const char* kernel_name, int ticks)
+{
+	if(actions->maxfile->kernels.count(kernel_name) == 0){
+		Fail("the maxfile has no kernel", kernel_name);
+	}
+	actions->ticks[kernel_name] = ticks;
+}
+
+extern "C" void max_set_uint64t(max_actions_t* actions, const char* block_name, const char* name, uint64_t value)
+{
+	std::string scalar = std::string(block_name) + "." + name;
+	if(actions->maxfile->scalars.count(scalar) == 0){
+		Fail("the maxfile has no scalar input", scalar.c_str());
+	}
+	actions->scalars[scalar] = value;
+}
+
+extern "C" void max_set_param_uint64t(max_actions_t* actions, const char* name, uint64_t value)
+{
+	if(actions->maxfile->params.count(name) == 0){
+		Fail("the engine interface has no parameter", name);
+	}
+	actions->params[name] = value;
+}
+
+extern "C" void max_queue_input(max_actions_t* actions, const char* stream_name, const void* data, size_t length)
+{
+	if(actions->maxfile->input_streams.count(stream_name) == 0){
+		Fail("the maxfile has no input stream", stream_name);
+	}
+
+	input_t input;
+	input.data = (const char*)data;
+	input.size = length;
+	actions->inputs[stream_name] = input;
+}
+
+extern "C" void max_ignore_lmem(max_actions_t* actions, const char* stream_name)
+{
+	if(actions->maxfile->lmem_streams.count(stream_name) == 0){
+		Fail("the maxfile has no LMem stream", stream_name);
+	}
+	actions->lmem.erase(stream_name);
+}
+
+extern "C" void max_lmem_linear(max_actions_t* actions, const char* stream_name, size_t address, size_t size)
+{
+	if(actions->maxfile->lmem_streams.count(stream_name) == 0){
+		Fail("the maxfile has no LMem stream", stream_name);
+	}
+
+	lmem_access_t access;
+	access.address = address;
+	access.size = size;
+	actions->lmem[stream_name] = access;
+}
+
+/******************************************************************************************************************************************************/
+/* running */
+
+static u_int64_t Scalar(max_actions_t* actions, const char* name)
+{
+	std::map<std::string, u_int64_t>::iterator scalar = actions->scalars.find(name);
+	if(scalar == actions->scalars.end()){
+		Fail("scalar input was not set", name);
+	}
+	return scalar->second;
+}
+
+static input_t Input(max_actions_t* actions, const char* name)
+{
+	std::map<std::string, input_t>::iterator input = actions->inputs.find(name);
+	if(input == actions->inputs.end())
+	{
+		input_t none;
+		none.data = NULL;
+		none.size = 0;
+		return none;
+	}
+	return input->second;
+}
+
+static char* LMem(max_engine_t* engine, size_t address, size_t size)
+{
+	if(engine->lmem.size() < address + size){
+		engine->lmem.resize(address + size, 0);
+	}
+	return &engine->lmem[0] + address;
+}
+
+static void WriteStream(max_engine_t* engine, const char* name, const void* slots, size_t num_slots)
+{
+	std::map<std::string, max_llstream_t*>::iterator stream = engine->llstreams.find(name);
+	if(stream == engine->llstreams.end()){
+		Fail("output to a stream that has not been set up", name);
+	}
+	stream->second->Write(slots, num_slots);
+}
+
+/* streams the triangles_in input into LMem. for memoryInitialisation the range comes from the interface parameters, for the default interface from
+ * max_lmem_linear */
+static void UploadTriangles(max_engine_t* engine, size_t address, size_t size, input_t triangles)
+{
+	if(triangles.size < size)
+	{
+		printf("EMULATOR ERROR: %zu bytes queued to triangles_in, but the LMem write is %zu bytes. On the DFE this run would stall.\n", triangles.size, size);
+		size = triangles.size;
+	}
+	memcpy(LMem(engine, address, size), triangles.data, size);
+}
+
+static void Execute(max_engine_t* engine, max_actions_t* actions)
+{
+	if(actions->interface_name == "memoryInitialisation")
+	{
+		UploadTriangles(engine, actions->params["address"], actions->params["size"], Input(actions, "triangles_in"));
+		return;
+	}
+
+	/* an upload queued alongside the intersection tests goes to a region the kernel is not reading, so doing it first is equivalent */
+
+	std::map<std::string, lmem_access_t>::iterator upload = actions->lmem.find("triangles_to_mem");
+	if(upload != actions->lmem.end()){
+		UploadTriangles(engine, upload->second.address, upload->second.size, Input(actions, "triangles_in"));
+	}
+
+	model_job_t job;
+	job.command_ticks = actions->ticks["MemoryCommandGenerator"];
+	job.triangles_to_read_in_bursts = Scalar(actions, "MemoryCommandGenerator.triangles_to_read_in_bursts");
+	job.triangles_offset_in_bursts = Scalar(actions, "MemoryCommandGenerator.triangles_offset_in_bursts");
+	job.kernel_ticks = actions->ticks["RayTracerKernel"];
+	job.total_triangles = Scalar(actions, "RayTracerKernel.total_triangles");
+	job.total_rays = Scalar(actions, "RayTracerKernel.total_rays");
+	job.query_mode = Scalar(actions, "RayTracerKernel.query_mode");
+	job.result_encoding = Scalar(actions, "RayTracerKernel.result_encoding");
+
+	job.lmem = engine->lmem.empty() ? NULL : &engine->lmem[0];
+	job.lmem_size = engine->lmem.size();
+
+	input_t rays = Input(actions, "rays_in");
+	job.rays = rays.data;
+	job.rays_size = rays.size;
+
+	model_outputs_t outputs;
+	outputs.results_out = [engine](const void* slots, size_t num_slots){ WriteStream(engine, "results_out", slots, num_slots); };
+	outputs.status_out = [engine](const void* slots, size_t num_slots){ WriteStream(engine, "status_out", slots, num_slots); };
+	outputs.closest_out = [engine](const void* slots, size_t num_slots){ WriteStream(engine, "closest_out", slots, num_slots); };
+	outputs.occlusion_out = [engine](const void* slots, size_t num_slots){ WriteStream(engine, "occlusion_out", slots, num_slots); };
+
+	engine->model.m_num_threads = std::max(1, engine->model_threads / std::max(1, s_num_engines.load()));
+	engine->model.Run(job, outputs);
+}
+
+extern "C" max_run_t* max_run_nonblock(max_engine_t* engine, max_actions_t* actions)
+{
+	u_int64_t ticket;
+	{
+		std::lock_guard<std::mutex> lock(engine->mutex);
+		ticket = engine->next_ticket++;
+	}
+
+	max_run_t* run = new max_run_t;
+	run->thread = std::thread([engine, actions, ticket]()
+	{
+		{
+			std::unique_lock<std::mutex> lock(engine->mutex);
+			engine->turn.wait(lock, [&]{ return engine->serving == ticket; });
+		}
+
+		Execute(engine, actions);
+
+		{
+			std::lock_guard<std::mutex> lock(engine->mutex);
+			engine->serving++;
+		}
+		engine->turn.notify_all();
+	});
+
+	return run;
+}
+
+extern "C" void max_wait(max_run_t* run)
+{
+	run->thread.join();
+	delete run;
+}
+
+extern "C" void max_nowait(max_run_t* run)
+{
+	run->thread.detach();
+	delete run;
+}
+
+extern "C" void max_run(max_engine_t* engine, max_actions_t* actions)
+{
+	max_wait(max_run_nonblock(engine, actions));
+}
+
+/******************************************************************************************************************************************************/
+/* low latency streams */
+
+extern "C" max_llstream_t* max_llstream_setup(max_engine_t* engine, const char* stream_name, size_t slots, size_t slot_size, void* buffer)
+{
+	if(engine->maxfile->handle_streams.count(stream_name) == 0){
+		Fail("the maxfile has no stream", stream_name);
+	}
+
+	max_llstream_t* llstream = new max_llstream_t;
+	llstream->buffer = (char*)buffer;
+	llstream->slots = slots;
+	llstream->slot_size = slot_size;
+	llstream->written.store(0);
+	llstream->discarded.store(0);
+
+	/* setting a stream up again redirects the output to the new ring. the old one may still be referenced by the host, so is kept until unload */
+
+	std::lock_guard<std::mutex> lock(engine->mutex);
+	max_llstream_t*& existing = engine->llstreams[stream_name];
+	if(existing != NULL){
+		engine->retired.push_back(existing);
+	}
+	existing = llstream;
+
+	return llstream;
+}
+
+extern "C" ssize_t max_llstream_read(max_llstream_t* llstream, size_t max_slots, void** slot_ptr)
+{
+	return llstream->Read(max_slots, slot_ptr);
+}
+
+extern "C" void max_llstream_read_discard(max_llstream_t* llstream, size_t number_of_slots)
+{
+	llstream->Discard(number_of_slots);
+}
+
+extern "C" void max_llstream_release(max_llstream_t* llstream)
+{
+	/* the engine owns the stream, and frees it when it is unloaded */
+	(void)llstream;
+}
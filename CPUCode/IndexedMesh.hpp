@@ -0,0 +1,200 @@
+/*
+ * IndexedMesh.hpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#ifndef INDEXEDMESH_HPP_
+#define INDEXEDMESH_HPP_
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <unordered_map>
+#include <algorithm>
+#include "Types.h"
+
+/* A mesh held as a vertex buffer and an index buffer, three indices per triangle, so a vertex shared by several triangles is stored once. A
+ * triangle_t carries its three vertices in full, 36 bytes, where an indexed triangle needs 12 bytes of indices; in a typical closed mesh each vertex
+ * is shared by about six triangles, so the indexed form takes around a third of the memory.
+ *
+ * The CPU engine tests an indexed mesh as it is (see CPUIntersectionEngine::m_mesh). The DFE reads whole triangles from LMem, one word after
+ * another, so for the engine the triangles are expanded into the word layout only as each tile is packed (see Triangles::SetTriangles), on several
+ * threads for large tiles. Expansion copies the vertices bit for bit, so the expanded triangles give exactly the hits of the originals. */
+
+/* tiles with fewer triangles than this are expanded on the calling thread */
+#define INDEXED_MESH_PARALLEL_TRIANGLES 65536
+
+class IndexedMesh
+{
+public:
+	std::vector<vector3> m_vertices;
+	std::vector<u_int32_t> m_indices;	/* three per triangle */
+
+private:
+	struct vertex_key_t
+	{
+		u_int32_t bits[3];
+
+		bool operator==(const vertex_key_t& other) const
+		{
+			return memcmp(bits, other.bits, sizeof(bits)) == 0;
+		}
+	};
+
+	struct vertex_hash_t
+	{
+		size_t operator()(const vertex_key_t& key) const
+		{
+			u_int64_t h = 14695981039346656037ull;
+			for(int c = 0; c < 3; c++){
+				h = (h ^ key.bits[c]) * 1099511628211ull;
+			}
+			return (size_t)h;
+		}
+	};
+
+public:
+	size_t NumTriangles() const
+	{
+		return m_indices.size() / 3;
+	}
+
+	size_t SizeInBytes() const
+	{
+		return (m_vertices.size() * sizeof(vector3)) + (m_indices.size() * sizeof(u_int32_t));
+	}
+
+	/* the size the triangles take as a triangle_t array */
+	size_t ExpandedSizeInBytes() const
+	{
+		return NumTriangles() * sizeof(triangle_t);
+	}
+
+	/* builds the mesh from a triangle array, sharing vertices that are bit for bit the same (so 0 and -0 are kept apart, and expanding the mesh gives
+	 * back exactly the same triangles) */
+	void SetTriangles(const triangle_t* triangles, size_t count)
+	{
+		m_vertices.clear();
+		m_indices.resize(count * 3);
+
+		std::unordered_map<vertex_key_t, u_int32_t, vertex_hash_t> shared;
+		shared.reserve(count);
+
+		for(size_t t = 0; t < count; t++)
+		{
+			const vector3* vertices = &triangles[t].v0;
+			for(int v = 0; v < 3; v++)
+			{
+				vertex_key_t key;
+				memcpy(key.bits, &vertices[v], sizeof(key.bits));
+
+				std::pair<std::unordered_map<vertex_key_t, u_int32_t, vertex_hash_t>::iterator, bool> found =
+						shared.insert(std::make_pair(key, (u_int32_t)m_vertices.size()));
+				if(found.second){
+					m_vertices.push_back(vertices[v]);
+				}
+				m_indices[(t * 3) + v] = found.first->second;
+			}
+		}
+	}
+
+	/* returns false if the index buffer is not whole triangles, or refers past the end of the vertex buffer */
+	bool Validate() const
+	{
+		if(m_indices.size() % 3 != 0)
+		{
+			printf("ERROR: an index buffer of %zu indices is not a whole number of triangles.\n", m_indices.size());
+			return false;
+		}
+
+		for(size_t i = 0; i < m_indices.size(); i++)
+		{
+			if(m_indices[i] >= m_vertices.size())
+			{
+				printf("ERROR: index %zu refers to vertex %u of %zu.\n", i, m_indices[i], m_vertices.size());
+				return false;
+			}
+		}
+		return true;
+	}
+
+	triangle_t GetTriangle(size_t t) const
+	{
+		const u_int32_t* indices = &m_indices[t * 3];
+
+		triangle_t triangle;
+		triangle.v0 = m_vertices[indices[0]];
+		triangle.v1 = m_vertices[indices[1]];
+		triangle.v2 = m_vertices[indices[2]];
+		return triangle;
+	}
+
+	void Expand(triangle_t* dst, size_t first, size_t count) const
+	{
+		for(size_t t = 0; t < count; t++){
+			dst[t] = GetTriangle(first + t);
+		}
+	}
+
+	/* Writes count triangles from first in the DFE's padded word layout, as TriangleSoA::PackWords does: triangles_per_word triangles at the start of
+	 * each word_width_in_bytes word, the rest of each word, and any words beyond the last triangle, zeroed. total_words words are written to dst. In
+	 * the edges format the edges are worked out on the way. Large ranges are split by word between up to num_threads threads (0 for one per core) */
+	void PackWords(void* dst, size_t first, size_t count, int triangles_per_word, int word_width_in_bytes, int total_words,
+			triangle_format_t format = TRIANGLE_FORMAT_VERTICES, int num_threads = 0) const
+	{
+		if(num_threads <= 0){
+			num_threads = std::max(1, (int)std::thread::hardware_concurrency());
+		}
+		if(count < INDEXED_MESH_PARALLEL_TRIANGLES){
+			num_threads = 1;
+		}
+		num_threads = std::max(1, std::min(num_threads, total_words));
+
+		int words_per_thread = (total_words + num_threads - 1) / num_threads;
+
+		std::vector<std::thread> threads;
+		for(int i = 1; i < num_threads; i++)
+		{
+			int begin = i * words_per_thread;
+			int end = std::min(total_words, begin + words_per_thread);
+			threads.push_back(std::thread(&IndexedMesh::PackWordRange, this, dst, first, count, triangles_per_word, word_width_in_bytes, begin, end,
+					format));
+		}
+
+		PackWordRange(dst, first, count, triangles_per_word, word_width_in_bytes, 0, std::min(total_words, words_per_thread), format);
+
+		for(size_t i = 0; i < threads.size(); i++){
+			threads[i].join();
+		}
+	}
+
+private:
+	void PackWordRange(void* dst, size_t first, size_t count, int triangles_per_word, int word_width_in_bytes, int begin_word, int end_word,
+			triangle_format_t format) const
+	{
+		for(int w = begin_word; w < end_word; w++)
+		{
+			char* word = ((char*)dst) + ((size_t)w * word_width_in_bytes);
+			size_t t = (size_t)w * triangles_per_word;
+
+			int in_word = 0;
+			for(; in_word < triangles_per_word && t < count; in_word++, t++)
+			{
+				triangle_t triangle = GetTriangle(first + t);
+				if(format == TRIANGLE_FORMAT_EDGES){
+					((triangle_edges_t*)word)[in_word] = TriangleEdges(triangle);
+				}else{
+					((triangle_t*)word)[in_word] = triangle;
+				}
+			}
+
+			int used_bytes = in_word * sizeof(triangle_t);
+			memset(word + used_bytes, 0, word_width_in_bytes - used_bytes);
+		}
+	}
+};
+
+#endif /* INDEXEDMESH_HPP_ */
@@ -0,0 +1,325 @@
+/*
+ * Instrumentation.hpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#ifndef INSTRUMENTATION_HPP_
+#define INSTRUMENTATION_HPP_
+
+/* Timing instrumentation for the host pipeline, compiled in by building with RAYTRACER_INSTRUMENTATION=1 (make INSTRUMENTATION=1). Otherwise every
+ * macro below expands to nothing and none of this code is compiled.
+ *
+ *   INSTRUMENT_SCOPE(name)          times the rest of the enclosing block
+ *   INSTRUMENT_COUNT(name, value)   adds value to a counter, for the summary only (cheap enough for polling loops)
+ *   INSTRUMENT_COUNTER(name, value) adds value to a counter, and records the value in the event ring
+ *   INSTRUMENT_MARK(name)           records an instant in the event ring
+ *
+ * Names must be string literals. Each site keeps its own totals in atomics, so the summary covers the whole run; the event ring keeps only the most
+ * recent INSTRUMENT_EVENT_RING_SIZE events, overwriting the oldest. Recording is lock free and allocates nothing after a site is first reached.
+ * The results should be exported (INSTRUMENT_PRINT_SUMMARY, INSTRUMENT_WRITE_CHROME_TRACE) once the pipeline is idle. */
+
+#ifndef RAYTRACER_INSTRUMENTATION
+#define RAYTRACER_INSTRUMENTATION 0
+#endif
+
+#if RAYTRACER_INSTRUMENTATION
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+#define INSTRUMENT_EVENT_RING_SIZE 65536
+
+enum instrument_event_type_t
+{
+	INSTRUMENT_SPAN,
+	INSTRUMENT_COUNTER_VALUE,
+	INSTRUMENT_INSTANT
+};
+
+struct instrument_event_t
+{
+	const char* name;
+	u_int64_t start_ns;
+	u_int64_t duration_ns;
+	int64_t value;
+	u_int32_t thread;
+	u_int32_t type;
+};
+
+class InstrumentSite;
+
+class Instrumentation
+{
+private:
+	std::chrono::steady_clock::time_point m_epoch;
+
+	std::vector<instrument_event_t> m_events;
+	std::atomic<u_int64_t> m_next_event;
+
+	std::mutex m_sites_lock;
+	std::vector<InstrumentSite*> m_sites;
+
+	std::atomic<u_int32_t> m_next_thread;
+
+	Instrumentation()
+	{
+		m_epoch = std::chrono::steady_clock::now();
+		m_events.resize(INSTRUMENT_EVENT_RING_SIZE);
+		m_next_event.store(0);
+		m_next_thread.store(0);
+	}
+
+public:
+	static Instrumentation& Get()
+	{
+		static Instrumentation instance;
+		return instance;
+	}
+
+	u_int64_t Now() const
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_epoch).count();
+	}
+
+	/* small sequential ids, so traces show "thread 0, 1, 2..." rather than pthread handles */
+	u_int32_t ThreadId()
+	{
+		static thread_local u_int32_t id = m_next_thread.fetch_add(1);
+		return id;
+	}
+
+	void Record(instrument_event_type_t type, const char* name, u_int64_t start_ns, u_int64_t duration_ns, int64_t value)
+	{
+		u_int64_t index = m_next_event.fetch_add(1, std::memory_order_relaxed);
+		instrument_event_t& event = m_events[index % INSTRUMENT_EVENT_RING_SIZE];
+		event.name = name;
+		event.start_ns = start_ns;
+		event.duration_ns = duration_ns;
+		event.value = value;
+		event.thread = ThreadId();
+		event.type = type;
+	}
+
+	void Register(InstrumentSite* site)
+	{
+		std::lock_guard<std::mutex> lock(m_sites_lock);
+		m_sites.push_back(site);
+	}
+
+	inline void PrintSummary();
+	inline bool WriteChromeTrace(const char* filename);
+
+private:
+	/* the events still in the ring, oldest first */
+	void GetEvents(std::vector<instrument_event_t>& events) const
+	{
+		u_int64_t end = m_next_event.load();
+		u_int64_t begin = (end > INSTRUMENT_EVENT_RING_SIZE) ? (end - INSTRUMENT_EVENT_RING_SIZE) : 0;
+		for(u_int64_t i = begin; i < end; i++){
+			events.push_back(m_events[i % INSTRUMENT_EVENT_RING_SIZE]);
+		}
+	}
+
+	static void WriteString(FILE* file, const char* s)
+	{
+		fputc('"', file);
+		for(; *s != '\0'; s++)
+		{
+			if(*s == '"' || *s == '\\'){
+				fputc('\\', file);
+			}
+			fputc(*s, file);
+		}
+		fputc('"', file);
+	}
+};
+
+/* the totals of one timer or counter. timer values are in nanoseconds */
+class InstrumentSite
+{
+public:
+	const char* m_name;
+	bool m_timer;
+
+	std::atomic<u_int64_t> m_count;
+	std::atomic<int64_t> m_total;
+	std::atomic<int64_t> m_min;
+	std::atomic<int64_t> m_max;
+
+	InstrumentSite(const char* name, bool timer)
+	{
+		m_name = name;
+		m_timer = timer;
+		m_count.store(0);
+		m_total.store(0);
+		m_min.store(INT64_MAX);
+		m_max.store(INT64_MIN);
+		Instrumentation::Get().Register(this);
+	}
+
+	void Add(int64_t value)
+	{
+		m_count.fetch_add(1, std::memory_order_relaxed);
+		m_total.fetch_add(value, std::memory_order_relaxed);
+
+		int64_t current = m_min.load(std::memory_order_relaxed);
+		while(value < current && !m_min.compare_exchange_weak(current, value, std::memory_order_relaxed)){
+		}
+		current = m_max.load(std::memory_order_relaxed);
+		while(value > current && !m_max.compare_exchange_weak(current, value, std::memory_order_relaxed)){
+		}
+	}
+};
+
+class InstrumentScope
+{
+private:
+	InstrumentSite* m_site;
+	u_int64_t m_start;
+
+public:
+	InstrumentScope(InstrumentSite* site)
+	{
+		m_site = site;
+		m_start = Instrumentation::Get().Now();
+	}
+
+	~InstrumentScope()
+	{
+		u_int64_t duration = Instrumentation::Get().Now() - m_start;
+		m_site->Add(duration);
+		Instrumentation::Get().Record(INSTRUMENT_SPAN, m_site->m_name, m_start, duration, 0);
+	}
+};
+
+void Instrumentation::PrintSummary()
+{
+	std::vector<InstrumentSite*> sites;
+	{
+		std::lock_guard<std::mutex> lock(m_sites_lock);
+		sites = m_sites;
+	}
+
+	std::stable_sort(sites.begin(), sites.end(), [](const InstrumentSite* a, const InstrumentSite* b)
+	{
+		return (a->m_timer != b->m_timer) ? a->m_timer : (a->m_total.load() > b->m_total.load());
+	});
+
+	printf("Instrumentation summary\n");
+	printf("\t%-36s %10s %12s %12s %12s %12s\n", "Timer", "Count", "Total ms", "Mean us", "Min us", "Max us");
+	for(size_t i = 0; i < sites.size(); i++)
+	{
+		const InstrumentSite* site = sites[i];
+		u_int64_t count = site->m_count.load();
+		if(!site->m_timer || count == 0){
+			continue;
+		}
+		printf("\t%-36s %10llu %12.3f %12.3f %12.3f %12.3f\n", site->m_name, (unsigned long long)count, site->m_total.load() / 1e6,
+				(site->m_total.load() / (double)count) / 1e3, site->m_min.load() / 1e3, site->m_max.load() / 1e3);
+	}
+
+	printf("\t%-36s %10s %12s %12s %12s %12s\n", "Counter", "Count", "Total", "Mean", "Min", "Max");
+	for(size_t i = 0; i < sites.size(); i++)
+	{
+		const InstrumentSite* site = sites[i];
+		u_int64_t count = site->m_count.load();
+		if(site->m_timer || count == 0){
+			continue;
+		}
+		printf("\t%-36s %10llu %12lld %12.1f %12lld %12lld\n", site->m_name, (unsigned long long)count, (long long)site->m_total.load(),
+				site->m_total.load() / (double)count, (long long)site->m_min.load(), (long long)site->m_max.load());
+	}
+
+	u_int64_t recorded = m_next_event.load();
+	if(recorded > INSTRUMENT_EVENT_RING_SIZE){
+		printf("\t(%llu of %llu events were overwritten in the ring)\n", (unsigned long long)(recorded - INSTRUMENT_EVENT_RING_SIZE),
+				(unsigned long long)recorded);
+	}
+}
+
+/* writes the events in the ring in the Chrome trace event format, which chrome://tracing and Perfetto can load */
+bool Instrumentation::WriteChromeTrace(const char* filename)
+{
+	FILE* file = fopen(filename, "w");
+	if(file == NULL)
+	{
+		printf("Could not create trace file %s.\n", filename);
+		return false;
+	}
+
+	std::vector<instrument_event_t> events;
+	GetEvents(events);
+
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	for(size_t i = 0; i < events.size(); i++)
+	{
+		const instrument_event_t& event = events[i];
+
+		fprintf(file, "%s\n{\"name\":", (i > 0) ? "," : "");
+		WriteString(file, event.name);
+		fprintf(file, ",\"pid\":1,\"tid\":%u,\"ts\":%.3f", event.thread, event.start_ns / 1e3);
+
+		switch(event.type)
+		{
+		case INSTRUMENT_SPAN:
+			fprintf(file, ",\"ph\":\"X\",\"dur\":%.3f}", event.duration_ns / 1e3);
+			break;
+		case INSTRUMENT_COUNTER_VALUE:
+			fprintf(file, ",\"ph\":\"C\",\"args\":{\"value\":%lld}}", (long long)event.value);
+			break;
+		default:
+			fprintf(file, ",\"ph\":\"i\",\"s\":\"t\"}");
+			break;
+		}
+	}
+	fprintf(file, "\n]}\n");
+
+	bool ok = (ferror(file) == 0);
+	ok = (fclose(file) == 0) && ok;
+	return ok;
+}
+
+#define INSTRUMENT_CONCAT_(a, b) a##b
+#define INSTRUMENT_CONCAT(a, b) INSTRUMENT_CONCAT_(a, b)
+
+#define INSTRUMENT_SCOPE(name) \
+	static InstrumentSite INSTRUMENT_CONCAT(instrument_site_, __LINE__)(name, true); \
+	InstrumentScope INSTRUMENT_CONCAT(instrument_scope_, __LINE__)(&INSTRUMENT_CONCAT(instrument_site_, __LINE__))
+
+#define INSTRUMENT_COUNT(name, value) \
+	do { static InstrumentSite instrument_site(name, false); instrument_site.Add(value); } while(0)
+
+#define INSTRUMENT_COUNTER(name, value) \
+	do { \
+		static InstrumentSite instrument_site(name, false); \
+		int64_t instrument_value = (value); \
+		instrument_site.Add(instrument_value); \
+		Instrumentation::Get().Record(INSTRUMENT_COUNTER_VALUE, name, Instrumentation::Get().Now(), 0, instrument_value); \
+	} while(0)
+
+#define INSTRUMENT_MARK(name) \
+	Instrumentation::Get().Record(INSTRUMENT_INSTANT, name, Instrumentation::Get().Now(), 0, 0)
+
+#define INSTRUMENT_PRINT_SUMMARY() Instrumentation::Get().PrintSummary()
+#define INSTRUMENT_WRITE_CHROME_TRACE(filename) Instrumentation::Get().WriteChromeTrace(filename)
+
+#else
+
+#define INSTRUMENT_SCOPE(name)
+#define INSTRUMENT_COUNT(name, value) do { } while(0)
+#define INSTRUMENT_COUNTER(name, value) do { } while(0)
+#define INSTRUMENT_MARK(name) do { } while(0)
+#define INSTRUMENT_PRINT_SUMMARY() do { } while(0)
+#define INSTRUMENT_WRITE_CHROME_TRACE(filename) do { } while(0)
+
+#endif
+
+#endif /* INSTRUMENTATION_HPP_ */
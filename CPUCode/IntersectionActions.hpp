@@ -0,0 +1,87 @@
+/*
+ * IntersectionActions.hpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#ifndef INTERSECTIONACTIONS_HPP_
+#define INTERSECTIONACTIONS_HPP_
+
+#include "Maxfiles.h"
+#include "MaxSLiCInterface.h"
+#include <stdio.h>
+#include <limits.h>
+#include "Types.h"
+#include "Triangles.hpp"
+#include "Rays.hpp"
+#include "ResultEncoding.hpp"
+
+/* What a run reports: every (ray, triangle) pair that hits, on results_out (see Results); the nearest hit of each ray with its t, u and v, on
+ * closest_out (see ClosestHits); or one bit per ray saying whether anything blocks it between its tmin and tmax, on occlusion_out (see Occlusion) */
+enum query_mode_t
+{
+	QUERY_ALL_HITS = 0,
+	QUERY_CLOSEST_HIT = 1,
+	QUERY_OCCLUSION = 2
+};
+
+/* The number of ticks the intersection kernel needs to test every ray against every triangle. Computed in 64 bits, as the product overflows an int
+ * long before the scalar inputs do */
+inline u_int64_t IntersectionTicks(max_file_t* maxfile, u_int64_t total_triangles, u_int64_t total_rays)
+{
+	u_int64_t triangles_per_tick = max_get_constant_uint64t(maxfile, "TrianglesPerTick");
+	u_int64_t rays_per_tick = max_get_constant_uint64t(maxfile, "RaysPerTick");
+
+	return (total_triangles / triangles_per_tick) * (total_rays / rays_per_tick);
+}
+
+/* Builds the default mode actions to test the queued rays against the triangles already in LMem at offset_in_bursts. Returns NULL if the job is too
+ * big for one run (the tick counts must fit in an int); such jobs need to be split, see TiledScheduler.
+ *
+ * If upload is given, it is streamed into LMem at upload_offset_in_bursts during the same run. It must not overlap the triangles being read.
+ *
+ * encoding selects how all hits runs send their hits (see ResultEncoding). The run's results must be read with the same encoding, e.g. by giving it,
+ * along with tris->m_total_triangles and rays->m_num_rays, to AsyncRun::Start. */
+inline max_actions_t* CreateIntersectionActions(max_file_t* maxfile, Triangles* tris, int offset_in_bursts, Rays* rays,
+		Triangles* upload = NULL, int upload_offset_in_bursts = 0, query_mode_t query = QUERY_ALL_HITS,
+		result_encoding_t encoding = RESULT_ENCODING_PAIRS)
+{
+	u_int64_t rays_per_tick = max_get_constant_uint64t(maxfile, "RaysPerTick");
+	u_int64_t rays_in_set = rays->m_num_rays;
+	u_int64_t triangles_in_set = tris->m_total_triangles;
+
+	u_int64_t intersection_ticks = IntersectionTicks(maxfile, triangles_in_set, rays_in_set);
+	u_int64_t memory_command_ticks = (rays_in_set / rays_per_tick);
+
+	if(intersection_ticks > INT_MAX)
+	{
+		printf("ERROR: %llu rays against %llu triangles needs %llu ticks, more than one run can do. Split the job into tiles.\n",
+				(unsigned long long)rays_in_set, (unsigned long long)triangles_in_set, (unsigned long long)intersection_ticks);
+		return NULL;
+	}
+
+	max_actions_t* act = max_actions_init(maxfile, NULL);
+
+	max_set_ticks(act, "MemoryCommandGenerator", memory_command_ticks);
+	max_set_uint64t(act,"MemoryCommandGenerator","triangles_to_read_in_bursts",tris->m_total_bursts);
+	max_set_uint64t(act,"MemoryCommandGenerator","triangles_offset_in_bursts",offset_in_bursts);
+
+	if(upload != NULL){
+		upload->QueueTriangles(act, upload_offset_in_bursts);
+	}else{
+		max_ignore_lmem(act,"triangles_to_mem");
+	}
+
+	max_set_ticks(act, "RayTracerKernel", intersection_ticks);
+	max_set_uint64t(act,"RayTracerKernel","total_triangles",triangles_in_set);
+	max_set_uint64t(act,"RayTracerKernel","total_rays",rays_in_set);
+	max_set_uint64t(act,"RayTracerKernel","query_mode",query);
+	max_set_uint64t(act,"RayTracerKernel","result_encoding",encoding);
+
+	rays->QueueRays(act);
+
+	return act;
+}
+
+#endif /* INTERSECTIONACTIONS_HPP_ */
@@ -0,0 +1,471 @@
+/*
+ * MeshImporter.hpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#ifndef MESHIMPORTER_HPP_
+#define MESHIMPORTER_HPP_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <string>
+#include <vector>
+#include "Types.h"
+#include "SceneFile.hpp"
+
+/* Converts OBJ and PLY meshes to scene files in a single pass. Faces are triangulated as fans and written to the SceneFileWriter as they are read,
+ * so only the vertex positions (which any face may refer to) are held in memory, never the triangles. Only positions and faces are imported;
+ * normals, texture coordinates, other elements and properties are skipped. */
+class MeshImporter
+{
+public:
+	size_t m_num_vertices;
+	size_t m_num_faces;
+	size_t m_num_triangles;
+
+private:
+	std::vector<vector3> m_vertices;
+	SceneFileWriter* m_writer;
+
+	/* PLY property types, in the order of the names in PLYType */
+	enum ply_type_t { PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64, PLY_INVALID };
+
+	struct ply_property_t
+	{
+		std::string name;
+		ply_type_t type;
+		ply_type_t count_type;	/* for lists, the type of the count that precedes the items */
+		bool list;
+	};
+
+	struct ply_element_t
+	{
+		std::string name;
+		u_int64_t count;
+		std::vector<ply_property_t> properties;
+	};
+
+	enum ply_format_t { PLY_ASCII, PLY_BINARY_LITTLE_ENDIAN, PLY_BINARY_BIG_ENDIAN };
+
+public:
+	MeshImporter()
+	{
+		m_writer = NULL;
+		m_num_vertices = 0;
+		m_num_faces = 0;
+		m_num_triangles = 0;
+	}
+
+	/* picks the importer by the file extension */
+	bool Import(const char* filename, SceneFileWriter& writer)
+	{
+		const char* extension = strrchr(filename, '.');
+		if(extension != NULL && strcasecmp(extension, ".obj") == 0){
+			return ImportOBJ(filename, writer);
+		}
+		if(extension != NULL && strcasecmp(extension, ".ply") == 0){
+			return ImportPLY(filename, writer);
+		}
+
+		printf("Unknown mesh format %s, expected .obj or .ply.\n", filename);
+		return false;
+	}
+
+	bool ImportOBJ(const char* filename, SceneFileWriter& writer)
+	{
+		FILE* file = fopen(filename, "r");
+		if(file == NULL)
+		{
+			printf("Could not open %s.\n", filename);
+			return false;
+		}
+
+		Begin(writer);
+
+		char* line = NULL;
+		size_t line_capacity = 0;
+		size_t line_number = 0;
+		bool ok = true;
+
+		std::vector<long> face;
+
+		while(ok && getline(&line, &line_capacity, file) >= 0)
+		{
+			line_number++;
+
+			char* c = line;
+			while(*c == ' ' || *c == '\t'){
+				c++;
+			}
+
+			if(c[0] == 'v' && (c[1] == ' ' || c[1] == '\t'))
+			{
+				char* end;
+				vector3 vertex;
+				vertex.x = strtof(c + 1, &end);
+				vertex.y = strtof(end, &end);
+				vertex.z = strtof(end, &end);
+				m_vertices.push_back(vertex);
+			}
+			else if(c[0] == 'f' && (c[1] == ' ' || c[1] == '\t'))
+			{
+				/* each vertex is v, v/vt, v//vn or v/vt/vn, and negative indices count back from the last vertex */
+
+				face.clear();
+				c++;
+				while(true)
+				{
+					while(*c == ' ' || *c == '\t'){
+						c++;
+					}
+					if(*c == '\0' || *c == '\n' || *c == '\r' || *c == '#'){
+						break;
+					}
+
+					char* end;
+					long index = strtol(c, &end, 10);
+					if(end == c || index == 0)
+					{
+						printf("%s:%zu: invalid face.\n", filename, line_number);
+						ok = false;
+						break;
+					}
+					face.push_back(index < 0 ? ((long)m_vertices.size() + index) : (index - 1));
+
+					c = end;
+					while(*c != '\0' && *c != ' ' && *c != '\t' && *c != '\n' && *c != '\r'){
+						c++;
+					}
+				}
+
+				if(ok && !AddFace(face.data(), face.size()))
+				{
+					printf("%s:%zu: face refers to a vertex that has not been defined.\n", filename, line_number);
+					ok = false;
+				}
+			}
+		}
+
+		free(line);
+		fclose(file);
+
+		End();
+		return ok;
+	}
+
+	bool ImportPLY(const char* filename, SceneFileWriter& writer)
+	{
+		FILE* file = fopen(filename, "rb");
+		if(file == NULL)
+		{
+			printf("Could not open %s.\n", filename);
+			return false;
+		}
+
+		Begin(writer);
+
+		ply_format_t format;
+		std::vector<ply_element_t> elements;
+		bool ok = ReadPLYHeader(file, filename, format, elements);
+
+		bool vertices_read = false;
+		std::vector<long> face;
+
+		for(size_t e = 0; ok && e < elements.size(); e++)
+		{
+			const ply_element_t& element = elements[e];
+
+			bool is_vertex = (element.name == "vertex");
+			bool is_face = (element.name == "face");
+
+			int x = -1, y = -1, z = -1, indices = -1;
+			for(size_t p = 0; p < element.properties.size(); p++)
+			{
+				const ply_property_t& property = element.properties[p];
+				if(is_vertex && !property.list)
+				{
+					if(property.name == "x"){ x = p; }
+					if(property.name == "y"){ y = p; }
+					if(property.name == "z"){ z = p; }
+				}
+				if(is_face && property.list && (property.name == "vertex_indices" || property.name == "vertex_index")){
+					indices = p;
+				}
+			}
+
+			if(is_vertex && (x < 0 || y < 0 || z < 0))
+			{
+				printf("%s: vertices have no x, y and z.\n", filename);
+				ok = false;
+				break;
+			}
+
+			if(is_face && (indices < 0 || !vertices_read))
+			{
+				printf("%s: faces must have vertex_indices and follow the vertices.\n", filename);
+				ok = false;
+				break;
+			}
+
+			double values[3] = { 0, 0, 0 };
+
+			for(u_int64_t i = 0; ok && i < element.count; i++)
+			{
+				for(size_t p = 0; ok && p < element.properties.size(); p++)
+				{
+					const ply_property_t& property = element.properties[p];
+
+					if(!property.list)
+					{
+						double value;
+						ok = ReadPLYValue(file, format, property.type, value);
+						if(is_vertex && ((int)p == x || (int)p == y || (int)p == z)){
+							values[((int)p == x) ? 0 : (((int)p == y) ? 1 : 2)] = value;
+						}
+						continue;
+					}
+
+					double count;
+					ok = ReadPLYValue(file, format, property.count_type, count);
+					if((int)p == indices){
+						face.clear();
+					}
+					for(u_int64_t j = 0; ok && j < (u_int64_t)count; j++)
+					{
+						double index;
+						ok = ReadPLYValue(file, format, property.type, index);
+						if((int)p == indices){
+							face.push_back((long)index);
+						}
+					}
+				}
+
+				if(!ok)
+				{
+					printf("%s: unexpected end of file in %s %llu.\n", filename, element.name.c_str(), (unsigned long long)i);
+					break;
+				}
+
+				if(is_vertex){
+					m_vertices.push_back(vector3((float)values[0], (float)values[1], (float)values[2]));
+				}
+
+				if(is_face && !AddFace(face.data(), face.size()))
+				{
+					printf("%s: face %llu refers to a vertex that does not exist.\n", filename, (unsigned long long)i);
+					ok = false;
+				}
+			}
+
+			if(is_vertex){
+				vertices_read = true;
+			}
+
+			/* nothing after the faces is imported, so there is no need to read on */
+
+			if(is_face){
+				break;
+			}
+		}
+
+		fclose(file);
+
+		End();
+		return ok;
+	}
+
+private:
+	void Begin(SceneFileWriter& writer)
+	{
+		m_writer = &writer;
+		m_vertices.clear();
+		m_num_vertices = 0;
+		m_num_faces = 0;
+		m_num_triangles = 0;
+	}
+
+	void End()
+	{
+		m_num_vertices = m_vertices.size();
+		std::vector<vector3>().swap(m_vertices);
+		m_writer = NULL;
+	}
+
+	/* writes a polygon as a fan of triangles around its first vertex. faces with fewer than three vertices are skipped */
+	bool AddFace(const long* indices, size_t count)
+	{
+		for(size_t i = 0; i < count; i++)
+		{
+			if(indices[i] < 0 || indices[i] >= (long)m_vertices.size()){
+				return false;
+			}
+		}
+
+		m_num_faces++;
+
+		for(size_t i = 2; i < count; i++)
+		{
+			triangle_t triangle;
+			triangle.v0 = m_vertices[indices[0]];
+			triangle.v1 = m_vertices[indices[i - 1]];
+			triangle.v2 = m_vertices[indices[i]];
+			m_writer->AddTriangle(triangle);
+			m_num_triangles++;
+		}
+
+		return true;
+	}
+
+	static ply_type_t PLYType(const char* name)
+	{
+		static const char* names[][2] = {
+			{ "char", "int8" }, { "uchar", "uint8" }, { "short", "int16" }, { "ushort", "uint16" },
+			{ "int", "int32" }, { "uint", "uint32" }, { "float", "float32" }, { "double", "float64" }
+		};
+
+		for(int t = 0; t < PLY_INVALID; t++)
+		{
+			if(strcmp(name, names[t][0]) == 0 || strcmp(name, names[t][1]) == 0){
+				return (ply_type_t)t;
+			}
+		}
+		return PLY_INVALID;
+	}
+
+	static int PLYTypeSize(ply_type_t type)
+	{
+		static const int sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+		return sizes[type];
+	}
+
+	static bool ReadPLYHeader(FILE* file, const char* filename, ply_format_t& format, std::vector<ply_element_t>& elements)
+	{
+		char line[1024];
+		char word[4][256];
+
+		if(fgets(line, sizeof(line), file) == NULL || strncmp(line, "ply", 3) != 0)
+		{
+			printf("%s is not a PLY file.\n", filename);
+			return false;
+		}
+
+		bool have_format = false;
+
+		while(fgets(line, sizeof(line), file) != NULL)
+		{
+			int words = sscanf(line, "%255s %255s %255s %255s", word[0], word[1], word[2], word[3]);
+			if(words <= 0){
+				continue;
+			}
+
+			if(strcmp(word[0], "end_header") == 0)
+			{
+				if(!have_format){
+					printf("%s has no format.\n", filename);
+				}
+				return have_format;
+			}
+
+			if(strcmp(word[0], "format") == 0 && words >= 2)
+			{
+				have_format = true;
+				if(strcmp(word[1], "ascii") == 0){
+					format = PLY_ASCII;
+				}else if(strcmp(word[1], "binary_little_endian") == 0){
+					format = PLY_BINARY_LITTLE_ENDIAN;
+				}else if(strcmp(word[1], "binary_big_endian") == 0){
+					format = PLY_BINARY_BIG_ENDIAN;
+				}else{
+					printf("%s has an unknown format %s.\n", filename, word[1]);
+					return false;
+				}
+			}
+			else if(strcmp(word[0], "element") == 0 && words >= 3)
+			{
+				ply_element_t element;
+				element.name = word[1];
+				element.count = strtoull(word[2], NULL, 10);
+				elements.push_back(element);
+			}
+			else if(strcmp(word[0], "property") == 0 && !elements.empty())
+			{
+				ply_property_t property;
+				property.list = (strcmp(word[1], "list") == 0);
+				if(property.list && words >= 4)
+				{
+					property.count_type = PLYType(word[2]);
+					property.type = PLYType(word[3]);
+					sscanf(line, "%*s %*s %*s %*s %255s", word[0]);
+					property.name = word[0];
+				}
+				else if(!property.list && words >= 3)
+				{
+					property.count_type = PLY_INVALID;
+					property.type = PLYType(word[1]);
+					property.name = word[2];
+				}
+				else
+				{
+					property.type = PLY_INVALID;
+				}
+
+				if(property.type == PLY_INVALID || (property.list && property.count_type == PLY_INVALID))
+				{
+					printf("%s has an invalid property: %s", filename, line);
+					return false;
+				}
+
+				elements.back().properties.push_back(property);
+			}
+		}
+
+		printf("%s has no end_header.\n", filename);
+		return false;
+	}
+
+	static bool ReadPLYValue(FILE* file, ply_format_t format, ply_type_t type, double& value)
+	{
+		if(format == PLY_ASCII){
+			return fscanf(file, "%lf", &value) == 1;
+		}
+
+		unsigned char bytes[8];
+		int size = PLYTypeSize(type);
+		if(fread(bytes, size, 1, file) != 1){
+			return false;
+		}
+
+		/* the host is little endian, so only big endian files need swapping */
+
+		if(format == PLY_BINARY_BIG_ENDIAN)
+		{
+			for(int i = 0; i < size / 2; i++)
+			{
+				unsigned char byte = bytes[i];
+				bytes[i] = bytes[size - 1 - i];
+				bytes[size - 1 - i] = byte;
+			}
+		}
+
+		switch(type)
+		{
+		case PLY_INT8:		{ int8_t v; memcpy(&v, bytes, size); value = v; break; }
+		case PLY_UINT8:		{ u_int8_t v; memcpy(&v, bytes, size); value = v; break; }
+		case PLY_INT16:		{ int16_t v; memcpy(&v, bytes, size); value = v; break; }
+		case PLY_UINT16:	{ u_int16_t v; memcpy(&v, bytes, size); value = v; break; }
+		case PLY_INT32:		{ int32_t v; memcpy(&v, bytes, size); value = v; break; }
+		case PLY_UINT32:	{ u_int32_t v; memcpy(&v, bytes, size); value = v; break; }
+		case PLY_FLOAT32:	{ float v; memcpy(&v, bytes, size); value = v; break; }
+		case PLY_FLOAT64:	{ double v; memcpy(&v, bytes, size); value = v; break; }
+		default:			return false;
+		}
+
+		return true;
+	}
+};
+
+#endif /* MESHIMPORTER_HPP_ */
@@ -0,0 +1,284 @@
+/*
+ * MultiEngineScheduler.hpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#ifndef MULTIENGINESCHEDULER_HPP_
+#define MULTIENGINESCHEDULER_HPP_
+
+#include "Maxfiles.h"
+#include "MaxSLiCInterface.h"
+#include <stdio.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <algorithm>
+#include "Types.h"
+#include "Rays.hpp"
+#include "AsyncRun.hpp"
+#include "SceneSession.hpp"
+#include "Instrumentation.hpp"
+
+/* How the scene is spread over the engines. Replicated, every engine holds the whole scene and each ray batch goes to one engine, whichever is free
+ * first. Partitioned, each engine holds a contiguous slice of the triangles and tests every batch against it; this fits scenes too large to copy to
+ * every card, but each engine sees all of the rays. */
+enum engine_distribution_t
+{
+	DISTRIBUTE_REPLICATE,
+	DISTRIBUTE_PARTITION
+};
+
+/* Runs ray jobs across several engines. Each engine is loaded separately and driven by its own worker thread, which holds the engine's result and
+ * status streams (an AsyncRun) and keeps the scene resident in its LMem (a SceneSession). The rays of a job are split into batches, and the workers
+ * take batches from a shared counter, so a slow or busy engine simply takes fewer of them. Each worker remaps the tile-local ids of its hits to
+ * global ray and triangle indices before they are merged.
+ *
+ * The engines are loaded one at a time with max_load, rather than as a max_group_t or max_engarray_t, because each needs its own low latency
+ * streams and LMem contents, which the group and array interfaces do not expose per engine. Under the Emulation run rule every load is a separate
+ * emulated engine, so the scheduler can be tested without cards. */
+class MultiEngineScheduler
+{
+public:
+	/* how many batches each engine ran in the last Run */
+	std::vector<size_t> m_batches_per_engine;
+
+private:
+	enum command_t
+	{
+		COMMAND_NONE,
+		COMMAND_LOAD,
+		COMMAND_RUN,
+		COMMAND_STOP
+	};
+
+	max_file_t* m_maxfile;
+	engine_distribution_t m_distribution;
+	size_t m_batch_rays;
+
+	std::vector<max_engine_t*> m_engines;
+	std::vector<std::thread> m_workers;
+
+	/* the current command. the workers wake when the generation changes, and the caller waits until all of them have finished it */
+	std::mutex m_lock;
+	std::condition_variable m_changed;
+	command_t m_command;
+	u_int64_t m_generation;
+	size_t m_finished;
+	bool m_failed;
+
+	/* the arguments of the current command */
+	const triangle_t* m_triangles;
+	size_t m_num_triangles;
+	const ray_t* m_rays;
+	size_t m_num_rays;
+	size_t m_num_batches;
+	std::atomic<size_t> m_next_batch;
+	std::vector<intersection_t>* m_intersections;
+
+public:
+	/* loads num_engines engines matching engine_id_pattern. batch_rays is the number of rays each run tests, rounded to whole ray words; it must be
+	 * small enough that a run against one triangle tile fits (see CreateIntersectionActions) */
+	MultiEngineScheduler(max_file_t* maxfile, int num_engines, engine_distribution_t distribution = DISTRIBUTE_REPLICATE, size_t batch_rays = 8192,
+			const char* engine_id_pattern = "*")
+	{
+		m_maxfile = maxfile;
+		m_distribution = distribution;
+
+		size_t rays_per_word = max_get_constant_uint64t(maxfile, "RaysPerWord");
+		m_batch_rays = std::max((size_t)1, (batch_rays + rays_per_word - 1) / rays_per_word) * rays_per_word;
+
+		m_command = COMMAND_NONE;
+		m_generation = 0;
+		m_finished = 0;
+		m_failed = false;
+
+		m_triangles = NULL;
+		m_num_triangles = 0;
+		m_rays = NULL;
+		m_num_rays = 0;
+		m_num_batches = 0;
+		m_next_batch.store(0);
+		m_intersections = NULL;
+
+		for(int i = 0; i < num_engines; i++){
+			m_engines.push_back(max_load(maxfile, engine_id_pattern));
+		}
+
+		m_batches_per_engine.resize(m_engines.size(), 0);
+
+		for(size_t i = 0; i < m_engines.size(); i++){
+			m_workers.push_back(std::thread(&MultiEngineScheduler::Worker, this, i));
+		}
+	}
+
+	~MultiEngineScheduler()
+	{
+		Issue(COMMAND_STOP);
+
+		for(size_t i = 0; i < m_workers.size(); i++){
+			m_workers[i].join();
+		}
+		for(size_t i = 0; i < m_engines.size(); i++){
+			max_unload(m_engines[i]);
+		}
+	}
+
+	size_t NumEngines() const
+	{
+		return m_engines.size();
+	}
+
+	/* uploads the scene to the engines, replacing any previous one. the triangles are packed by the workers, so need only be valid for the call */
+	bool SetScene(const triangle_t* triangles, size_t num_triangles)
+	{
+		INSTRUMENT_SCOPE("MultiEngineScheduler::SetScene");
+
+		m_triangles = triangles;
+		m_num_triangles = num_triangles;
+		return Issue(COMMAND_LOAD);
+	}
+
+	/* tests every ray against the scene, appending the hits with global indices to intersections. the hits of different batches are in no
+	 * particular order */
+	bool Run(const ray_t* rays, size_t num_rays, std::vector<intersection_t>& intersections)
+	{
+		INSTRUMENT_SCOPE("MultiEngineScheduler::Run");
+
+		m_rays = rays;
+		m_num_rays = num_rays;
+		m_num_batches = (num_rays + m_batch_rays - 1) / m_batch_rays;
+		m_next_batch.store(0);
+		m_intersections = &intersections;
+
+		std::fill(m_batches_per_engine.begin(), m_batches_per_engine.end(), 0);
+
+		return Issue(COMMAND_RUN);
+	}
+
+private:
+	/* hands the command to every worker and waits for all of them to finish it. returns false if any failed */
+	bool Issue(command_t command)
+	{
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_command = command;
+		m_generation++;
+		m_finished = 0;
+		m_failed = false;
+		m_changed.notify_all();
+
+		if(command == COMMAND_STOP){
+			return true;
+		}
+
+		m_changed.wait(lock, [&]{ return m_finished == m_engines.size(); });
+		return !m_failed;
+	}
+
+	/* the slice of the triangles an engine holds */
+	void Slice(size_t engine, size_t& base, size_t& count) const
+	{
+		if(m_distribution == DISTRIBUTE_REPLICATE)
+		{
+			base = 0;
+			count = m_num_triangles;
+			return;
+		}
+
+		size_t per_engine = (m_num_triangles + m_engines.size() - 1) / m_engines.size();
+		base = std::min(m_num_triangles, engine * per_engine);
+		count = std::min(per_engine, m_num_triangles - base);
+	}
+
+	void Worker(size_t index)
+	{
+		max_engine_t* engine = m_engines[index];
+
+		AsyncRun run(m_maxfile, engine);
+		SceneSession session(m_maxfile, engine, run);
+		Rays batch_rays(m_maxfile);
+
+		int scene = -1;
+		size_t triangle_base = 0;
+		u_int64_t seen = 0;
+
+		while(true)
+		{
+			command_t command;
+			{
+				std::unique_lock<std::mutex> lock(m_lock);
+				m_changed.wait(lock, [&]{ return m_generation != seen; });
+				seen = m_generation;
+				command = m_command;
+			}
+
+			if(command == COMMAND_STOP){
+				break;
+			}
+
+			bool ok = true;
+			std::vector<intersection_t> hits;
+
+			if(command == COMMAND_LOAD)
+			{
+				session.UnloadScene(scene);
+				scene = -1;
+
+				size_t count;
+				Slice(index, triangle_base, count);
+
+				/* a partition may be empty if there are more engines than triangles. the engine then has nothing to test */
+
+				if(count > 0 || m_distribution == DISTRIBUTE_REPLICATE)
+				{
+					scene = session.LoadScene(m_triangles + triangle_base, count);
+					ok = (scene >= 0);
+				}
+			}
+			else if(command == COMMAND_RUN && scene >= 0)
+			{
+				/* replicated, the engines share one sequence of batches. partitioned, each engine runs every batch against its own slice */
+
+				size_t next = 0;
+				while(ok)
+				{
+					size_t batch = (m_distribution == DISTRIBUTE_REPLICATE) ? m_next_batch.fetch_add(1) : next++;
+					if(batch >= m_num_batches){
+						break;
+					}
+
+					size_t ray_base = batch * m_batch_rays;
+					size_t ray_count = std::min(m_batch_rays, m_num_rays - ray_base);
+
+					size_t first_hit = hits.size();
+
+					batch_rays.SetRays((ray_t*)(m_rays + ray_base), ray_count);
+					ok = session.Intersect(scene, &batch_rays, hits);
+
+					for(size_t i = first_hit; i < hits.size(); i++)
+					{
+						hits[i].ray += ray_base;
+						hits[i].triangle += triangle_base;
+					}
+
+					m_batches_per_engine[index]++;
+				}
+			}
+
+			std::lock_guard<std::mutex> lock(m_lock);
+			if(!hits.empty()){
+				m_intersections->insert(m_intersections->end(), hits.begin(), hits.end());
+			}
+			m_failed = m_failed || !ok;
+			m_finished++;
+			m_changed.notify_all();
+		}
+
+		session.UnloadScene(scene);
+	}
+};
+
+#endif /* MULTIENGINESCHEDULER_HPP_ */
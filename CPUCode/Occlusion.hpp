@@ -0,0 +1,106 @@
+/*
+ * Occlusion.hpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#ifndef OCCLUSION_HPP_
+#define OCCLUSION_HPP_
+
+#include "Maxfiles.h"
+#include "MaxSLiCInterface.h"
+#include <errno.h>
+#include <stdio.h>
+#include <vector>
+#include <thread>
+#include "Types.h"
+#include "Instrumentation.hpp"
+
+/* Receives the output of an occlusion run on the occlusion_out stream. Each slot is a 128 bit mask for a batch of 128 consecutive rays, ray 0 of the
+ * batch in the least significant bit of the first byte, so the slots read back as a bit per ray with bit (r % 64) of word (r / 64) for ray r. The
+ * last batch is sent when the rays run out, with the bits of the missing rays clear. Nothing is sent on results_out or status_out. */
+
+#define OCCLUSION_RAYS_PER_SLOT 128
+
+class Occlusion
+{
+public:
+	std::vector<u_int64_t> m_mask;
+
+private:
+	int m_slotSize;
+	int m_numSlots;
+
+	void* m_buffer;
+
+	max_llstream_t* m_stream;
+
+public:
+	Occlusion(max_file_t* maxfile, max_engine_t* engine, int num_slots = 64)
+	{
+		m_slotSize = OCCLUSION_RAYS_PER_SLOT / 8;
+		m_numSlots = num_slots;
+		m_stream = NULL;
+
+		m_buffer = NULL;
+		if(posix_memalign(&m_buffer, 4096, m_slotSize * m_numSlots) == ENOMEM){
+			printf("Could not allocate memory.");
+		}
+
+		memset(m_buffer, 0, m_slotSize * m_numSlots);
+
+		if(!max_has_handle_stream(maxfile, "occlusion_out"))
+		{
+			printf("Maxfile does not have an occlusion_out stream.\n");
+			return;
+		}
+
+		m_stream = max_llstream_setup(engine, "occlusion_out", m_numSlots, m_slotSize, m_buffer);
+	}
+
+	/* Blocks until the masks of a run over num_rays rays (as queued, including padding) have arrived, replacing the previous contents of m_mask */
+	void Collect(size_t num_rays)
+	{
+		INSTRUMENT_SCOPE("Occlusion::Collect");
+
+		size_t words_per_slot = m_slotSize / sizeof(u_int64_t);
+		size_t slots = (num_rays + OCCLUSION_RAYS_PER_SLOT - 1) / OCCLUSION_RAYS_PER_SLOT;
+
+		m_mask.clear();
+		m_mask.reserve(slots * words_per_slot);
+
+		size_t slots_read = 0;
+		while(slots_read < slots)
+		{
+			void* data;
+			ssize_t num_slots_read = max_llstream_read(m_stream, slots - slots_read, &data);
+			if(num_slots_read <= 0)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+
+			m_mask.insert(m_mask.end(), (u_int64_t*)data, ((u_int64_t*)data) + num_slots_read * words_per_slot);
+
+			max_llstream_read_discard(m_stream, num_slots_read);
+			slots_read += num_slots_read;
+		}
+	}
+
+	bool IsOccluded(size_t ray) const
+	{
+		return (m_mask[ray / 64] >> (ray % 64)) & 1;
+	}
+
+	size_t CountOccluded(size_t num_rays) const
+	{
+		size_t count = 0;
+		for(size_t r = 0; r < num_rays; r++){
+			count += IsOccluded(r);
+		}
+		return count;
+	}
+};
+
+#endif /* OCCLUSION_HPP_ */
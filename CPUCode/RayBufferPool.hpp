@@ -0,0 +1,135 @@
+/*
+ * RayBufferPool.hpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#ifndef RAYBUFFERPOOL_HPP_
+#define RAYBUFFERPOOL_HPP_
+
+#include "Maxfiles.h"
+#include "MaxSLiCInterface.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include "Types.h"
+
+#define RAY_BUFFER_ALIGNMENT 4096
+
+/* A page aligned ray buffer, like the stream buffers of Results and Status, whose capacity is a whole number of ray words. Rays written into one
+ * can be given straight to Rays::SetRays, which pads the last word in place instead of copying the rays. */
+class RayBuffer
+{
+public:
+	ray_t* m_rays;
+	size_t m_capacity;
+
+	RayBuffer(ray_t* rays, size_t capacity)
+	{
+		m_rays = rays;
+		m_capacity = capacity;
+	}
+};
+
+/* Recycles ray buffers between jobs, so a caller tracing a frame at a time does not allocate (or fault in) new memory each frame. Acquire returns
+ * the smallest free buffer large enough, or allocates one, and Release returns it to the pool. Buffers are only freed when the pool is destroyed.
+ * Acquire and Release may be called from any thread. */
+class RayBufferPool
+{
+private:
+	size_t m_rays_per_word;
+
+	std::mutex m_lock;
+	std::vector<RayBuffer*> m_free;
+	size_t m_allocated;
+
+public:
+	RayBufferPool(max_file_t* maxfile)
+	{
+		m_rays_per_word = max_get_constant_uint64t(maxfile, "RaysPerWord");
+		m_allocated = 0;
+	}
+
+	~RayBufferPool()
+	{
+		if(m_free.size() != m_allocated)
+		{
+			printf("ERROR: ray buffer pool destroyed with %zu of %zu buffers still acquired. These will be leaked.\n", m_allocated - m_free.size(),
+					m_allocated);
+		}
+
+		for(size_t i = 0; i < m_free.size(); i++)
+		{
+			free(m_free[i]->m_rays);
+			delete m_free[i];
+		}
+	}
+
+	/* returns a buffer with room for at least num_rays rays, rounded up to a whole number of ray words, or NULL if there is no memory for one */
+	RayBuffer* Acquire(size_t num_rays)
+	{
+		size_t padded_rays = PaddedRays(num_rays);
+
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+
+			size_t best = m_free.size();
+			for(size_t i = 0; i < m_free.size(); i++)
+			{
+				if(m_free[i]->m_capacity >= padded_rays && (best == m_free.size() || m_free[i]->m_capacity < m_free[best]->m_capacity)){
+					best = i;
+				}
+			}
+
+			if(best < m_free.size())
+			{
+				RayBuffer* buffer = m_free[best];
+				m_free[best] = m_free.back();
+				m_free.pop_back();
+				return buffer;
+			}
+		}
+
+		/* allocate whole pages, and let the buffer use all of them (in whole ray words), so it fits as many later jobs as it can */
+
+		size_t size = std::max(padded_rays * sizeof(ray_t), (size_t)RAY_BUFFER_ALIGNMENT);
+		size = ((size + RAY_BUFFER_ALIGNMENT - 1) / RAY_BUFFER_ALIGNMENT) * RAY_BUFFER_ALIGNMENT;
+
+		void* rays;
+		if(posix_memalign(&rays, RAY_BUFFER_ALIGNMENT, size) != 0)
+		{
+			printf("ERROR: could not allocate a ray buffer of %zu bytes.\n", size);
+			return NULL;
+		}
+
+		size_t capacity = ((size / sizeof(ray_t)) / m_rays_per_word) * m_rays_per_word;
+
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_allocated++;
+		m_free.reserve(m_allocated);
+
+		return new RayBuffer((ray_t*)rays, capacity);
+	}
+
+	/* returns a buffer to the pool. it must not be used after this, including by a run that has not finished */
+	void Release(RayBuffer* buffer)
+	{
+		if(buffer == NULL){
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_free.push_back(buffer);
+	}
+
+	size_t PaddedRays(size_t num_rays) const
+	{
+		return ((num_rays + m_rays_per_word - 1) / m_rays_per_word) * m_rays_per_word;
+	}
+};
+
+#endif /* RAYBUFFERPOOL_HPP_ */
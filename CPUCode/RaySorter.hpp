@@ -0,0 +1,172 @@
+/*
+ * RaySorter.hpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#ifndef RAYSORTER_HPP_
+#define RAYSORTER_HPP_
+
+#include <float.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "Types.h"
+
+/* Reorders rays so that rays which start near each other and point the same way are adjacent. The key of each ray is its direction octant (the signs
+ * of the direction components) above a Morton code of its origin, quantised to RAY_SORT_ORIGIN_BITS per axis within the bounds of all the origins.
+ * Rays in a contiguous run of the sorted array then traverse the same parts of the scene, which makes the CPU engines' tiles and packets more
+ * coherent, and gives ray batches tight bounds to cull triangle tiles against.
+ *
+ * m_permutation maps the index of a ray in the sorted array to its index in the array given to Sort, so results computed on the sorted rays can be
+ * mapped back with the Remap functions. The sort is stable, so rays with the same key keep their order. */
+
+#define RAY_SORT_ORIGIN_BITS 16
+
+class RaySorter
+{
+public:
+	std::vector<ray_t> m_sorted;
+	std::vector<u_int32_t> m_permutation;
+
+private:
+	std::vector<u_int64_t> m_keys;
+	std::vector<u_int64_t> m_keys_scratch;
+	std::vector<u_int32_t> m_permutation_scratch;
+
+public:
+	/* fills m_sorted and m_permutation. the buffers are kept, so sorting batches of a similar size repeatedly does not allocate */
+	void Sort(const ray_t* rays, size_t num_rays)
+	{
+		m_sorted.resize(num_rays);
+		m_permutation.resize(num_rays);
+		m_keys.resize(num_rays);
+
+		if(num_rays == 0){
+			return;
+		}
+
+		/* the bounds of the origins, which the quantisation spans */
+
+		vector3 lower(FLT_MAX, FLT_MAX, FLT_MAX);
+		vector3 upper(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for(size_t i = 0; i < num_rays; i++)
+		{
+			const vector3& o = rays[i].origin;
+			lower.x = std::min(lower.x, o.x); upper.x = std::max(upper.x, o.x);
+			lower.y = std::min(lower.y, o.y); upper.y = std::max(upper.y, o.y);
+			lower.z = std::min(lower.z, o.z); upper.z = std::max(upper.z, o.z);
+		}
+
+		const float cells = (float)((1 << RAY_SORT_ORIGIN_BITS) - 1);
+		vector3 scale(Scale(lower.x, upper.x, cells), Scale(lower.y, upper.y, cells), Scale(lower.z, upper.z, cells));
+
+		for(size_t i = 0; i < num_rays; i++)
+		{
+			const ray_t& ray = rays[i];
+
+			u_int64_t x = (u_int64_t)((ray.origin.x - lower.x) * scale.x);
+			u_int64_t y = (u_int64_t)((ray.origin.y - lower.y) * scale.y);
+			u_int64_t z = (u_int64_t)((ray.origin.z - lower.z) * scale.z);
+
+			u_int64_t octant = (ray.direction.x < 0 ? 4 : 0) | (ray.direction.y < 0 ? 2 : 0) | (ray.direction.z < 0 ? 1 : 0);
+
+			m_keys[i] = (octant << (3 * RAY_SORT_ORIGIN_BITS)) | (Spread(x) << 2) | (Spread(y) << 1) | Spread(z);
+			m_permutation[i] = (u_int32_t)i;
+		}
+
+		RadixSort(num_rays);
+
+		for(size_t i = 0; i < num_rays; i++){
+			m_sorted[i] = rays[m_permutation[i]];
+		}
+	}
+
+	/* maps the ray ids of hits against the sorted rays back to the original ids. ids past the sorted rays (e.g. those of padding rays) are left */
+	void RemapIntersections(intersection_t* intersections, size_t count) const
+	{
+		for(size_t i = 0; i < count; i++)
+		{
+			if(intersections[i].ray < m_permutation.size()){
+				intersections[i].ray = m_permutation[intersections[i].ray];
+			}
+		}
+	}
+
+	/* puts per ray records (e.g. closest hits), which are in sorted order, back into the original order */
+	template<typename T>
+	void RemapPerRay(const T* sorted_records, T* records) const
+	{
+		for(size_t i = 0; i < m_permutation.size(); i++){
+			records[m_permutation[i]] = sorted_records[i];
+		}
+	}
+
+	/* the same for an occlusion mask, with one bit per ray in 64 bit words */
+	void RemapOcclusion(const u_int64_t* sorted_mask, u_int64_t* mask) const
+	{
+		memset(mask, 0, ((m_permutation.size() + 63) / 64) * sizeof(u_int64_t));
+		for(size_t i = 0; i < m_permutation.size(); i++)
+		{
+			if((sorted_mask[i / 64] >> (i % 64)) & 1){
+				mask[m_permutation[i] / 64] |= (u_int64_t)1 << (m_permutation[i] % 64);
+			}
+		}
+	}
+
+private:
+	static float Scale(float lower, float upper, float cells)
+	{
+		return (upper > lower) ? (cells / (upper - lower)) : 0.0f;
+	}
+
+	/* spreads the low RAY_SORT_ORIGIN_BITS bits of v out to every third bit */
+	static u_int64_t Spread(u_int64_t v)
+	{
+		v &= (1 << RAY_SORT_ORIGIN_BITS) - 1;
+		v = (v | (v << 16)) & 0x0000FF0000FF;
+		v = (v | (v << 8)) & 0x00F00F00F00F;
+		v = (v | (v << 4)) & 0x0C30C30C30C3;
+		v = (v | (v << 2)) & 0x249249249249;
+		return v;
+	}
+
+	/* a least significant digit first radix sort of the keys, carrying the permutation, over only the bits the keys use */
+	void RadixSort(size_t count)
+	{
+		const int key_bits = 3 * RAY_SORT_ORIGIN_BITS + 3;
+		const int digit_bits = 8;
+
+		m_keys_scratch.resize(count);
+		m_permutation_scratch.resize(count);
+
+		for(int shift = 0; shift < key_bits; shift += digit_bits)
+		{
+			size_t offsets[1 << digit_bits] = { 0 };
+			for(size_t i = 0; i < count; i++){
+				offsets[(m_keys[i] >> shift) & ((1 << digit_bits) - 1)]++;
+			}
+
+			size_t total = 0;
+			for(int d = 0; d < (1 << digit_bits); d++)
+			{
+				size_t n = offsets[d];
+				offsets[d] = total;
+				total += n;
+			}
+
+			for(size_t i = 0; i < count; i++)
+			{
+				size_t position = offsets[(m_keys[i] >> shift) & ((1 << digit_bits) - 1)]++;
+				m_keys_scratch[position] = m_keys[i];
+				m_permutation_scratch[position] = m_permutation[i];
+			}
+
+			m_keys.swap(m_keys_scratch);
+			m_permutation.swap(m_permutation_scratch);
+		}
+	}
+};
+
+#endif /* RAYSORTER_HPP_ */
@@ -0,0 +1,342 @@
+/*
+ * RayTracerContext.hpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#ifndef RAYTRACERCONTEXT_HPP_
+#define RAYTRACERCONTEXT_HPP_
+
+#include "Maxfiles.h"
+#include "MaxSLiCInterface.h"
+#include <stdio.h>
+#include <memory.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <future>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+#include "Types.h"
+#include "Rays.hpp"
+#include "RayBufferPool.hpp"
+#include "SceneSession.hpp"
+#include "Instrumentation.hpp"
+
+/* The outcome of one job given to a RayTracerContext */
+struct result_set_t
+{
+	u_int64_t job;			/* the order the job was submitted in, from 0 */
+	bool ok;				/* false if the job could not be run, e.g. there is no scene, or the rays do not fit in a run */
+	size_t num_rays;
+
+	/* the hits, in no particular order. rays are indices into the job's rays, and triangles into the scene */
+	std::vector<intersection_t> intersections;
+
+	double queued_seconds;	/* from Submit until the engine started the job */
+	double run_seconds;		/* from then until the hits were ready */
+};
+
+/* Runs a stream of ray jobs against a scene resident in LMem, with up to max_in_flight jobs submitted at once, so the engine does not sit idle
+ * between them. Submit prepares a job on the caller's thread - copies the rays into a pooled buffer and builds the actions of its runs - while the
+ * jobs ahead of it run, and returns at once with a future for its results. A runner thread starts each job's runs as soon as the previous job's
+ * are done, and a completion thread calls the job's callback, if it has one, and then fulfils the future, so neither holds up the engine.
+ *
+ * Once max_in_flight jobs are waiting or running, Submit blocks until one completes. Callbacks run on the completion thread, one at a time, in
+ * the order the jobs finish (which is the order they were submitted, unless some could not be run); they must not call Submit, which could wait
+ * on the thread they hold.
+ *
+ * The context runs its jobs through session (and so its AsyncRun), and holds one scene in it. While jobs are in flight nothing else may use the
+ * session or its run; call Flush first. */
+class RayTracerContext
+{
+public:
+	typedef std::function<void(const result_set_t&)> completion_t;
+
+	/* how many jobs have completed, how long the engine spent on them, and how long it sat idle between runs while a job was ready for it */
+	u_int64_t m_jobs_completed;
+	double m_engine_seconds;
+	double m_gap_seconds;
+
+private:
+	struct job_t
+	{
+		int scene;
+		RayBuffer* buffer;
+		Rays* rays;
+		std::vector<max_actions_t*> actions;
+		completion_t on_complete;
+		std::promise<result_set_t> promise;
+		result_set_t result;
+
+		std::chrono::steady_clock::time_point submitted;
+		std::chrono::steady_clock::time_point ready;
+	};
+
+	SceneSession& m_session;
+	RayBufferPool m_ray_buffers;
+	int m_scene;
+
+	/* taken for the whole of Submit and SetScene, so callers on several threads prepare one job at a time */
+	std::mutex m_submit_lock;
+
+	/* the jobs waiting for the engine, and those waiting for completion. each in flight job holds one of the Rays */
+	std::mutex m_lock;
+	std::condition_variable m_changed;
+	std::deque<job_t*> m_ready;
+	std::deque<job_t*> m_finished;
+	std::vector<Rays*> m_free_rays;
+	size_t m_in_flight;
+	size_t m_max_in_flight;
+	u_int64_t m_next_job;
+	bool m_stopping;
+
+	std::thread m_runner;
+	std::thread m_completer;
+
+public:
+	RayTracerContext(max_file_t* maxfile, SceneSession& session, size_t max_in_flight = 2) :
+		m_session(session),
+		m_ray_buffers(maxfile)
+	{
+		m_scene = -1;
+
+		m_jobs_completed = 0;
+		m_engine_seconds = 0;
+		m_gap_seconds = 0;
+
+		m_in_flight = 0;
+		m_max_in_flight = std::max((size_t)1, max_in_flight);
+		m_next_job = 0;
+		m_stopping = false;
+
+		for(size_t i = 0; i < m_max_in_flight; i++){
+			m_free_rays.push_back(new Rays(maxfile));
+		}
+
+		m_runner = std::thread(&RayTracerContext::RunLoop, this);
+		m_completer = std::thread(&RayTracerContext::CompleteLoop, this);
+	}
+
+	~RayTracerContext()
+	{
+		Flush();
+
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_stopping = true;
+			m_changed.notify_all();
+		}
+
+		m_runner.join();
+		m_completer.join();
+
+		m_session.UnloadScene(m_scene);
+
+		for(size_t i = 0; i < m_free_rays.size(); i++){
+			delete m_free_rays[i];
+		}
+	}
+
+	/* waits for the jobs in flight, then makes the triangles the scene of the jobs that follow, replacing any previous one. the triangles are
+	 * packed during the call, so need only be valid for it. returns false, leaving no scene, if they could not be made resident */
+	bool SetScene(const triangle_t* triangles, size_t num_triangles)
+	{
+		INSTRUMENT_SCOPE("RayTracerContext::SetScene");
+
+		std::lock_guard<std::mutex> submit_lock(m_submit_lock);
+		Flush();
+
+		m_session.UnloadScene(m_scene);
+		m_scene = m_session.LoadScene(triangles, num_triangles);
+		return m_scene >= 0;
+	}
+
+	/* as above, for an indexed mesh, which is expanded as its tiles are packed (see SceneSession::LoadScene) */
+	bool SetScene(const IndexedMesh& mesh)
+	{
+		INSTRUMENT_SCOPE("RayTracerContext::SetScene");
+
+		std::lock_guard<std::mutex> submit_lock(m_submit_lock);
+		Flush();
+
+		m_session.UnloadScene(m_scene);
+		m_scene = m_session.LoadScene(mesh);
+		return m_scene >= 0;
+	}
+
+	/* waits for the jobs in flight, then overwrites count of the scene's triangles from first, sending only the bursts they are in (see
+	 * SceneSession::UpdateScene). the jobs that follow see the new triangles */
+	bool UpdateScene(size_t first, const triangle_t* triangles, size_t count)
+	{
+		INSTRUMENT_SCOPE("RayTracerContext::UpdateScene");
+
+		std::lock_guard<std::mutex> submit_lock(m_submit_lock);
+		Flush();
+
+		return m_session.UpdateScene(m_scene, first, triangles, count);
+	}
+
+	/* queues a job testing the rays against the scene, and returns the future of its results. the rays are copied, so need only be valid for the
+	 * call. on_complete, if given, is called with the results before the future is ready */
+	std::future<result_set_t> Submit(const ray_t* rays, size_t num_rays, completion_t on_complete = completion_t())
+	{
+		INSTRUMENT_SCOPE("RayTracerContext::Submit");
+
+		std::lock_guard<std::mutex> submit_lock(m_submit_lock);
+
+		job_t* job = new job_t();
+		job->scene = m_scene;
+		job->buffer = NULL;
+		job->on_complete = on_complete;
+		job->submitted = std::chrono::steady_clock::now();
+		job->result.ok = false;
+		job->result.num_rays = num_rays;
+		job->result.queued_seconds = 0;
+		job->result.run_seconds = 0;
+
+		std::future<result_set_t> future = job->promise.get_future();
+
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			m_changed.wait(lock, [&]{ return m_in_flight < m_max_in_flight; });
+
+			m_in_flight++;
+			job->result.job = m_next_job++;
+			job->rays = m_free_rays.back();
+			m_free_rays.pop_back();
+		}
+
+		/* this is the work that overlaps the runs of the jobs ahead */
+
+		if(m_scene < 0)
+		{
+			printf("ERROR: a job was submitted with no scene set.\n");
+		}
+		else if(num_rays == 0)
+		{
+			job->result.ok = true;
+		}
+		else
+		{
+			job->buffer = m_ray_buffers.Acquire(num_rays);
+			memcpy(job->buffer->m_rays, rays, num_rays * sizeof(ray_t));
+			job->rays->SetRays(job->buffer, num_rays);
+
+			job->result.ok = m_session.PrepareIntersect(m_scene, job->rays, job->actions);
+		}
+
+		/* jobs with nothing to run go straight to completion */
+
+		std::lock_guard<std::mutex> lock(m_lock);
+		job->ready = std::chrono::steady_clock::now();
+		if(job->result.ok && !job->actions.empty()){
+			m_ready.push_back(job);
+		}else{
+			m_finished.push_back(job);
+		}
+		m_changed.notify_all();
+
+		return future;
+	}
+
+	/* waits until every job submitted so far has completed */
+	void Flush()
+	{
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_changed.wait(lock, [&]{ return m_in_flight == 0; });
+	}
+
+	/* the session's handle of the context's scene, or -1 if it has none */
+	int Scene() const
+	{
+		return m_scene;
+	}
+
+	size_t MaxInFlight() const
+	{
+		return m_max_in_flight;
+	}
+
+private:
+	void RunLoop()
+	{
+		bool ran = false;
+		std::chrono::steady_clock::time_point last_end;
+
+		while(true)
+		{
+			job_t* job;
+			{
+				std::unique_lock<std::mutex> lock(m_lock);
+				m_changed.wait(lock, [&]{ return m_stopping || !m_ready.empty(); });
+				if(m_ready.empty()){
+					break;
+				}
+				job = m_ready.front();
+				m_ready.pop_front();
+			}
+
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+			/* a job that was ready before the last one finished could have started straight after it */
+
+			if(ran && job->ready < last_end){
+				m_gap_seconds += std::chrono::duration<double>(start - last_end).count();
+			}
+
+			job->result.ok = m_session.RunIntersect(job->scene, job->rays, job->actions, job->result.intersections);
+
+			last_end = std::chrono::steady_clock::now();
+			ran = true;
+
+			m_engine_seconds += std::chrono::duration<double>(last_end - start).count();
+			job->result.queued_seconds = std::chrono::duration<double>(start - job->submitted).count();
+			job->result.run_seconds = std::chrono::duration<double>(last_end - start).count();
+
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_finished.push_back(job);
+			m_changed.notify_all();
+		}
+	}
+
+	void CompleteLoop()
+	{
+		while(true)
+		{
+			job_t* job;
+			{
+				std::unique_lock<std::mutex> lock(m_lock);
+				m_changed.wait(lock, [&]{ return m_stopping || !m_finished.empty(); });
+				if(m_finished.empty()){
+					break;
+				}
+				job = m_finished.front();
+				m_finished.pop_front();
+			}
+
+			if(job->on_complete){
+				job->on_complete(job->result);
+			}
+
+			if(job->buffer != NULL){
+				m_ray_buffers.Release(job->buffer);
+			}
+
+			job->promise.set_value(std::move(job->result));
+
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_free_rays.push_back(job->rays);
+			m_in_flight--;
+			m_jobs_completed++;
+			m_changed.notify_all();
+
+			delete job;
+		}
+	}
+};
+
+#endif /* RAYTRACERCONTEXT_HPP_ */
@@ -7,125 +7,216 @@
 #include "Maxfiles.h"
 #include "MaxSLiCInterface.h"
 #include "Triangles.hpp"
+#include "Rays.hpp"
+#include "RayBufferPool.hpp"
+#include "IntersectionActions.hpp"
 #include "Results.hpp"
 #include "Status.hpp"
+#include "AsyncRun.hpp"
+#include "ClosestHits.hpp"
+#include "Occlusion.hpp"
+#include "SceneSession.hpp"
+#include "RayTracerContext.hpp"
 #include "Verification/TestManager.hpp"
 
 
-/* For optimum performance, the rays word width should always be a multiple of the PCIe word width, and therefore the main function of this class
- * is to ensure that the rays provided are a multiple of the rays word size in rays, so there is no stalling waiting on data. */
-class Rays
+int main(void)
 {
-public:
-	ray_t* m_rays;
-	size_t m_num_rays;
+	max_file_t *maxfile = RayTracer_init();
+	max_engine_t *engine = max_load(maxfile, "*");
 
-private:
-	int m_rays_width_in_bytes;
-	int m_rays_width_in_rays;
+	TestManager test_manager;
+	test_manager.Initiliase();
 
+	/* initialise triangles */
 
-public:
-	Rays(max_file_t* maxfile)
-	{
-		m_rays_width_in_bytes = max_get_constant_uint64t(maxfile,"RaysWordWidthInBits") / 8;
-		m_rays_width_in_rays = max_get_constant_uint64t(maxfile,"RaysPerWord");
+	Triangles* tris = new Triangles(maxfile, 16);
+	tris->SetTriangles(test_manager.m_triangle_lanes);
+	tris->IntialiseTriangles(engine,0);
 
-		if(m_rays_width_in_bytes != (m_rays_width_in_rays * sizeof(ray_t)))
-		{
-			printf("ERROR: rays word width is not a multiple of the ray data structure width. This is not currently supported.\n");
-		}
-	}
+	/* Queue the rays. they are written into a pooled buffer, which has room for the padding, so Rays can queue them without another copy */
 
-	void SetRays(ray_t* rays, size_t num_rays)
-	{
-		m_rays = rays;
-		m_num_rays = num_rays;
+	RayBufferPool ray_buffers(maxfile);
+	RayBuffer* ray_buffer = ray_buffers.Acquire(test_manager.m_rays_count);
+	memcpy(ray_buffer->m_rays, test_manager.m_rays, test_manager.m_rays_count * sizeof(ray_t));
 
-		//for rays, only a simple check if we need to pad the input to make the ray count a multiple of the rays word width (in rays)
-		if((num_rays % m_rays_width_in_rays) != 0)
-		{
-			m_num_rays = m_num_rays + (m_rays_width_in_rays - (num_rays % m_rays_width_in_rays));
-			m_rays = (ray_t*)malloc(m_num_rays * sizeof(ray_t));
-			memset(m_rays, 0, m_num_rays * sizeof(ray_t));
-			memcpy(m_rays, rays, num_rays * sizeof(ray_t));
-		}
-	}
+	Rays rays(maxfile);
+	rays.SetRays(ray_buffer, test_manager.m_rays_count);
+
+	max_actions_t* act = CreateIntersectionActions(maxfile, tris, 0, &rays);
+
+	/* prepare the output. the run drains the result and status streams on its own thread, while this one consumes the results */
+
+	AsyncRun run(maxfile, engine);
 
-	void QueueRays(max_actions_t* actions)
+	printf("Running on DFE...\n");
+
+	run.Start(engine, act);
+
+	std::vector<intersection_t> intersections;
+	run.Consume([&](const intersection_t* batch, size_t count)
 	{
-		max_queue_input(actions, "rays_in", m_rays, m_num_rays * sizeof(ray_t));
-	}
+		intersections.insert(intersections.end(), batch, batch + count);
+	});
+	run.Wait();
 
+	run.GetStatus().PrintSummary();
+	run.GetResults().PrintRingSummary();
 
-};
+	bool passed = test_manager.CheckResults(intersections);
 
-int main(void)
-{
-	max_file_t *maxfile = RayTracer_init();
-	max_engine_t *engine = max_load(maxfile, "*");
+	/* the same rays in closest hit mode, which returns one record per ray */
 
-	TestManager test_manager;
-	test_manager.Initiliase();
+	ClosestHits closest(maxfile, engine);
+	max_actions_t* closest_act = CreateIntersectionActions(maxfile, tris, 0, &rays, NULL, 0, QUERY_CLOSEST_HIT);
 
-	/* initialise triangles */
+	printf("Running closest hit tests on DFE...\n");
 
-	Triangles* tris = new Triangles(maxfile, 16);
-	tris->SetTriangles(test_manager.m_triangles, test_manager.m_triangle_count);
-	tris->IntialiseTriangles(engine,0);
+	max_run_t* closest_run = max_run_nonblock(engine, closest_act);
+	closest.Collect(rays.m_num_rays, test_manager.m_rays_count);
+	max_wait(closest_run);
 
-	/* Queue the rays */
+	passed = test_manager.CheckClosestHits(closest.m_hits) && passed;
 
-	Rays rays(maxfile);
-	rays.SetRays(test_manager.m_rays, test_manager.m_rays_count);
+	/* and as occlusion queries, which return a bit per ray */
 
-	max_actions_t* act = max_actions_init(maxfile, NULL);
-	
-	int triangles_per_tick = max_get_constant_uint64t(maxfile, "TrianglesPerTick");
-	int rays_per_tick = max_get_constant_uint64t(maxfile, "RaysPerTick");
-	int rays_in_set = rays.m_num_rays;
-	int triangles_in_set = tris->m_total_triangles;
+	Occlusion occlusion(maxfile, engine);
+	max_actions_t* occlusion_act = CreateIntersectionActions(maxfile, tris, 0, &rays, NULL, 0, QUERY_OCCLUSION);
+
+	printf("Running occlusion tests on DFE...\n");
 
-	int intersection_ticks = (triangles_in_set / triangles_per_tick) * (rays_in_set / rays_per_tick);
-	int memory_command_ticks = (rays_in_set / rays_per_tick);
+	max_run_t* occlusion_run = max_run_nonblock(engine, occlusion_act);
+	occlusion.Collect(rays.m_num_rays);
+	max_wait(occlusion_run);
 
-	max_set_ticks(act, "MemoryCommandGenerator", memory_command_ticks);
-	max_set_uint64t(act,"MemoryCommandGenerator","triangles_to_read_in_bursts",tris->m_total_bursts);
+	printf("\t%zu of %zu rays occluded\n", occlusion.CountOccluded(test_manager.m_rays_count), test_manager.m_rays_count);
 
-	max_ignore_lmem(act,"triangles_to_mem");
+	passed = test_manager.CheckOcclusion(occlusion.m_mask) && passed;
 
-	max_set_ticks(act, "RayTracerKernel", intersection_ticks);
-	max_set_uint64t(act,"RayTracerKernel","total_triangles",triangles_in_set);
-	max_set_uint64t(act,"RayTracerKernel","total_rays",rays_in_set);
+	/* all hits again, with the compact result encodings. the words sent are kept so they can be checked as well as the hits decoded from them */
 
-	rays.QueueRays(act);
+	result_encoding_t encodings[2] = { RESULT_ENCODING_MASKS, RESULT_ENCODING_DELTAS };
+	for(int e = 0; e < 2; e++)
+	{
+		max_actions_t* encoded_act = CreateIntersectionActions(maxfile, tris, 0, &rays, NULL, 0, QUERY_ALL_HITS, encodings[e]);
 
+		printf("Running on DFE with %s encoding...\n", ResultEncodingName(encodings[e]));
 
-	/* prepare the output */
+		std::vector<u_int32_t> units;
+		run.GetResults().SetCapture(&units);
 
-	Results results(maxfile, engine);
-	Status status(maxfile, engine);
+		size_t encoded_intersections = 0;
+		run.Start(engine, encoded_act, encodings[e], tris->m_total_triangles, rays.m_num_rays);
+		run.Consume([&](const intersection_t*, size_t count){ encoded_intersections += count; });
+		run.Wait();
 
-	printf("Running on DFE...\n");
+		run.GetResults().SetCapture(NULL);
+
+		printf("\t%zu intersections in %zu bytes\n", encoded_intersections, units.size() * sizeof(u_int32_t));
+
+		result_layout_t layout(max_get_constant_uint64t(maxfile, "RaysPerTick"), max_get_constant_uint64t(maxfile, "TrianglesPerTick"),
+				tris->m_total_triangles, rays.m_num_rays);
+		passed = test_manager.CheckEncodedResults(encodings[e], layout, units) && passed;
 
-	max_run_t* max_run = max_run_nonblock(engine, act);
+		max_actions_free(encoded_act);
+	}
 
-	while(true)
+	/* and as a stream of small jobs through a context, which prepares each while those ahead of it run. its scene is kept above the triangles
+	 * already in LMem, and its runs share the streams of the run above */
 	{
-		results.ReadResults();
+		SceneSession session(maxfile, engine, run, tris->m_total_bursts);
+		RayTracerContext context(maxfile, session, 3);
+		context.SetScene(test_manager.m_triangles, test_manager.m_triangle_count);
+
+		printf("Running as pipelined jobs on DFE...\n");
+
+		size_t job_rays = 4;
+		std::vector< std::future<result_set_t> > jobs;
+		for(size_t base = 0; base < test_manager.m_rays_count; base += job_rays){
+			jobs.push_back(context.Submit(test_manager.m_rays + base, std::min(job_rays, test_manager.m_rays_count - base)));
+		}
+
+		std::vector<intersection_t> job_intersections;
+		for(size_t i = 0; i < jobs.size(); i++)
+		{
+			result_set_t result = jobs[i].get();
+			passed = result.ok && passed;
+
+			for(size_t j = 0; j < result.intersections.size(); j++)
+			{
+				intersection_t hit = result.intersections[j];
+				hit.ray += i * job_rays;
+				job_intersections.push_back(hit);
+			}
+		}
+
+		context.Flush();
+		printf("\t%llu jobs, engine busy %.3f ms, idle %.3f ms between ready jobs\n", (unsigned long long)context.m_jobs_completed,
+				context.m_engine_seconds * 1e3, context.m_gap_seconds * 1e3);
 
-		if(status.ReadStatus()){
-			status.PrintSummary();
-			break;
+		passed = test_manager.CheckResults(job_intersections) && passed;
+
+		/* move a few of the triangles, as an animated scene would, sending only the bursts they are in, and refit the CPU's hierarchy to match
+		 * rather than rebuilding it */
+
+		BVH bvh;
+		bvh.Build(test_manager.m_triangles, test_manager.m_triangle_count);
+
+		size_t first_moved = 5;
+		std::vector<triangle_t> moved(test_manager.m_triangles + first_moved, test_manager.m_triangles + first_moved + 3);
+		std::vector<u_int32_t> moved_ids;
+		for(size_t i = 0; i < moved.size(); i++)
+		{
+			moved[i].v0.x += 2;
+			moved[i].v1.x += 2;
+			moved[i].v2.x += 2;
+			moved_ids.push_back(first_moved + i);
 		}
+
+		printf("Running on DFE after moving %zu triangles...\n", moved.size());
+
+		u_int64_t bytes_before = session.m_bytes_uploaded;
+		passed = context.UpdateScene(first_moved, &moved[0], moved.size()) && passed;
+		test_manager.UpdateTriangles(first_moved, &moved[0], moved.size());
+		bvh.Refit(test_manager.m_triangles, &moved_ids[0], moved_ids.size());
+
+		result_set_t moved_result = context.Submit(test_manager.m_rays, test_manager.m_rays_count).get();
+		printf("\t%llu of %llu bytes uploaded, %zu intersections\n", (unsigned long long)(session.m_bytes_uploaded - bytes_before),
+				(unsigned long long)session.SizeInBursts(context.Scene()) * max_get_burst_size(maxfile, NULL), moved_result.intersections.size());
+
+		passed = moved_result.ok && test_manager.CheckResults(moved_result.intersections) && passed;
+		passed = test_manager.CheckBVH(bvh) && passed;
+
+		/* and the same triangles as an indexed mesh, which shares the vertices they have in common. the engine's tiles are expanded from it as they
+		 * are packed, while the CPU reads it as it is */
+
+		IndexedMesh mesh;
+		mesh.SetTriangles(test_manager.m_triangles, test_manager.m_triangle_count);
+
+		printf("Running on DFE from an indexed mesh...\n");
+		printf("\t%zu vertices for %zu triangles, %zu bytes against %zu\n", mesh.m_vertices.size(), mesh.NumTriangles(), mesh.SizeInBytes(),
+				mesh.ExpandedSizeInBytes());
+
+		passed = context.SetScene(mesh) && passed;
+		result_set_t mesh_result = context.Submit(test_manager.m_rays, test_manager.m_rays_count).get();
+
+		passed = mesh_result.ok && test_manager.CheckResults(mesh_result.intersections) && passed;
+		passed = test_manager.CheckMesh(mesh) && passed;
 	}
 
-	test_manager.CheckResults(results);
+	/* a scene file written in the engine's word layout, whose triangles are used from the mapping without being copied */
+
+	printf("Checking a mapped scene file...\n");
+	passed = test_manager.CheckSceneFile(maxfile) && passed;
+
+	ray_buffers.Release(ray_buffer);
 
-	max_wait(max_run);
 	max_unload(engine);
 
+	INSTRUMENT_PRINT_SUMMARY();
+	INSTRUMENT_WRITE_CHROME_TRACE("RayTracer.trace.json");
+
 	printf("Done.\n");
 	
-	return 0;
+	return passed ? 0 : 1;
 }
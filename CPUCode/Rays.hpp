@@ -0,0 +1,129 @@
+/*
+ * Rays.hpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#ifndef RAYS_HPP_
+#define RAYS_HPP_
+
+#include "Maxfiles.h"
+#include "MaxSLiCInterface.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Types.h"
+#include "RayBufferPool.hpp"
+#include "Instrumentation.hpp"
+
+/* For optimum performance, the rays word width should always be a multiple of the PCIe word width, and therefore the main function of this class
+ * is to ensure that the rays provided are a multiple of the rays word size in rays, so there is no stalling waiting on data.
+ *
+ * Rays in a RayBuffer already have room for the padding, so are queued where they are. Other arrays whose count is not a whole number of words
+ * are copied into a padded buffer, which is kept and reused by later calls. */
+class Rays
+{
+public:
+	ray_t* m_rays;
+	size_t m_num_rays;
+
+private:
+	int m_rays_width_in_bytes;
+	int m_rays_width_in_rays;
+
+	ray_t* m_padded;
+	size_t m_padded_capacity;
+
+
+public:
+	Rays(max_file_t* maxfile)
+	{
+		m_rays_width_in_bytes = max_get_constant_uint64t(maxfile,"RaysWordWidthInBits") / 8;
+		m_rays_width_in_rays = max_get_constant_uint64t(maxfile,"RaysPerWord");
+
+		if(m_rays_width_in_bytes != (m_rays_width_in_rays * sizeof(ray_t)))
+		{
+			printf("ERROR: rays word width is not a multiple of the ray data structure width. This is not currently supported.\n");
+		}
+
+		m_rays = NULL;
+		m_num_rays = 0;
+		m_padded = NULL;
+		m_padded_capacity = 0;
+	}
+
+	~Rays()
+	{
+		free(m_padded);
+	}
+
+	Rays(const Rays&) = delete;
+	Rays& operator=(const Rays&) = delete;
+
+	void SetRays(ray_t* rays, size_t num_rays)
+	{
+		INSTRUMENT_SCOPE("Rays::SetRays");
+
+		m_rays = rays;
+		m_num_rays = num_rays;
+
+		//for rays, only a simple check if we need to pad the input to make the ray count a multiple of the rays word width (in rays)
+		if((num_rays % m_rays_width_in_rays) != 0)
+		{
+			m_num_rays = m_num_rays + (m_rays_width_in_rays - (num_rays % m_rays_width_in_rays));
+
+			if(m_num_rays > m_padded_capacity)
+			{
+				free(m_padded);
+				m_padded = NULL;
+				m_padded_capacity = 0;
+
+				if(posix_memalign((void**)&m_padded, RAY_BUFFER_ALIGNMENT, m_num_rays * sizeof(ray_t)) != 0)
+				{
+					printf("ERROR: could not allocate %zu bytes to pad the rays.\n", m_num_rays * sizeof(ray_t));
+					m_rays = NULL;
+					m_num_rays = 0;
+					return;
+				}
+				m_padded_capacity = m_num_rays;
+			}
+
+			memcpy(m_padded, rays, num_rays * sizeof(ray_t));
+			memset((char*)(m_padded + num_rays), 0, (m_num_rays - num_rays) * sizeof(ray_t));
+			m_rays = m_padded;
+		}
+	}
+
+	/* uses the first num_rays rays of the buffer without copying them. the padding rays after them are cleared (a zero ray hits nothing), so the
+	 * buffer must not be written to or released until the run has finished */
+	void SetRays(RayBuffer* buffer, size_t num_rays)
+	{
+		INSTRUMENT_SCOPE("Rays::SetRays");
+
+		m_rays = buffer->m_rays;
+		m_num_rays = ((num_rays + m_rays_width_in_rays - 1) / m_rays_width_in_rays) * m_rays_width_in_rays;
+
+		if(m_num_rays > buffer->m_capacity)
+		{
+			printf("ERROR: %zu rays do not fit in a ray buffer of %zu.\n", num_rays, buffer->m_capacity);
+			m_rays = NULL;
+			m_num_rays = 0;
+			return;
+		}
+
+		memset((char*)(m_rays + num_rays), 0, (m_num_rays - num_rays) * sizeof(ray_t));
+	}
+
+	void QueueRays(max_actions_t* actions)
+	{
+		INSTRUMENT_SCOPE("Rays::QueueRays");
+		INSTRUMENT_COUNTER("Ray bytes queued", m_num_rays * sizeof(ray_t));
+
+		max_queue_input(actions, "rays_in", m_rays, m_num_rays * sizeof(ray_t));
+	}
+
+
+};
+
+#endif /* RAYS_HPP_ */
@@ -0,0 +1,293 @@
+/*
+ * ResultEncoding.hpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#ifndef RESULTENCODING_HPP_
+#define RESULTENCODING_HPP_
+
+#include <stdio.h>
+#include <memory.h>
+#include <vector>
+#include <algorithm>
+#include "Types.h"
+
+/* How an all hits run sends its hits on results_out. Whichever is used, the stream is a sequence of 64 bit units, two to a 16 byte slot.
+ *
+ * Pairs: one unit per hit, a (ray, triangle) pair laid out as an intersection_t.
+ *
+ * Masks: one unit per kernel tick on which anything hit, holding the tick and a mask of which of the tick's (ray, triangle) tests hit. Bit
+ * (r * triangles_per_tick) + t stands for ray r of the tick's ray word against triangle t of its triangle word. Within a pass, ticks go through the
+ * triangle words in order, so a unit is in effect the hits of a pair of rays against a run of triangles, and dense hits cost a fraction of a pair
+ * each.
+ *
+ * Deltas: the same masks, each in a 32 bit record along with the number of ticks since the previous record (or since the tick before the first), in
+ * the bits above the mask. The records of one pass are the triangle words each pair of rays hit, delta coded. Whenever the maximum delta goes by
+ * without a hit, an empty record (mask zero) carries it, up to the end of the run. Two records make a unit, the first in the low half.
+ *
+ * In the encoded modes, padding (the unused half of the last unit, and the unused unit of the last slot) is zero, which decodes to nothing, so the
+ * stream needs no trimming; the count in the status report is of units, not hits. */
+enum result_encoding_t
+{
+	RESULT_ENCODING_PAIRS = 0,
+	RESULT_ENCODING_MASKS = 1,
+	RESULT_ENCODING_DELTAS = 2
+};
+
+/* where the bits of a tick fall, for one run */
+struct result_layout_t
+{
+	u_int32_t rays_per_tick;
+	u_int32_t triangles_per_tick;
+	u_int64_t words_per_pass;	/* the run's total_triangles / triangles_per_tick */
+	u_int64_t ticks;			/* the length of the run */
+
+	result_layout_t(u_int32_t rays_per_tick = 1, u_int32_t triangles_per_tick = 1, u_int64_t total_triangles = 0, u_int64_t total_rays = 0)
+	{
+		this->rays_per_tick = std::max((u_int32_t)1, rays_per_tick);
+		this->triangles_per_tick = std::max((u_int32_t)1, triangles_per_tick);
+		this->words_per_pass = std::max((u_int64_t)1, total_triangles / this->triangles_per_tick);
+		this->ticks = (total_triangles / this->triangles_per_tick) * (total_rays / this->rays_per_tick);
+	}
+
+	u_int32_t MaskBits() const
+	{
+		return rays_per_tick * triangles_per_tick;
+	}
+
+	u_int32_t MaxDelta() const
+	{
+		return (MaskBits() < 32) ? ((1u << (32 - MaskBits())) - 1) : 0;
+	}
+};
+
+inline const char* ResultEncodingName(result_encoding_t encoding)
+{
+	switch(encoding)
+	{
+	case RESULT_ENCODING_PAIRS:		return "pairs";
+	case RESULT_ENCODING_MASKS:		return "masks";
+	case RESULT_ENCODING_DELTAS:	return "deltas";
+	}
+	return "unknown";
+}
+
+/* Turns the units of an encoded stream back into intersections. The decoder carries the position in the run from one call to the next, so the
+ * stream may be decoded as it arrives, in pieces of any number of whole units. */
+class ResultDecoder
+{
+private:
+	result_encoding_t m_encoding;
+	result_layout_t m_layout;
+
+	/* deltas: the tick of the previous record, plus one, so the first record's delta counts from zero */
+	u_int64_t m_next_tick;
+
+public:
+	ResultDecoder()
+	{
+		Begin(RESULT_ENCODING_PAIRS, result_layout_t());
+	}
+
+	/* starts a new run */
+	void Begin(result_encoding_t encoding, const result_layout_t& layout)
+	{
+		m_encoding = encoding;
+		m_layout = layout;
+		m_next_tick = 0;
+
+		if(encoding != RESULT_ENCODING_PAIRS && !Supported(encoding, layout)){
+			printf("ERROR: a tick's %u mask bits do not fit the %s encoding.\n", layout.MaskBits(), ResultEncodingName(encoding));
+		}
+	}
+
+	result_encoding_t Encoding() const
+	{
+		return m_encoding;
+	}
+
+	/* masks need a bit per test of a tick in 32 bits, and deltas at least one bit more */
+	static bool Supported(result_encoding_t encoding, const result_layout_t& layout)
+	{
+		switch(encoding)
+		{
+		case RESULT_ENCODING_PAIRS:		return true;
+		case RESULT_ENCODING_MASKS:		return layout.MaskBits() <= 32;
+		case RESULT_ENCODING_DELTAS:	return layout.MaxDelta() > 0;
+		}
+		return false;
+	}
+
+	/* the number of hits num_units units hold, without decoding them. does not advance the run */
+	size_t CountHits(const u_int32_t* units, size_t num_units) const
+	{
+		if(m_encoding == RESULT_ENCODING_PAIRS){
+			return num_units;
+		}
+
+		size_t hits = 0;
+		if(m_encoding == RESULT_ENCODING_MASKS)
+		{
+			for(size_t i = 0; i < num_units; i++){
+				hits += __builtin_popcount(units[(i * 2) + 1]);
+			}
+		}
+		else
+		{
+			u_int32_t mask_of_record = MaskOfRecord();
+			for(size_t i = 0; i < num_units * 2; i++){
+				hits += __builtin_popcount(units[i] & mask_of_record);
+			}
+		}
+		return hits;
+	}
+
+	/* appends the hits of num_units units to intersections. the vector is grown once, to the exact size, and the hits written in place */
+	size_t Decode(const u_int32_t* units, size_t num_units, std::vector<intersection_t>& intersections)
+	{
+		size_t begin = intersections.size();
+		intersections.resize(begin + CountHits(units, num_units));
+
+		intersection_t* out = intersections.empty() ? NULL : &intersections[begin];
+
+		if(m_encoding == RESULT_ENCODING_PAIRS)
+		{
+			if(num_units > 0){
+				memcpy(out, units, num_units * sizeof(intersection_t));
+			}
+		}
+		else if(m_encoding == RESULT_ENCODING_MASKS)
+		{
+			for(size_t i = 0; i < num_units; i++){
+				out = Expand(units[i * 2], units[(i * 2) + 1], out);
+			}
+		}
+		else
+		{
+			u_int32_t mask_bits = m_layout.MaskBits();
+			u_int32_t mask_of_record = MaskOfRecord();
+
+			for(size_t i = 0; i < num_units * 2; i++)
+			{
+				u_int32_t delta = (mask_bits < 32) ? (units[i] >> mask_bits) : 0;
+				if(delta == 0){
+					continue;
+				}
+
+				u_int64_t tick = m_next_tick + delta - 1;
+				out = Expand(tick, units[i] & mask_of_record, out);
+				m_next_tick = tick + 1;
+			}
+		}
+
+		return intersections.size() - begin;
+	}
+
+private:
+	u_int32_t MaskOfRecord() const
+	{
+		return (m_layout.MaskBits() < 32) ? ((1u << m_layout.MaskBits()) - 1) : 0xFFFFFFFF;
+	}
+
+	intersection_t* Expand(u_int64_t tick, u_int32_t mask, intersection_t* out) const
+	{
+		u_int32_t ray_base = (u_int32_t)((tick / m_layout.words_per_pass) * m_layout.rays_per_tick);
+		u_int32_t triangle_base = (u_int32_t)((tick % m_layout.words_per_pass) * m_layout.triangles_per_tick);
+
+		while(mask != 0)
+		{
+			u_int32_t bit = __builtin_ctz(mask);
+			mask &= mask - 1;
+
+			out->ray = ray_base + (bit / m_layout.triangles_per_tick);
+			out->triangle = triangle_base + (bit % m_layout.triangles_per_tick);
+			out++;
+		}
+		return out;
+	}
+};
+
+/* Encodes a set of hits as a run with the given layout would send them, slot padding included, so a reference set of hits can be compared with
+ * what the engine sent. The hits may be in any order, but must be within the run's rays and triangles. In the pairs encoding the engine's hits are
+ * in no particular order, and its padding is not zero, so only the encoded modes can be compared word for word. */
+inline bool EncodeResults(result_encoding_t encoding, const result_layout_t& layout, const intersection_t* intersections, size_t count,
+		std::vector<u_int32_t>& units)
+{
+	units.clear();
+
+	if(!ResultDecoder::Supported(encoding, layout))
+	{
+		printf("ERROR: a tick's %u mask bits do not fit the %s encoding.\n", layout.MaskBits(), ResultEncodingName(encoding));
+		return false;
+	}
+
+	if(encoding == RESULT_ENCODING_PAIRS)
+	{
+		for(size_t i = 0; i < count; i++)
+		{
+			units.push_back(intersections[i].ray);
+			units.push_back(intersections[i].triangle);
+		}
+	}
+	else
+	{
+		/* order the hits by tick, with the bit of each below it */
+
+		std::vector<u_int64_t> keys(count);
+		for(size_t i = 0; i < count; i++)
+		{
+			u_int64_t pass = intersections[i].ray / layout.rays_per_tick;
+			u_int64_t tick = (pass * layout.words_per_pass) + (intersections[i].triangle / layout.triangles_per_tick);
+			u_int64_t bit = ((intersections[i].ray % layout.rays_per_tick) * layout.triangles_per_tick) + (intersections[i].triangle % layout.triangles_per_tick);
+			keys[i] = (tick << 5) | bit;
+		}
+		std::sort(keys.begin(), keys.end());
+
+		u_int64_t max_delta = layout.MaxDelta();
+		u_int64_t next_tick = 0;
+
+		for(size_t i = 0; i < keys.size(); )
+		{
+			u_int64_t tick = keys[i] >> 5;
+			u_int32_t mask = 0;
+			for(; i < keys.size() && (keys[i] >> 5) == tick; i++){
+				mask |= 1u << (keys[i] & 31);
+			}
+
+			if(encoding == RESULT_ENCODING_MASKS)
+			{
+				units.push_back((u_int32_t)tick);
+				units.push_back(mask);
+				continue;
+			}
+
+			while(tick + 1 - next_tick > max_delta)
+			{
+				units.push_back((u_int32_t)(max_delta << layout.MaskBits()));
+				next_tick += max_delta;
+			}
+			units.push_back((u_int32_t)(((tick + 1 - next_tick) << layout.MaskBits()) | mask));
+			next_tick = tick + 1;
+		}
+
+		/* the empty records after the last hit */
+
+		if(encoding == RESULT_ENCODING_DELTAS)
+		{
+			while(next_tick + max_delta <= layout.ticks)
+			{
+				units.push_back((u_int32_t)(max_delta << layout.MaskBits()));
+				next_tick += max_delta;
+			}
+		}
+	}
+
+	/* whole slots of four words, the padding zero */
+
+	units.resize(((units.size() + 3) / 4) * 4, 0);
+	return true;
+}
+
+#endif /* RESULTENCODING_HPP_ */
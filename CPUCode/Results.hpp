@@ -12,7 +12,11 @@
 #include "MaxSLiCInterface.h"
 #include <errno.h>
 #include "Types.h"
+#include "ResultEncoding.hpp"
+#include "Instrumentation.hpp"
 #include <vector>
+#include <algorithm>
+#include <functional>
 
 struct result_t
 {
@@ -22,11 +26,21 @@ struct result_t
 	u_int32_t triangle_2;
 };
 
+/* A results slot holds two (ray, triangle) pairs laid out exactly as two consecutive intersection_t's, so slots read from the ring buffer can be
+ * handed out as intersections without decoding or copying. Runs with one of the compact encodings (see ResultEncoding) are decoded into a scratch
+ * buffer that is kept between reads, and handed out from there */
+typedef std::function<void(const intersection_t* intersections, size_t count)> results_consumer_t;
+
 class Results
 {
 public:
 	std::vector<intersection_t> m_intersections;
 
+	/* ring statistics: whether the DFE ever filled the ring (and so may have stalled waiting on the host), and the largest backlog seen */
+	bool m_ring_became_full;
+	size_t m_max_slots_pending;
+	size_t m_total_slots_read;
+
 private:
 
 	int m_slotSize; 	//one pcie word width
@@ -39,13 +53,58 @@ private:
 
 	max_llstream_t* m_results_stream;
 
+	results_consumer_t m_consumer;
+
+	u_int32_t m_rays_per_tick;
+	u_int32_t m_triangles_per_tick;
+	ResultDecoder m_decoder;
+	std::vector<intersection_t> m_decoded;
+
+	std::vector<u_int32_t>* m_capture;
+
+	intersection_t* m_arena;
+	size_t m_arena_capacity;
+	size_t m_arena_count;
+
+	/* the slot the next read starts at, so a read that reaches the end of the ring is known to continue from its start */
+	size_t m_read_position;
+
+	/* with a consumer the newest intersection of a pairs run is held back until the next read, or TrimToCount, so the padding is never handed
+	 * out. m_consumed counts those that have been */
+	intersection_t m_held;
+	bool m_holding;
+	size_t m_consumed;
+
 public:
-	Results(max_file_t* maxfile, max_engine_t* engine)
+	Results(max_file_t* maxfile, max_engine_t* engine, int num_slots = 512)
 	{
 		m_maxfile = maxfile;
 
 		m_slotSize = 16;
-		m_numSlots = 512;
+		m_numSlots = num_slots;
+
+		m_ring_became_full = false;
+		m_max_slots_pending = 0;
+		m_total_slots_read = 0;
+
+		m_arena = NULL;
+		m_arena_capacity = 0;
+		m_arena_count = 0;
+
+		m_read_position = 0;
+		m_holding = false;
+		m_consumed = 0;
+
+		m_results_stream = NULL;
+		m_capture = NULL;
+
+		m_rays_per_tick = max_get_constant_uint64t(maxfile, "RaysPerTick");
+		m_triangles_per_tick = max_get_constant_uint64t(maxfile, "TrianglesPerTick");
+
+		if(sizeof(result_t) != (size_t)m_slotSize || sizeof(result_t) != 2 * sizeof(intersection_t))
+		{
+			printf("ERROR: result_t does not match the results slot layout.\n");
+		}
 
 		m_results_buffer_size = m_slotSize * m_numSlots;
 		m_results_buffer = NULL;
@@ -64,29 +123,138 @@ public:
 		m_results_stream = max_llstream_setup(engine, "results_out", m_numSlots, m_slotSize, m_results_buffer);
 	}
 
-	void ReadResults()
+	/* results are handed to the consumer in spans that point straight into the ring buffer, and are only valid for the duration of the call. in
+	 * pairs runs the last intersection is only handed out by TrimToCount, which must be called with the count in the status once it arrives */
+	void SetConsumer(results_consumer_t consumer)
+	{
+		m_consumer = consumer;
+	}
+
+	/* results are copied into a caller owned arena instead of m_intersections. anything beyond the capacity is dropped and counted in Overflow() */
+	void SetArena(intersection_t* arena, size_t capacity)
+	{
+		m_arena = arena;
+		m_arena_capacity = capacity;
+		m_arena_count = 0;
+	}
+
+	/* how the next run's results are encoded, and the size of the run, which the encoded modes need to place their hits. call before the run
+	 * starts */
+	void BeginRun(result_encoding_t encoding = RESULT_ENCODING_PAIRS, u_int64_t total_triangles = 0, u_int64_t total_rays = 0)
+	{
+		m_decoder.Begin(encoding, result_layout_t(m_rays_per_tick, m_triangles_per_tick, total_triangles, total_rays));
+		m_holding = false;
+		m_consumed = 0;
+	}
+
+	result_encoding_t Encoding() const
+	{
+		return m_decoder.Encoding();
+	}
+
+	/* every word read is also appended to capture, as it was sent, so an encoded stream can be checked against a reference. NULL stops this */
+	void SetCapture(std::vector<u_int32_t>* capture)
 	{
-		int slots_to_get = 1;
-		void* results_data;
-		int num_slots_read = max_llstream_read(m_results_stream, slots_to_get, &results_data);
+		m_capture = capture;
+	}
+
+	size_t ArenaCount() const
+	{
+		return std::min(m_arena_count, m_arena_capacity);
+	}
 
-		for(int i = 0; i < num_slots_read; i++)
+	size_t Overflow() const
+	{
+		return (m_arena_count > m_arena_capacity) ? (m_arena_count - m_arena_capacity) : 0;
+	}
+
+	/* Drains every slot currently in the ring. max_llstream_read only returns contiguous slots, so when the data wraps around the end of the ring
+	 * it takes more than one read. Returns the number of slots read. */
+	size_t ReadResults()
+	{
+		size_t slots_read = 0;
+
+		/* the backlog is what was in the ring when the call began: the first read, and the read after it if the first reached the end of the ring.
+		 * the reads after that are of slots the engine wrote while this one drained the ring, so do not show it falling behind */
+
+		size_t backlog = 0;
+		bool in_backlog = true;
+
+		INSTRUMENT_COUNT("Results::ReadResults polls", 1);
+
+		while(true)
 		{
-			result_t result = *((result_t*)results_data);
+			void* results_data;
+			ssize_t num_slots_read = max_llstream_read(m_results_stream, m_numSlots, &results_data);
+			if(num_slots_read <= 0){
+				break;
+			}
+
+			INSTRUMENT_SCOPE("Results::ReadResults batch");
+			INSTRUMENT_COUNTER("Result slots read", num_slots_read);
 
-			intersection_t intersection_1;
-			intersection_1.ray = result.ray_1;
-			intersection_1.triangle = result.triangle_1;
-			intersection_t intersection_2;
-			intersection_2.ray = result.ray_2;
-			intersection_2.triangle = result.triangle_2;
+			if(m_capture != NULL){
+				m_capture->insert(m_capture->end(), (const u_int32_t*)results_data, ((const u_int32_t*)results_data) + (num_slots_read * 4));
+			}
 
-			m_intersections.push_back(intersection_1);
-			m_intersections.push_back(intersection_2);
+			if(m_decoder.Encoding() == RESULT_ENCODING_PAIRS)
+			{
+				Deliver((const intersection_t*)results_data, num_slots_read * 2);
+			}
+			else
+			{
+				m_decoded.clear();
+				m_decoder.Decode((const u_int32_t*)results_data, num_slots_read * 2, m_decoded);
+				if(!m_decoded.empty()){
+					Deliver(&m_decoded[0], m_decoded.size());
+				}
+			}
 
+			max_llstream_read_discard(m_results_stream, num_slots_read);
+			slots_read += num_slots_read;
+
+			if(in_backlog){
+				backlog += num_slots_read;
+			}
+			m_read_position += num_slots_read;
+			in_backlog = in_backlog && (m_read_position == (size_t)m_numSlots) && (backlog == (size_t)num_slots_read);
+			m_read_position %= m_numSlots;
+		}
+
+		if(backlog >= (size_t)m_numSlots){
+			m_ring_became_full = true;
 		}
+		m_max_slots_pending = std::max(m_max_slots_pending, backlog);
+		m_total_slots_read += slots_read;
 
-		max_llstream_read_discard(m_results_stream, num_slots_read);
+		return slots_read;
+	}
+
+	/* The serialiser pads the stream to a whole slot when the number of hits is odd, so the last intersection read may not be real. This discards
+	 * everything beyond the count reported in the status, and hands the consumer the intersection held back from it if that is within the count.
+	 * The encoded modes pad with nothing, and report a count of units, so are not trimmed */
+	void TrimToCount(size_t intersections)
+	{
+		if(m_decoder.Encoding() != RESULT_ENCODING_PAIRS){
+			return;
+		}
+
+		if(m_holding)
+		{
+			m_holding = false;
+			if(m_consumed < intersections)
+			{
+				m_consumed++;
+				m_consumer(&m_held, 1);
+			}
+		}
+
+		if(m_intersections.size() > intersections){
+			m_intersections.resize(intersections);
+		}
+		if(m_arena_count > intersections){
+			m_arena_count = intersections;
+		}
 	}
 
 	void PrintResults()
@@ -97,6 +265,46 @@ public:
 		}
 	}
 
+	void PrintRingSummary()
+	{
+		printf("Results ring: %i slots, largest backlog %zu slots, %zu slots read%s\n", m_numSlots, m_max_slots_pending, m_total_slots_read,
+				m_ring_became_full ? " (ring became full - host fell behind)" : "");
+	}
+
+private:
+	void Deliver(const intersection_t* intersections, size_t count)
+	{
+		if(m_consumer && m_decoder.Encoding() == RESULT_ENCODING_PAIRS)
+		{
+			/* hand out the intersection held from the last read, and hold back the newest of this one in its place */
+
+			if(m_holding){
+				m_consumer(&m_held, 1);
+			}
+			if(count > 1){
+				m_consumer(intersections, count - 1);
+			}
+			m_consumed += count - (m_holding ? 0 : 1);
+			m_held = intersections[count - 1];
+			m_holding = true;
+		}
+		else if(m_consumer)
+		{
+			m_consumer(intersections, count);
+		}
+		else if(m_arena != NULL)
+		{
+			if(m_arena_count < m_arena_capacity){
+				memcpy(m_arena + m_arena_count, intersections, std::min(count, m_arena_capacity - m_arena_count) * sizeof(intersection_t));
+			}
+			m_arena_count += count;
+		}
+		else
+		{
+			m_intersections.insert(m_intersections.end(), intersections, intersections + count);
+		}
+	}
+
 };
 
 #endif /* RESULTS_HPP_ */
@@ -0,0 +1,76 @@
+/*
+ * SPSCQueue.hpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#ifndef SPSCQUEUE_HPP_
+#define SPSCQUEUE_HPP_
+
+#include <atomic>
+#include <vector>
+
+/* Bounded lock-free queue for exactly one producer thread and one consumer thread. The head and tail indices live on separate cache lines so the
+ * two sides do not contend; each side only ever writes its own index, and reads the other's with acquire ordering. */
+
+template<typename T>
+class SPSCQueue
+{
+private:
+	std::vector<T> m_items;
+	size_t m_mask;
+
+	alignas(64) std::atomic<size_t> m_head;	//next slot to pop, written by the consumer
+	alignas(64) std::atomic<size_t> m_tail;	//next slot to push, written by the producer
+
+public:
+	/* capacity is rounded up to a power of two */
+	SPSCQueue(size_t capacity)
+	{
+		size_t size = 1;
+		while(size < capacity){
+			size <<= 1;
+		}
+
+		m_items.resize(size);
+		m_mask = size - 1;
+		m_head.store(0, std::memory_order_relaxed);
+		m_tail.store(0, std::memory_order_relaxed);
+	}
+
+	bool Push(const T& item)
+	{
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		if(tail - m_head.load(std::memory_order_acquire) > m_mask){
+			return false;
+		}
+
+		m_items[tail & m_mask] = item;
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool Pop(T& item)
+	{
+		size_t head = m_head.load(std::memory_order_relaxed);
+		if(head == m_tail.load(std::memory_order_acquire)){
+			return false;
+		}
+
+		item = m_items[head & m_mask];
+		m_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool Empty() const
+	{
+		return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+	}
+
+private:
+	SPSCQueue(const SPSCQueue&);
+	SPSCQueue& operator=(const SPSCQueue&);
+};
+
+#endif /* SPSCQUEUE_HPP_ */
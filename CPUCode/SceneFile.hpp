@@ -0,0 +1,522 @@
+/*
+ * SceneFile.hpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#ifndef SCENEFILE_HPP_
+#define SCENEFILE_HPP_
+
+#include "Maxfiles.h"
+#include "MaxSLiCInterface.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+#include "Types.h"
+
+/* A binary scene file holds a set of triangles, a batch of rays, or both, in exactly the form they are handed to Triangles and Rays, so a mapped
+ * file can be used with no parsing:
+ *
+ *   page 0      scene_file_header_t, zero padded
+ *   triangles   either consecutive triangle_t's, or the padded DFE word layout (triangles_per_word triangle_t's at the start of each word, rounded
+ *               up to whole bursts) which can be queued to the engine straight from the mapping
+ *   rays        consecutive ray_t's, zero padded rays up to a multiple of the rays per word
+ *
+ * Each section starts on a page boundary. All values are little endian, as on the host and the DFE. */
+
+#define SCENE_FILE_MAGIC		"RTSCENE"
+#define SCENE_FILE_VERSION		1
+#define SCENE_FILE_ALIGNMENT	4096
+
+enum scene_triangles_layout_t
+{
+	SCENE_TRIANGLES_ARRAY = 0,
+	SCENE_TRIANGLES_DFE_WORDS = 1
+};
+
+struct scene_file_header_t
+{
+	char magic[8];
+	u_int32_t version;
+	u_int32_t header_size;
+
+	u_int32_t triangle_size;	/* sizeof(triangle_t) and sizeof(ray_t) when written, which must match the reader's */
+	u_int32_t ray_size;
+
+	u_int64_t num_triangles;
+	u_int64_t triangles_offset;
+	u_int64_t triangles_size;
+
+	u_int32_t triangles_layout;
+	u_int32_t triangles_per_word;	/* the DFE layout only */
+	u_int32_t word_width_in_bytes;
+	u_int32_t burst_size_in_bytes;
+
+	u_int64_t num_rays;
+	u_int64_t num_padded_rays;
+	u_int64_t rays_offset;
+	u_int64_t rays_size;
+};
+
+/* The parameters of the DFE word layout, and the ray padding, for a particular maxfile. These are computed in the same way as in Triangles and Rays */
+struct scene_dfe_layout_t
+{
+	u_int32_t triangles_per_word;
+	u_int32_t word_width_in_bytes;
+	u_int32_t burst_size_in_bytes;
+	u_int32_t rays_per_word;
+
+	static scene_dfe_layout_t FromMaxfile(max_file_t* maxfile)
+	{
+		scene_dfe_layout_t layout;
+		if(max_get_constant_uint64t(maxfile, "TrianglePacking") == TRIANGLE_PACKING_CONTINUOUS)
+		{
+			layout.triangles_per_word = max_get_constant_uint64t(maxfile, "TrianglesPerTick");
+			layout.word_width_in_bytes = layout.triangles_per_word * sizeof(triangle_t);
+		}
+		else
+		{
+			layout.word_width_in_bytes = max_get_constant_uint64t(maxfile, "TrianglesInWidthInBits") / 8;
+			layout.triangles_per_word = layout.word_width_in_bytes / sizeof(triangle_t);
+		}
+		layout.burst_size_in_bytes = max_get_burst_size(maxfile, NULL);
+		layout.rays_per_word = max_get_constant_uint64t(maxfile, "RaysPerWord");
+		return layout;
+	}
+
+	/* the size of the word layout for num_triangles triangles: the words needed to hold them, rounded up to the fewest bytes that are both whole
+	 * words and whole bursts. for words of a burst this is whole bursts; for continuously packed words it may be several bursts */
+	u_int64_t TrianglesSize(u_int64_t num_triangles) const
+	{
+		u_int64_t period = LeastCommonMultiple(word_width_in_bytes, burst_size_in_bytes);
+		u_int64_t words = (num_triangles + triangles_per_word - 1) / triangles_per_word;
+		return (((words * word_width_in_bytes) + period - 1) / period) * period;
+	}
+};
+
+/* Maps a scene file read only. The pointers returned point into the mapping, and are valid until the file is closed. The mapping is private, so
+ * writing through them (e.g. Rays padding in place) never reaches the file. */
+class SceneFile
+{
+public:
+	scene_file_header_t m_header;
+
+private:
+	char* m_map;
+	size_t m_map_size;
+
+public:
+	SceneFile()
+	{
+		m_map = NULL;
+		m_map_size = 0;
+		memset(&m_header, 0, sizeof(m_header));
+	}
+
+	~SceneFile()
+	{
+		Close();
+	}
+
+	bool Open(const char* filename)
+	{
+		Close();
+
+		int fd = open(filename, O_RDONLY);
+		if(fd < 0)
+		{
+			printf("Could not open scene file %s.\n", filename);
+			return false;
+		}
+
+		struct stat info;
+		if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(scene_file_header_t))
+		{
+			printf("Scene file %s is too small to be a scene file.\n", filename);
+			close(fd);
+			return false;
+		}
+
+		m_map_size = info.st_size;
+		void* map = mmap(NULL, m_map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		close(fd);
+
+		if(map == MAP_FAILED)
+		{
+			printf("Could not map scene file %s.\n", filename);
+			m_map_size = 0;
+			return false;
+		}
+
+		m_map = (char*)map;
+		madvise(m_map, m_map_size, MADV_SEQUENTIAL);
+
+		memcpy(&m_header, m_map, sizeof(m_header));
+
+		if(!Validate(filename))
+		{
+			Close();
+			return false;
+		}
+
+		return true;
+	}
+
+	void Close()
+	{
+		if(m_map != NULL){
+			munmap(m_map, m_map_size);
+		}
+		m_map = NULL;
+		m_map_size = 0;
+	}
+
+	size_t NumTriangles() const
+	{
+		return m_header.num_triangles;
+	}
+
+	size_t NumRays() const
+	{
+		return m_header.num_rays;
+	}
+
+	/* the number of rays including the padding, which can be given to Rays::SetRays so it does not need to copy the rays to pad them */
+	size_t NumPaddedRays() const
+	{
+		return m_header.num_padded_rays;
+	}
+
+	bool HasPackedTriangles() const
+	{
+		return m_header.triangles_layout == SCENE_TRIANGLES_DFE_WORDS;
+	}
+
+	/* the triangles as an array, or NULL if they are stored in the DFE word layout */
+	triangle_t* GetTriangles() const
+	{
+		if(HasPackedTriangles()){
+			return NULL;
+		}
+		return (triangle_t*)(m_map + m_header.triangles_offset);
+	}
+
+	/* the triangles in the DFE word layout, or NULL if they are stored as an array */
+	void* GetTriangleWords() const
+	{
+		if(!HasPackedTriangles()){
+			return NULL;
+		}
+		return m_map + m_header.triangles_offset;
+	}
+
+	size_t GetTrianglesSize() const
+	{
+		return m_header.triangles_size;
+	}
+
+	/* a single triangle, whichever layout the triangles are stored in */
+	triangle_t GetTriangle(size_t index) const
+	{
+		if(!HasPackedTriangles()){
+			return GetTriangles()[index];
+		}
+
+		size_t word = index / m_header.triangles_per_word;
+		size_t in_word = index % m_header.triangles_per_word;
+		return ((triangle_t*)(m_map + m_header.triangles_offset + (word * m_header.word_width_in_bytes)))[in_word];
+	}
+
+	ray_t* GetRays() const
+	{
+		return (ray_t*)(m_map + m_header.rays_offset);
+	}
+
+private:
+	bool Validate(const char* filename)
+	{
+		if(memcmp(m_header.magic, SCENE_FILE_MAGIC, sizeof(SCENE_FILE_MAGIC)) != 0)
+		{
+			printf("%s is not a scene file.\n", filename);
+			return false;
+		}
+
+		if(m_header.version != SCENE_FILE_VERSION)
+		{
+			printf("Scene file %s is version %u, expected version %u.\n", filename, m_header.version, SCENE_FILE_VERSION);
+			return false;
+		}
+
+		if(m_header.triangle_size != sizeof(triangle_t) || m_header.ray_size != sizeof(ray_t))
+		{
+			printf("Scene file %s was written with %u byte triangles and %u byte rays, expected %zu and %zu.\n", filename,
+					m_header.triangle_size, m_header.ray_size, sizeof(triangle_t), sizeof(ray_t));
+			return false;
+		}
+
+		u_int64_t triangles_size = m_header.num_triangles * sizeof(triangle_t);
+		if(m_header.triangles_layout == SCENE_TRIANGLES_DFE_WORDS)
+		{
+			scene_dfe_layout_t layout;
+			layout.triangles_per_word = m_header.triangles_per_word;
+			layout.word_width_in_bytes = m_header.word_width_in_bytes;
+			layout.burst_size_in_bytes = m_header.burst_size_in_bytes;
+
+			if(layout.triangles_per_word == 0 || layout.burst_size_in_bytes == 0 ||
+					(layout.triangles_per_word * sizeof(triangle_t)) > layout.word_width_in_bytes)
+			{
+				printf("Scene file %s has an invalid triangle word layout.\n", filename);
+				return false;
+			}
+
+			triangles_size = layout.TrianglesSize(m_header.num_triangles);
+		}
+		else if(m_header.triangles_layout != SCENE_TRIANGLES_ARRAY)
+		{
+			printf("Scene file %s has an unknown triangle layout (%u).\n", filename, m_header.triangles_layout);
+			return false;
+		}
+
+		if(m_header.num_padded_rays < m_header.num_rays)
+		{
+			printf("Scene file %s has fewer padded rays than rays.\n", filename);
+			return false;
+		}
+
+		if(m_header.triangles_size != triangles_size || m_header.rays_size != m_header.num_padded_rays * sizeof(ray_t) ||
+				!InFile(m_header.triangles_offset, m_header.triangles_size) || !InFile(m_header.rays_offset, m_header.rays_size))
+		{
+			printf("Scene file %s is truncated or its sections do not match its header.\n", filename);
+			return false;
+		}
+
+		return true;
+	}
+
+	bool InFile(u_int64_t offset, u_int64_t size) const
+	{
+		return (offset % SCENE_FILE_ALIGNMENT) == 0 && offset <= m_map_size && size <= (m_map_size - offset);
+	}
+};
+
+/* Writes a scene file in a single pass. Triangles are written as they are added, so memory use is one word and the stdio buffer regardless of the
+ * size of the scene; the header is filled in when the file is closed. All the triangles must be added before the rays. */
+class SceneFileWriter
+{
+public:
+	u_int64_t m_num_triangles;
+	u_int64_t m_num_rays;
+
+private:
+	FILE* m_file;
+	scene_file_header_t m_header;
+	bool m_packed;
+	scene_dfe_layout_t m_layout;
+
+	std::vector<char> m_word;
+	u_int32_t m_in_word;
+
+	u_int64_t m_offset;
+	bool m_triangles_closed;
+
+public:
+	SceneFileWriter()
+	{
+		m_file = NULL;
+		m_num_triangles = 0;
+		m_num_rays = 0;
+	}
+
+	~SceneFileWriter()
+	{
+		if(m_file != NULL){
+			Close();
+		}
+	}
+
+	/* layout may be NULL to write the triangles as an array, with no ray padding */
+	bool Open(const char* filename, const scene_dfe_layout_t* layout = NULL)
+	{
+		m_file = fopen(filename, "wb");
+		if(m_file == NULL)
+		{
+			printf("Could not create scene file %s.\n", filename);
+			return false;
+		}
+
+		setvbuf(m_file, NULL, _IOFBF, 1 << 20);
+
+		m_packed = (layout != NULL);
+		if(m_packed)
+		{
+			m_layout = *layout;
+			m_word.assign(m_layout.word_width_in_bytes, 0);
+		}
+		else
+		{
+			memset(&m_layout, 0, sizeof(m_layout));
+			m_layout.rays_per_word = 1;
+		}
+
+		memset(&m_header, 0, sizeof(m_header));
+		memcpy(m_header.magic, SCENE_FILE_MAGIC, sizeof(SCENE_FILE_MAGIC));
+		m_header.version = SCENE_FILE_VERSION;
+		m_header.header_size = sizeof(scene_file_header_t);
+		m_header.triangle_size = sizeof(triangle_t);
+		m_header.ray_size = sizeof(ray_t);
+		m_header.triangles_layout = m_packed ? SCENE_TRIANGLES_DFE_WORDS : SCENE_TRIANGLES_ARRAY;
+		m_header.triangles_per_word = m_layout.triangles_per_word;
+		m_header.word_width_in_bytes = m_layout.word_width_in_bytes;
+		m_header.burst_size_in_bytes = m_layout.burst_size_in_bytes;
+
+		/* the header page is written now and again, filled in, on close */
+
+		m_offset = 0;
+		Zeros(SCENE_FILE_ALIGNMENT);
+		m_header.triangles_offset = m_offset;
+
+		m_num_triangles = 0;
+		m_num_rays = 0;
+		m_in_word = 0;
+		m_triangles_closed = false;
+
+		return true;
+	}
+
+	void AddTriangle(const triangle_t& triangle)
+	{
+		if(m_triangles_closed)
+		{
+			printf("ERROR: triangles added to a scene file after its rays.\n");
+			return;
+		}
+
+		m_num_triangles++;
+
+		if(!m_packed)
+		{
+			Write(&triangle, sizeof(triangle_t));
+			return;
+		}
+
+		memcpy(&m_word[m_in_word * sizeof(triangle_t)], &triangle, sizeof(triangle_t));
+		m_in_word++;
+		if(m_in_word == m_layout.triangles_per_word){
+			FlushWord();
+		}
+	}
+
+	void AddTriangles(const triangle_t* triangles, size_t count)
+	{
+		for(size_t i = 0; i < count; i++){
+			AddTriangle(triangles[i]);
+		}
+	}
+
+	void AddRays(const ray_t* rays, size_t count)
+	{
+		CloseTriangles();
+		Write(rays, count * sizeof(ray_t));
+		m_num_rays += count;
+	}
+
+	/* fills in the header and closes the file. a scene that is not complete (e.g. its import failed part way) is given a header with no magic, so
+	 * it fails validation rather than mapping as a smaller scene; false is returned for it as for a failed write */
+	bool Close(bool complete = true)
+	{
+		CloseTriangles();
+
+		/* pad the rays to whole rays words, with rays that hit nothing */
+
+		u_int64_t padded_rays = ((m_num_rays + m_layout.rays_per_word - 1) / m_layout.rays_per_word) * m_layout.rays_per_word;
+		ray_t padding = ray_t();
+		for(u_int64_t r = m_num_rays; r < padded_rays; r++){
+			Write(&padding, sizeof(ray_t));
+		}
+
+		m_header.num_rays = m_num_rays;
+		m_header.num_padded_rays = padded_rays;
+		m_header.rays_size = padded_rays * sizeof(ray_t);
+
+		/* pad the end of the file so the last section can always be mapped in whole pages */
+
+		Pad(SCENE_FILE_ALIGNMENT);
+
+		if(!complete){
+			memset(m_header.magic, 0, sizeof(m_header.magic));
+		}
+
+		bool ok = (fseek(m_file, 0, SEEK_SET) == 0) && (fwrite(&m_header, sizeof(m_header), 1, m_file) == 1);
+		ok = (ferror(m_file) == 0) && ok;
+		ok = (fclose(m_file) == 0) && ok;
+		m_file = NULL;
+
+		if(!ok){
+			printf("ERROR: could not write the scene file.\n");
+		}
+
+		return ok && complete;
+	}
+
+private:
+	void Write(const void* data, size_t size)
+	{
+		fwrite(data, 1, size, m_file);
+		m_offset += size;
+	}
+
+	void Zeros(u_int64_t count)
+	{
+		static const char zeros[SCENE_FILE_ALIGNMENT] = { 0 };
+		while(count > 0)
+		{
+			u_int64_t size = count < sizeof(zeros) ? count : sizeof(zeros);
+			Write(zeros, size);
+			count -= size;
+		}
+	}
+
+	void Pad(u_int64_t alignment)
+	{
+		Zeros((alignment - (m_offset % alignment)) % alignment);
+	}
+
+	void FlushWord()
+	{
+		Write(&m_word[0], m_word.size());
+		memset(&m_word[0], 0, m_word.size());
+		m_in_word = 0;
+	}
+
+	/* finishes the triangle section: the last partial word, the padding to whole bursts, and the alignment of the rays section */
+	void CloseTriangles()
+	{
+		if(m_triangles_closed){
+			return;
+		}
+		m_triangles_closed = true;
+
+		if(m_packed)
+		{
+			if(m_in_word > 0){
+				FlushWord();
+			}
+			Zeros(m_layout.TrianglesSize(m_num_triangles) - (m_offset - m_header.triangles_offset));
+		}
+
+		m_header.num_triangles = m_num_triangles;
+		m_header.triangles_size = m_offset - m_header.triangles_offset;
+
+		Pad(SCENE_FILE_ALIGNMENT);
+		m_header.rays_offset = m_offset;
+	}
+};
+
+#endif /* SCENEFILE_HPP_ */
@@ -0,0 +1,463 @@
+/*
+ * SceneSession.hpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#ifndef SCENESESSION_HPP_
+#define SCENESESSION_HPP_
+
+#include "Maxfiles.h"
+#include "MaxSLiCInterface.h"
+#include <stdio.h>
+#include <limits.h>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include "Types.h"
+#include "Triangles.hpp"
+#include "IndexedMesh.hpp"
+#include "Rays.hpp"
+#include "AsyncRun.hpp"
+#include "IntersectionActions.hpp"
+#include "Instrumentation.hpp"
+
+/* A scene held in LMem. Scenes larger than one memory command can read are split into tiles of MaxBurstsPerCommand bursts, which are stored back to
+ * back from offset_in_bursts. The packed tiles are kept on the host, so an evicted scene can be uploaded again without being repacked */
+struct resident_scene_t
+{
+	std::vector<Triangles*> tiles;
+	std::vector<int> tile_offsets_in_bursts;	/* relative to offset_in_bursts */
+	std::vector<size_t> tile_bases;				/* the scene index of the first triangle of each tile */
+	size_t num_triangles;
+
+	int size_in_bursts;
+	int offset_in_bursts;						/* -1 when the scene is not resident */
+	u_int64_t last_used;
+};
+
+/* Keeps scenes resident in LMem between ray jobs, so the triangles are uploaded once rather than with every batch of rays. Each scene is given a
+ * contiguous range of bursts, first fit; when there is no room, the least recently used scenes are evicted until there is. A job against an evicted
+ * scene uploads it again first.
+ *
+ * The session owns the LMem from lmem_base_in_bursts, for lmem_size_in_bursts: other code must not write there while the session is in use. Byte
+ * addresses are 64 bit, so the session can use the whole of a large card; offsets are counted in bursts in an int, so the size defaults to, and
+ * is limited to, the bursts from the base an int can count.
+ *
+ * The session's jobs are run and drained with run. An engine has one set of result and status streams, so code that also runs jobs of its own (e.g.
+ * a TiledScheduler) should share its AsyncRun with the session rather than create another. */
+class SceneSession
+{
+public:
+	/* how many scene uploads and evictions there have been, and the bytes the uploads (whole or partial) moved */
+	size_t m_uploads;
+	size_t m_evictions;
+	u_int64_t m_bytes_uploaded;
+
+	/* how the runs send their hits (see ResultEncoding). the hits handed back are the same whichever is used */
+	result_encoding_t m_result_encoding;
+
+private:
+	max_file_t* m_maxfile;
+	max_engine_t* m_engine;
+
+	int m_lmem_size_in_bursts;
+	int m_tile_bursts;
+	int m_triangles_per_tile;
+
+	int m_lmem_base_in_bursts;
+
+	std::map<int, resident_scene_t> m_scenes;
+	int m_next_handle;
+	u_int64_t m_clock;
+
+	AsyncRun& m_run;
+
+public:
+	SceneSession(max_file_t* maxfile, max_engine_t* engine, AsyncRun& run, int lmem_base_in_bursts = 0, int lmem_size_in_bursts = 0) :
+		m_run(run)
+	{
+		m_maxfile = maxfile;
+		m_engine = engine;
+
+		m_uploads = 0;
+		m_evictions = 0;
+		m_bytes_uploaded = 0;
+		m_result_encoding = RESULT_ENCODING_PAIRS;
+		m_next_handle = 0;
+		m_clock = 0;
+
+		m_lmem_base_in_bursts = std::max(lmem_base_in_bursts, 0);
+		m_lmem_size_in_bursts = INT_MAX - m_lmem_base_in_bursts;
+
+		if(lmem_size_in_bursts > m_lmem_size_in_bursts)
+		{
+			printf("ERROR: %i bursts of LMem from burst %i cannot be addressed, only the first %i are used.\n", lmem_size_in_bursts,
+					m_lmem_base_in_bursts, m_lmem_size_in_bursts);
+		}
+		else if(lmem_size_in_bursts > 0)
+		{
+			m_lmem_size_in_bursts = lmem_size_in_bursts;
+		}
+
+		/* size the tiles as TiledScheduler does, using Triangles to work out how many triangles one command's bursts hold */
+
+		m_tile_bursts = max_get_constant_uint64t(maxfile, "MaxBurstsPerCommand");
+
+		Triangles layout(maxfile, 1);
+		m_triangles_per_tile = layout.MaxTrianglesInBursts(m_tile_bursts);
+	}
+
+	~SceneSession()
+	{
+		std::map<int, resident_scene_t>::iterator it;
+		for(it = m_scenes.begin(); it != m_scenes.end(); it++){
+			FreeTiles(it->second);
+		}
+	}
+
+	/* the run the session drains the engine's result and status streams with */
+	AsyncRun& GetRun()
+	{
+		return m_run;
+	}
+
+	/* packs the triangles and uploads them to LMem. returns the handle of the scene, or -1 if it could not be made resident (it is larger than the
+	 * whole of LMem) */
+	int LoadScene(const triangle_t* triangles, size_t num_triangles)
+	{
+		INSTRUMENT_SCOPE("SceneSession::LoadScene");
+
+		return AddScene(num_triangles, [&](Triangles* tile, size_t base, size_t count)
+		{
+			tile->SetTriangles((triangle_t*)(triangles + base), (int)count);
+		});
+	}
+
+	/* as LoadScene, but expands the mesh's triangles into each tile as it is packed, so the whole scene is never held as a triangle array */
+	int LoadScene(const IndexedMesh& mesh)
+	{
+		INSTRUMENT_SCOPE("SceneSession::LoadScene");
+
+		if(!mesh.Validate()){
+			return -1;
+		}
+
+		return AddScene(mesh.NumTriangles(), [&](Triangles* tile, size_t base, size_t count)
+		{
+			tile->SetTriangles(mesh, base, count);
+		});
+	}
+
+	/* overwrites count of the scene's triangles, from first, with new ones. if the scene is resident only the bursts holding them are uploaded, one
+	 * run per changed range of each tile; if not, the whole scene goes up as usual the next time it is used. the scene cannot grow. returns false,
+	 * changing nothing, if the handle is invalid or the range is outside the scene, and false if a tile refuses the update (see
+	 * Triangles::UpdateTriangles), in which case the tiles before it have been updated */
+	bool UpdateScene(int handle, size_t first, const triangle_t* triangles, size_t count)
+	{
+		INSTRUMENT_SCOPE("SceneSession::UpdateScene");
+
+		std::map<int, resident_scene_t>::iterator it = m_scenes.find(handle);
+		if(it == m_scenes.end())
+		{
+			printf("ERROR: there is no scene with handle %i.\n", handle);
+			return false;
+		}
+
+		resident_scene_t& scene = it->second;
+		if(first + count > scene.num_triangles)
+		{
+			printf("ERROR: triangles %zu to %zu are outside a scene of %zu.\n", first, first + count, scene.num_triangles);
+			return false;
+		}
+
+		for(size_t t = 0; t < scene.tiles.size() && count > 0; t++)
+		{
+			size_t tile_end = scene.tile_bases[t] + m_triangles_per_tile;
+			if(first >= tile_end){
+				continue;
+			}
+
+			size_t tile_count = std::min(count, tile_end - first);
+			if(!scene.tiles[t]->UpdateTriangles((int)(first - scene.tile_bases[t]), triangles, (int)tile_count)){
+				return false;
+			}
+
+			if(scene.offset_in_bursts >= 0){
+				m_bytes_uploaded += scene.tiles[t]->UploadDirty(m_engine, scene.offset_in_bursts + scene.tile_offsets_in_bursts[t]);
+			}
+
+			first += tile_count;
+			triangles += tile_count;
+			count -= tile_count;
+		}
+
+		return true;
+	}
+
+	/* releases the scene's LMem and host buffers. the handle is invalid after this */
+	void UnloadScene(int handle)
+	{
+		std::map<int, resident_scene_t>::iterator it = m_scenes.find(handle);
+		if(it == m_scenes.end()){
+			return;
+		}
+
+		FreeTiles(it->second);
+		m_scenes.erase(it);
+	}
+
+	bool IsResident(int handle) const
+	{
+		std::map<int, resident_scene_t>::const_iterator it = m_scenes.find(handle);
+		return (it != m_scenes.end()) && (it->second.offset_in_bursts >= 0);
+	}
+
+	/* the scene's offset in LMem, or -1 if it is not resident */
+	int OffsetInBursts(int handle) const
+	{
+		std::map<int, resident_scene_t>::const_iterator it = m_scenes.find(handle);
+		return (it != m_scenes.end()) ? it->second.offset_in_bursts : -1;
+	}
+
+	int SizeInBursts(int handle) const
+	{
+		std::map<int, resident_scene_t>::const_iterator it = m_scenes.find(handle);
+		return (it != m_scenes.end()) ? it->second.size_in_bursts : 0;
+	}
+
+	/* the number of runs a job against the scene takes */
+	size_t NumTiles(int handle) const
+	{
+		std::map<int, resident_scene_t>::const_iterator it = m_scenes.find(handle);
+		return (it != m_scenes.end()) ? it->second.tiles.size() : 0;
+	}
+
+	/* tests the rays against every triangle of the scene, appending the hits with scene triangle indices. only the rays are sent, unless the scene
+	 * has been evicted since it was last used. the rays must fit in one run against one tile (see CreateIntersectionActions). returns false if the
+	 * handle is invalid or a run could not be built */
+	bool Intersect(int handle, Rays* rays, std::vector<intersection_t>& intersections)
+	{
+		INSTRUMENT_SCOPE("SceneSession::Intersect");
+
+		std::vector<max_actions_t*> actions;
+		return PrepareIntersect(handle, rays, actions) && RunIntersect(handle, rays, actions, intersections);
+	}
+
+	/* The two halves of Intersect, so the next job can be prepared while the engine runs this one. PrepareIntersect makes the scene resident and
+	 * builds the actions of every run of the job; it touches the engine only if the scene has to be uploaded. RunIntersect runs them in order, frees
+	 * them, and appends the hits. The scene must stay resident, and the rays unchanged, in between */
+	bool PrepareIntersect(int handle, Rays* rays, std::vector<max_actions_t*>& actions)
+	{
+		INSTRUMENT_SCOPE("SceneSession::PrepareIntersect");
+
+		if(m_scenes.count(handle) == 0)
+		{
+			printf("ERROR: there is no scene with handle %i.\n", handle);
+			return false;
+		}
+
+		if(!MakeResident(handle)){
+			return false;
+		}
+
+		resident_scene_t& scene = m_scenes.find(handle)->second;
+
+		for(size_t t = 0; t < scene.tiles.size(); t++)
+		{
+			max_actions_t* act = CreateIntersectionActions(m_maxfile, scene.tiles[t], scene.offset_in_bursts + scene.tile_offsets_in_bursts[t], rays,
+					NULL, 0, QUERY_ALL_HITS, m_result_encoding);
+			if(act == NULL)
+			{
+				FreeActions(actions);
+				return false;
+			}
+			actions.push_back(act);
+		}
+
+		return true;
+	}
+
+	bool RunIntersect(int handle, Rays* rays, std::vector<max_actions_t*>& actions, std::vector<intersection_t>& intersections)
+	{
+		INSTRUMENT_SCOPE("SceneSession::RunIntersect");
+
+		std::map<int, resident_scene_t>::const_iterator it = m_scenes.find(handle);
+		if(it == m_scenes.end() || it->second.offset_in_bursts < 0 || actions.size() != it->second.tiles.size())
+		{
+			printf("ERROR: the actions were not prepared for scene %i, or it is no longer resident.\n", handle);
+			FreeActions(actions);
+			return false;
+		}
+
+		const resident_scene_t& scene = it->second;
+
+		for(size_t t = 0; t < scene.tiles.size(); t++)
+		{
+			Triangles* tile = scene.tiles[t];
+			size_t triangle_base = scene.tile_bases[t];
+			size_t triangle_count = std::min((size_t)m_triangles_per_tile, scene.num_triangles - triangle_base);
+
+			m_run.Start(m_engine, actions[t], m_result_encoding, tile->m_total_triangles, rays->m_num_rays);
+
+			/* the padding triangles of the last tile are zero, but are filtered out anyway, as TiledScheduler does */
+
+			m_run.Consume([&](const intersection_t* batch, size_t count)
+			{
+				for(size_t i = 0; i < count; i++)
+				{
+					if(batch[i].triangle < triangle_count)
+					{
+						intersection_t hit = batch[i];
+						hit.triangle += triangle_base;
+						intersections.push_back(hit);
+					}
+				}
+			});
+			m_run.Wait();
+		}
+
+		FreeActions(actions);
+		return true;
+	}
+
+private:
+	/* packs the tiles of a new scene, with pack(tile, base, count) filling each, and uploads it */
+	int AddScene(size_t num_triangles, const std::function<void(Triangles*, size_t, size_t)>& pack)
+	{
+		resident_scene_t scene;
+		scene.num_triangles = num_triangles;
+		scene.size_in_bursts = 0;
+		scene.offset_in_bursts = -1;
+		scene.last_used = 0;
+
+		size_t num_tiles = std::max((size_t)1, (num_triangles + m_triangles_per_tile - 1) / m_triangles_per_tile);
+
+		for(size_t t = 0; t < num_tiles; t++)
+		{
+			size_t base = t * m_triangles_per_tile;
+			size_t count = std::min((size_t)m_triangles_per_tile, num_triangles - base);
+
+			Triangles* tile = new Triangles(m_maxfile, (int)std::max(count, (size_t)1));
+			pack(tile, base, count);
+
+			scene.tiles.push_back(tile);
+			scene.tile_offsets_in_bursts.push_back(scene.size_in_bursts);
+			scene.tile_bases.push_back(base);
+			scene.size_in_bursts += tile->m_total_bursts;
+		}
+
+		int handle = m_next_handle++;
+		m_scenes[handle] = scene;
+
+		if(!MakeResident(handle))
+		{
+			UnloadScene(handle);
+			return -1;
+		}
+
+		return handle;
+	}
+
+	void FreeActions(std::vector<max_actions_t*>& actions)
+	{
+		for(size_t i = 0; i < actions.size(); i++){
+			max_actions_free(actions[i]);
+		}
+		actions.clear();
+	}
+
+	/* uploads the scene if it is not resident, evicting the least recently used scenes until it fits, and marks it used */
+	bool MakeResident(int handle)
+	{
+		resident_scene_t& scene = m_scenes[handle];
+		scene.last_used = ++m_clock;
+
+		if(scene.offset_in_bursts >= 0){
+			return true;
+		}
+
+		if(scene.size_in_bursts > m_lmem_size_in_bursts)
+		{
+			printf("ERROR: a scene of %i bursts does not fit in %i bursts of LMem.\n", scene.size_in_bursts, m_lmem_size_in_bursts);
+			return false;
+		}
+
+		int offset;
+		while((offset = FindSpace(scene.size_in_bursts)) < 0)
+		{
+			if(!EvictLeastRecentlyUsed()){
+				return false;
+			}
+		}
+
+		for(size_t t = 0; t < scene.tiles.size(); t++){
+			scene.tiles[t]->IntialiseTriangles(m_engine, offset + scene.tile_offsets_in_bursts[t]);
+		}
+
+		scene.offset_in_bursts = offset;
+		m_uploads++;
+		m_bytes_uploaded += (u_int64_t)scene.size_in_bursts * max_get_burst_size(m_maxfile, NULL);
+
+		return true;
+	}
+
+	/* the lowest offset with size_in_bursts free bursts after it, or -1 */
+	int FindSpace(int size_in_bursts) const
+	{
+		int end = m_lmem_base_in_bursts + m_lmem_size_in_bursts;
+
+		std::vector<std::pair<int, int> > used;
+		std::map<int, resident_scene_t>::const_iterator it;
+		for(it = m_scenes.begin(); it != m_scenes.end(); it++)
+		{
+			if(it->second.offset_in_bursts >= 0){
+				used.push_back(std::make_pair(it->second.offset_in_bursts, it->second.size_in_bursts));
+			}
+		}
+		std::sort(used.begin(), used.end());
+
+		int begin = m_lmem_base_in_bursts;
+		for(size_t i = 0; i < used.size(); i++)
+		{
+			if(used[i].first - begin >= size_in_bursts){
+				return begin;
+			}
+			begin = used[i].first + used[i].second;
+		}
+
+		return (end - begin >= size_in_bursts) ? begin : -1;
+	}
+
+	bool EvictLeastRecentlyUsed()
+	{
+		resident_scene_t* oldest = NULL;
+		std::map<int, resident_scene_t>::iterator it;
+		for(it = m_scenes.begin(); it != m_scenes.end(); it++)
+		{
+			if(it->second.offset_in_bursts >= 0 && (oldest == NULL || it->second.last_used < oldest->last_used)){
+				oldest = &it->second;
+			}
+		}
+
+		if(oldest == NULL){
+			return false;
+		}
+
+		oldest->offset_in_bursts = -1;
+		m_evictions++;
+		return true;
+	}
+
+	static void FreeTiles(resident_scene_t& scene)
+	{
+		for(size_t t = 0; t < scene.tiles.size(); t++){
+			delete scene.tiles[t];
+		}
+		scene.tiles.clear();
+	}
+};
+
+#endif /* SCENESESSION_HPP_ */
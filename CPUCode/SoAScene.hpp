@@ -0,0 +1,292 @@
+/*
+ * SoAScene.hpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#ifndef SOASCENE_HPP_
+#define SOASCENE_HPP_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "Types.h"
+#include "IndexedMesh.hpp"
+#include "Verification/BatchIntersectionKernel.hpp"
+
+/* Structure-of-arrays storage for scene data. Each component (e.g. v0.x) lives in its own array, so a vector load picks up the same component of
+ * consecutive elements. All lanes share one allocation, each lane starts on a 64 byte boundary and is padded with zeros to a multiple of
+ * TRIANGLE_LANES_ALIGNMENT elements, so the vectorised kernels never need a remainder loop. */
+
+#define SOA_ALIGNMENT_IN_BYTES 64
+
+template<int NUM_LANES>
+class SoALanes
+{
+protected:
+	float* m_data;
+	float* m_lanes[NUM_LANES];
+
+public:
+	size_t m_count;
+	size_t m_padded_count;
+
+	SoALanes()
+	{
+		m_data = NULL;
+		m_count = 0;
+		m_padded_count = 0;
+		for(int i = 0; i < NUM_LANES; i++){
+			m_lanes[i] = NULL;
+		}
+	}
+
+	~SoALanes()
+	{
+		free(m_data);
+	}
+
+	void Resize(size_t count)
+	{
+		size_t padded_count = ((count + TRIANGLE_LANES_ALIGNMENT - 1) / TRIANGLE_LANES_ALIGNMENT) * TRIANGLE_LANES_ALIGNMENT;
+
+		if(padded_count != m_padded_count || m_data == NULL)
+		{
+			free(m_data);
+			m_data = NULL;
+
+			size_t size = (padded_count > 0 ? padded_count : TRIANGLE_LANES_ALIGNMENT) * NUM_LANES * sizeof(float);
+			if(posix_memalign((void**)&m_data, SOA_ALIGNMENT_IN_BYTES, size) == ENOMEM){
+				printf("Could not allocate memory.");
+				return;
+			}
+
+			m_padded_count = padded_count;
+			for(int i = 0; i < NUM_LANES; i++){
+				m_lanes[i] = m_data + (i * padded_count);
+			}
+		}
+
+		memset(m_data, 0, m_padded_count * NUM_LANES * sizeof(float));
+		m_count = count;
+	}
+
+	float* Lane(int lane)
+	{
+		return m_lanes[lane];
+	}
+
+	const float* Lane(int lane) const
+	{
+		return m_lanes[lane];
+	}
+
+private:
+	SoALanes(const SoALanes&);
+	SoALanes& operator=(const SoALanes&);
+};
+
+/* triangle lanes are ordered v0.xyz, v1.xyz, v2.xyz - the same order as the floats in triangle_t. In the edges format the last six hold e1.xyz and
+ * e2.xyz instead, as in triangle_edges_t */
+
+class TriangleSoA : public SoALanes<9>
+{
+public:
+	triangle_format_t m_format;
+
+	TriangleSoA()
+	{
+		m_format = TRIANGLE_FORMAT_VERTICES;
+	}
+
+	void SetTriangles(const triangle_t* triangles, size_t count, triangle_format_t format = TRIANGLE_FORMAT_VERTICES)
+	{
+		Resize(count);
+		m_format = format;
+
+		for(size_t t = 0; t < count; t++)
+		{
+			SetTriangle(t, triangles[t]);
+		}
+	}
+
+	/* fills the lanes from an indexed mesh, without expanding it to a triangle array first */
+	void SetTriangles(const IndexedMesh& mesh, triangle_format_t format = TRIANGLE_FORMAT_VERTICES)
+	{
+		Resize(mesh.NumTriangles());
+		m_format = format;
+
+		for(size_t t = 0; t < mesh.NumTriangles(); t++)
+		{
+			SetTriangle(t, mesh.GetTriangle(t));
+		}
+	}
+
+	/* stores the triangle in the format of the lanes */
+	void SetTriangle(size_t index, const triangle_t& triangle)
+	{
+		triangle_edges_t edges;
+		const float* vertices = &triangle.v0.x;
+		if(m_format == TRIANGLE_FORMAT_EDGES)
+		{
+			edges = TriangleEdges(triangle);
+			vertices = &edges.v0.x;
+		}
+
+		for(int c = 0; c < 9; c++)
+		{
+			m_lanes[c][index] = vertices[c];
+		}
+	}
+
+	/* the floats of the triangle as stored, so in the edges format these are v0, e1 and e2 */
+	triangle_t GetTriangle(size_t index) const
+	{
+		triangle_t triangle;
+		float* vertices = &triangle.v0.x;
+		for(int c = 0; c < 9; c++)
+		{
+			vertices[c] = m_lanes[c][index];
+		}
+		return triangle;
+	}
+
+	triangle_lanes_t GetLanes() const
+	{
+		triangle_lanes_t lanes;
+		lanes.v0x = m_lanes[0]; lanes.v0y = m_lanes[1]; lanes.v0z = m_lanes[2];
+		lanes.v1x = m_lanes[3]; lanes.v1y = m_lanes[4]; lanes.v1z = m_lanes[5];
+		lanes.v2x = m_lanes[6]; lanes.v2y = m_lanes[7]; lanes.v2z = m_lanes[8];
+		lanes.count = m_count;
+		lanes.padded_count = m_padded_count;
+		lanes.base = 0;
+		lanes.format = m_format;
+		return lanes;
+	}
+
+	/* Writes the triangles in the DFE's padded word layout: triangles_per_word triangle_t's at the start of each word_width_in_bytes word, with the
+	 * remainder of each word (and any words beyond the last triangle) zeroed. total_words words are written to dst. Four triangles at a time are
+	 * transposed back from lanes to triangle_t's with vector shuffles, and words are stepped through with integer arithmetic only.
+	 *
+	 * If format is edges and the lanes hold vertices, the edges are worked out on the way. Lanes holding edges can only be written as edges. */
+	bool PackWords(void* dst, int triangles_per_word, int word_width_in_bytes, int total_words,
+			triangle_format_t format = TRIANGLE_FORMAT_VERTICES) const
+	{
+		if(m_format == TRIANGLE_FORMAT_EDGES && format != TRIANGLE_FORMAT_EDGES)
+		{
+			printf("ERROR: triangle lanes holding edges cannot be packed as vertices.\n");
+			return false;
+		}
+
+		bool to_edges = (format == TRIANGLE_FORMAT_EDGES && m_format != TRIANGLE_FORMAT_EDGES);
+
+		char* word = (char*)dst;
+		size_t t = 0;
+
+		for(int w = 0; w < total_words; w++, word += word_width_in_bytes)
+		{
+			float* out = (float*)word;
+			int in_word = 0;
+
+#ifdef __SSE__
+			for(; (in_word + 4) <= triangles_per_word && (t + 4) <= m_count; in_word += 4, t += 4)
+			{
+				/* each 4x4 transpose turns four components of four triangles into four contiguous runs, one per triangle record */
+				float* triangle = out + (in_word * 9);
+				for(int c = 0; c < 8; c += 4)
+				{
+					__m128 r0 = LoadPacked(c + 0, t, to_edges);
+					__m128 r1 = LoadPacked(c + 1, t, to_edges);
+					__m128 r2 = LoadPacked(c + 2, t, to_edges);
+					__m128 r3 = LoadPacked(c + 3, t, to_edges);
+					_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+					_mm_storeu_ps(triangle + c, r0);
+					_mm_storeu_ps(triangle + 9 + c, r1);
+					_mm_storeu_ps(triangle + 18 + c, r2);
+					_mm_storeu_ps(triangle + 27 + c, r3);
+				}
+				for(int i = 0; i < 4; i++)
+				{
+					triangle[(i * 9) + 8] = PackedComponent(8, t + i, to_edges);
+				}
+			}
+#endif
+			for(; in_word < triangles_per_word && t < m_count; in_word++, t++)
+			{
+				float* triangle = out + (in_word * 9);
+				for(int c = 0; c < 9; c++)
+				{
+					triangle[c] = PackedComponent(c, t, to_edges);
+				}
+			}
+
+			int used_bytes = in_word * sizeof(triangle_t);
+			memset(word + used_bytes, 0, word_width_in_bytes - used_bytes);
+		}
+		return true;
+	}
+
+private:
+	/* component c of triangle t as PackWords writes it. the edge components are those of v1 and v2 less the same component of v0 */
+	float PackedComponent(int c, size_t t, bool to_edges) const
+	{
+		if(to_edges && c >= 3){
+			return m_lanes[c][t] - m_lanes[c % 3][t];
+		}
+		return m_lanes[c][t];
+	}
+
+#ifdef __SSE__
+	__m128 LoadPacked(int c, size_t t, bool to_edges) const
+	{
+		if(to_edges && c >= 3){
+			return _mm_sub_ps(_mm_loadu_ps(m_lanes[c] + t), _mm_loadu_ps(m_lanes[c % 3] + t));
+		}
+		return _mm_loadu_ps(m_lanes[c] + t);
+	}
+#endif
+};
+
+/* ray lanes are ordered origin.xyz, direction.xyz, tmin, tmax - the same order as the floats in ray_t */
+
+class RaySoA : public SoALanes<8>
+{
+public:
+	void SetRays(const ray_t* rays, size_t count)
+	{
+		Resize(count);
+
+		for(size_t r = 0; r < count; r++)
+		{
+			const float* components = &rays[r].origin.x;
+			for(int c = 0; c < 8; c++)
+			{
+				m_lanes[c][r] = components[c];
+			}
+		}
+	}
+
+	ray_t GetRay(size_t index) const
+	{
+		ray_t ray;
+		float* components = &ray.origin.x;
+		for(int c = 0; c < 8; c++)
+		{
+			components[c] = m_lanes[c][index];
+		}
+		return ray;
+	}
+
+	/* writes the rays as consecutive ray_t's, as expected by the rays_in stream */
+	void PackRays(ray_t* dst) const
+	{
+		for(size_t r = 0; r < m_count; r++)
+		{
+			dst[r] = GetRay(r);
+		}
+	}
+};
+
+#endif /* SOASCENE_HPP_ */
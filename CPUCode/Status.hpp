@@ -12,12 +12,17 @@
 #include "MaxSLiCInterface.h"
 #include <errno.h>
 #include "Types.h"
+#include "Instrumentation.hpp"
 
+/* sent by ResultsSerialiserKernel once it has sent every result. ticks counts the serialiser's ticks from the start of the run to the report (so
+ * it covers the intersection tests), and flush_ticks the part of those after the intersection kernel signalled it was complete. intersections counts
+ * the 64 bit units sent, which are hits only in the pairs encoding (see ResultEncoding) */
 struct report_t
 {
 	u_int32_t ticks;
 	u_int32_t intersections;
-	u_int64_t reserved;
+	u_int32_t flush_ticks;
+	u_int32_t reserved;
 };
 
 class Status
@@ -56,6 +61,8 @@ public:
 
 	bool ReadStatus()
 	{
+		INSTRUMENT_COUNT("Status::ReadStatus polls", 1);
+
 		int slots_to_get = 1;
 		void* results_data;
 		int num_slots_read = max_llstream_read(m_status_stream, slots_to_get, &results_data);
@@ -67,6 +74,13 @@ public:
 
 		max_llstream_read_discard(m_status_stream, num_slots_read);
 
+		if(num_slots_read > 0)
+		{
+			INSTRUMENT_MARK("Status report");
+			INSTRUMENT_COUNTER("Kernel ticks", status_report.ticks);
+			INSTRUMENT_COUNTER("Kernel flush ticks", status_report.flush_ticks);
+		}
+
 		return (num_slots_read > 0);
 	}
 
@@ -74,6 +88,7 @@ public:
 	{
 		printf("Intersection Tests Complete\n");
 		printf("\tTotal Intersections: %i\n", status_report.intersections);
+		printf("\tKernel Ticks: %u (%u flushing)\n", status_report.ticks, status_report.flush_ticks);
 	}
 
 };
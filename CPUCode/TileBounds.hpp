@@ -0,0 +1,226 @@
+/*
+ * TileBounds.hpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#ifndef TILEBOUNDS_HPP_
+#define TILEBOUNDS_HPP_
+
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+#include "Types.h"
+
+/* Conservative bounds for culling (ray packet, triangle tile) pairs that cannot intersect, before they are dispatched. A triangle tile is bounded by
+ * a box, and a ray packet by a box around its origins, and both a box and a cone around its unit directions. A packet cannot hit a tile if no
+ * half-line starting in the origin box, with a direction inside the direction bounds, reaches the box. Two tests look for such a half-line, and
+ * either can rule one out:
+ *
+ * The cone test works on spheres around the two boxes. Moving a ray's origin by up to the origin sphere's radius moves its path by the same amount,
+ * so the test widens the tile's sphere by that radius and asks whether the cone from the origin sphere's centre reaches it. This suits packets whose
+ * rays share an origin but spread out, such as those of a camera.
+ *
+ * The interval test treats each axis on its own: a point at distance t along some ray of the packet lies in [lower + t * d_lower, upper + t *
+ * d_upper] on that axis, so the t at which the box can be reached form an interval per axis, and the packet misses if the intervals do not overlap.
+ * This suits packets of near parallel rays with spread out origins, such as those of a shadow from a distant light.
+ *
+ * Both widen the tile by a margin, so rounding cannot cull a real hit. Culling pays off when the packets are coherent, e.g. after RaySorter. */
+
+#define TILE_BOUNDS_MARGIN 1e-4f
+
+struct tile_box_t
+{
+	vector3 lower;
+	vector3 upper;
+	bool empty;
+};
+
+struct ray_packet_bounds_t
+{
+	vector3 origin_lower;
+	vector3 origin_upper;
+
+	vector3 direction_lower;	/* the bounds of the unit directions */
+	vector3 direction_upper;
+
+	vector3 axis;			/* unit length */
+	float cos_half_angle;	/* the cone holds every direction within acos(cos_half_angle) of axis. -1 when it holds every direction */
+	bool empty;
+};
+
+inline void ExtendBox(vector3& lower, vector3& upper, const vector3& p)
+{
+	lower.x = std::min(lower.x, p.x); upper.x = std::max(upper.x, p.x);
+	lower.y = std::min(lower.y, p.y); upper.y = std::max(upper.y, p.y);
+	lower.z = std::min(lower.z, p.z); upper.z = std::max(upper.z, p.z);
+}
+
+inline double Square(double x)
+{
+	return x * x;
+}
+
+inline tile_box_t TriangleTileBounds(const triangle_t* triangles, size_t count)
+{
+	tile_box_t box;
+	box.lower = vector3(FLT_MAX, FLT_MAX, FLT_MAX);
+	box.upper = vector3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	box.empty = (count == 0);
+
+	for(size_t i = 0; i < count; i++)
+	{
+		ExtendBox(box.lower, box.upper, triangles[i].v0);
+		ExtendBox(box.lower, box.upper, triangles[i].v1);
+		ExtendBox(box.lower, box.upper, triangles[i].v2);
+	}
+	return box;
+}
+
+/* rays with a zero direction (such as padding rays) hit nothing, so are left out */
+inline ray_packet_bounds_t RayPacketBounds(const ray_t* rays, size_t count)
+{
+	ray_packet_bounds_t bounds;
+	bounds.origin_lower = vector3(FLT_MAX, FLT_MAX, FLT_MAX);
+	bounds.origin_upper = vector3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	bounds.direction_lower = vector3(FLT_MAX, FLT_MAX, FLT_MAX);
+	bounds.direction_upper = vector3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	bounds.axis = vector3(0, 0, 1);
+	bounds.cos_half_angle = -1;
+	bounds.empty = true;
+
+	/* the axis is the mean of the unit directions, and the half angle the widest any direction is from it */
+
+	double sum[3] = { 0, 0, 0 };
+	for(size_t i = 0; i < count; i++)
+	{
+		const vector3& d = rays[i].direction;
+		double length = sqrt((double)d.x * d.x + (double)d.y * d.y + (double)d.z * d.z);
+		if(length == 0){
+			continue;
+		}
+
+		ExtendBox(bounds.origin_lower, bounds.origin_upper, rays[i].origin);
+		ExtendBox(bounds.direction_lower, bounds.direction_upper, vector3((float)(d.x / length), (float)(d.y / length), (float)(d.z / length)));
+		sum[0] += d.x / length;
+		sum[1] += d.y / length;
+		sum[2] += d.z / length;
+		bounds.empty = false;
+	}
+
+	double sum_length = sqrt(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+	if(bounds.empty || sum_length < 1e-6){
+		return bounds;
+	}
+
+	bounds.axis = vector3((float)(sum[0] / sum_length), (float)(sum[1] / sum_length), (float)(sum[2] / sum_length));
+
+	double cos_half_angle = 1;
+	for(size_t i = 0; i < count; i++)
+	{
+		const vector3& d = rays[i].direction;
+		double length = sqrt((double)d.x * d.x + (double)d.y * d.y + (double)d.z * d.z);
+		if(length == 0){
+			continue;
+		}
+		double c = (d.x * bounds.axis.x + d.y * bounds.axis.y + d.z * bounds.axis.z) / length;
+		cos_half_angle = std::min(cos_half_angle, c);
+	}
+
+	bounds.cos_half_angle = (float)std::max(-1.0, cos_half_angle);
+	return bounds;
+}
+
+/* narrows [t_lower, t_upper] to the t at which a ray of the packet can be within [box_lower, box_upper] on one axis. the lowest point the packet can
+ * reach at t, origin_lower + t * direction_lower, must be below the top of the box, and the highest point above the bottom. the box and directions
+ * are widened by the margin */
+inline void ClipInterval(float origin_lower, float origin_upper, float direction_lower, float direction_upper, float box_lower, float box_upper,
+		double& t_lower, double& t_upper)
+{
+	double margin = TILE_BOUNDS_MARGIN * (1 + fabs((double)box_lower) + fabs((double)box_upper));
+
+	double low = (double)origin_lower - ((double)box_upper + margin);
+	double low_slope = (double)direction_lower - TILE_BOUNDS_MARGIN;
+
+	if(low_slope > 0){
+		t_upper = std::min(t_upper, -low / low_slope);
+	}else if(low_slope < 0){
+		t_lower = std::max(t_lower, -low / low_slope);
+	}else if(low > 0){
+		t_upper = -1;
+	}
+
+	double high = (double)origin_upper - ((double)box_lower - margin);
+	double high_slope = (double)direction_upper + TILE_BOUNDS_MARGIN;
+
+	if(high_slope < 0){
+		t_upper = std::min(t_upper, -high / high_slope);
+	}else if(high_slope > 0){
+		t_lower = std::max(t_lower, -high / high_slope);
+	}else if(high < 0){
+		t_upper = -1;
+	}
+}
+
+inline bool MayIntersectIntervals(const ray_packet_bounds_t& packet, const tile_box_t& box)
+{
+	double t_lower = 0;
+	double t_upper = DBL_MAX;
+
+	const vector3& ol = packet.origin_lower;
+	const vector3& ou = packet.origin_upper;
+	const vector3& dl = packet.direction_lower;
+	const vector3& du = packet.direction_upper;
+
+	ClipInterval(ol.x, ou.x, dl.x, du.x, box.lower.x, box.upper.x, t_lower, t_upper);
+	ClipInterval(ol.y, ou.y, dl.y, du.y, box.lower.y, box.upper.y, t_lower, t_upper);
+	ClipInterval(ol.z, ou.z, dl.z, du.z, box.lower.z, box.upper.z, t_lower, t_upper);
+
+	return t_lower <= t_upper;
+}
+
+inline bool MayIntersectCone(const ray_packet_bounds_t& packet, const tile_box_t& box)
+{
+	if(packet.cos_half_angle <= -1){
+		return true;
+	}
+
+	const vector3& ol = packet.origin_lower;
+	const vector3& ou = packet.origin_upper;
+	double origin_centre[3] = { 0.5 * ((double)ol.x + ou.x), 0.5 * ((double)ol.y + ou.y), 0.5 * ((double)ol.z + ou.z) };
+	double origin_radius = 0.5 * sqrt(Square((double)ou.x - ol.x) + Square((double)ou.y - ol.y) + Square((double)ou.z - ol.z));
+
+	const vector3& bl = box.lower;
+	const vector3& bu = box.upper;
+	double box_centre[3] = { 0.5 * ((double)bl.x + bu.x), 0.5 * ((double)bl.y + bu.y), 0.5 * ((double)bl.z + bu.z) };
+	double box_radius = 0.5 * sqrt(Square((double)bu.x - bl.x) + Square((double)bu.y - bl.y) + Square((double)bu.z - bl.z));
+
+	double radius = (box_radius + origin_radius) * (1 + TILE_BOUNDS_MARGIN) + TILE_BOUNDS_MARGIN;
+
+	double v[3] = { box_centre[0] - origin_centre[0], box_centre[1] - origin_centre[1], box_centre[2] - origin_centre[2] };
+	double distance = sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+	if(distance <= radius){
+		return true;
+	}
+
+	/* the angle from the axis to the sphere's centre, against the cone's half angle plus the angle the sphere subtends */
+
+	double cos_to_centre = (v[0] * packet.axis.x + v[1] * packet.axis.y + v[2] * packet.axis.z) / distance;
+	double to_centre = acos(std::max(-1.0, std::min(1.0, cos_to_centre)));
+	double half_angle = acos(std::max(-1.0, std::min(1.0, (double)packet.cos_half_angle)));
+	double subtended = asin(radius / distance);
+
+	return to_centre <= half_angle + subtended + TILE_BOUNDS_MARGIN;
+}
+
+/* false only if no ray of the packet can hit anything in the box */
+inline bool MayIntersect(const ray_packet_bounds_t& packet, const tile_box_t& box)
+{
+	if(packet.empty || box.empty){
+		return false;
+	}
+	return MayIntersectCone(packet, box) && MayIntersectIntervals(packet, box);
+}
+
+#endif /* TILEBOUNDS_HPP_ */
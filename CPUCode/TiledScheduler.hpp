@@ -0,0 +1,305 @@
+/*
+ * TiledScheduler.hpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#ifndef TILEDSCHEDULER_HPP_
+#define TILEDSCHEDULER_HPP_
+
+#include "Maxfiles.h"
+#include "MaxSLiCInterface.h"
+#include <limits.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include "Types.h"
+#include "Triangles.hpp"
+#include "Rays.hpp"
+#include "AsyncRun.hpp"
+#include "IntersectionActions.hpp"
+#include "TileBounds.hpp"
+
+/* Runs scenes of any size by splitting them into tiles the engine can handle: triangle tiles of at most MaxBurstsPerCommand bursts (the width of
+ * the memory command size field), and ray tiles small enough that the kernel tick count of one run fits in an int. Every ray tile is run against
+ * every triangle tile, back to back, and the tile-local ray and triangle indices are remapped to global ones as results arrive.
+ *
+ * LMem holds two triangle tiles, at offsets 0 and tile_bursts. While the ray tiles run against one, the next triangle tile is streamed into the
+ * other as part of the first run (so the upload overlaps the compute), and the host packs the tile after that into the spare host buffer.
+ *
+ * Runs whose ray tile cannot reach the triangle tile are skipped (see TileBounds). The bounds are of whole tiles, so culling needs coherent ones:
+ * triangles in spatial order, and small ray tiles (max_rays_per_tile) of rays sorted with RaySorter. When every run against a tile is skipped, the
+ * next tile is uploaded on its own instead. */
+class TiledScheduler
+{
+public:
+	int m_tile_bursts;
+	size_t m_rays_per_tile;
+
+	size_t m_runs;
+
+	/* how the runs send their hits (see ResultEncoding). the hits handed back are the same whichever is used */
+	result_encoding_t m_result_encoding;
+
+	/* if set, runs that cannot produce hits are skipped. m_culled_runs counts those skipped by the last Run */
+	bool m_cull_tiles;
+	size_t m_culled_runs;
+
+	/* where the time of the last Run went, in seconds. only the uploads of the first tile, and of tiles no run could carry, are counted; the others
+	 * overlap runs. compute is the wall time of the runs, which the packing of later tiles and the draining of results overlap; drain is the time
+	 * spent handling the results */
+	double m_pack_seconds;
+	double m_upload_seconds;
+	double m_queue_seconds;
+	double m_compute_seconds;
+	double m_drain_seconds;
+
+	/* the bytes moved between the host and the engine by the last Run: triangles and rays in, result and status slots out */
+	u_int64_t m_bytes_to_engine;
+	u_int64_t m_bytes_from_engine;
+
+private:
+	max_file_t* m_maxfile;
+	max_engine_t* m_engine;
+
+	Triangles* m_tiles[2];
+	AsyncRun m_run;
+
+	/* kept between runs so the copy that pads a partial ray tile reuses the same buffer */
+	Rays m_tile_rays;
+
+public:
+	/* max_rays_per_tile of 0 uses the largest ray tile a single run allows */
+	TiledScheduler(max_file_t* maxfile, max_engine_t* engine, size_t max_rays_per_tile = 0) :
+		m_run(maxfile, engine),
+		m_tile_rays(maxfile)
+	{
+		m_maxfile = maxfile;
+		m_engine = engine;
+		m_runs = 0;
+		m_cull_tiles = true;
+		m_result_encoding = RESULT_ENCODING_PAIRS;
+		ResetCounters();
+
+		m_tile_bursts = max_get_constant_uint64t(maxfile, "MaxBurstsPerCommand");
+
+		/* size the triangle tiles to the most triangles one memory command can read, using Triangles to work out how many its bursts hold. with
+		 * continuous packing the tile may be a few bursts short of the command's limit, so that it is whole periods */
+
+		Triangles layout(maxfile, 1);
+		int triangles_per_tile = layout.MaxTrianglesInBursts(m_tile_bursts);
+
+		m_tiles[0] = new Triangles(maxfile, triangles_per_tile);
+		m_tiles[1] = new Triangles(maxfile, triangles_per_tile);
+
+		/* the largest ray tile whose tick count (for a full triangle tile) fits in one run, in whole ray words */
+
+		u_int64_t rays_per_word = max_get_constant_uint64t(maxfile, "RaysPerWord");
+		u_int64_t ticks_per_ray_word = IntersectionTicks(maxfile, m_tiles[0]->m_total_triangles, rays_per_word);
+		u_int64_t max_rays = (INT_MAX / std::max(ticks_per_ray_word, (u_int64_t)1)) * rays_per_word;
+
+		m_rays_per_tile = max_rays;
+		if(max_rays_per_tile > 0 && max_rays_per_tile < max_rays){
+			m_rays_per_tile = std::max((u_int64_t)rays_per_word, (max_rays_per_tile / rays_per_word) * rays_per_word);
+		}
+	}
+
+	~TiledScheduler()
+	{
+		delete m_tiles[0];
+		delete m_tiles[1];
+	}
+
+	int TrianglesPerTile() const
+	{
+		return m_tiles[0]->m_total_triangles;
+	}
+
+	/* the LMem the scheduler uses, from offset 0: two triangle tiles */
+	int LMemSizeInBursts() const
+	{
+		return 2 * m_tile_bursts;
+	}
+
+	/* the run the scheduler drains the engine's result and status streams with, for other users of the engine to share */
+	AsyncRun& GetRun()
+	{
+		return m_run;
+	}
+
+	/* tests every ray against every triangle, appending the hits with global indices to intersections */
+	void Run(const triangle_t* triangles, size_t num_triangles, ray_t* rays, size_t num_rays, std::vector<intersection_t>& intersections)
+	{
+		size_t triangles_per_tile = TrianglesPerTile();
+		size_t triangle_tiles = (num_triangles + triangles_per_tile - 1) / triangles_per_tile;
+		size_t ray_tiles = (num_rays + m_rays_per_tile - 1) / m_rays_per_tile;
+
+		ResetCounters();
+
+		if(triangle_tiles == 0 || ray_tiles == 0){
+			return;
+		}
+
+		/* the first tile has nothing to overlap with, so is uploaded on its own */
+
+		Pack(0, triangles, num_triangles);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		m_tiles[0]->IntialiseTriangles(m_engine, Offset(0));
+		m_upload_seconds += Since(start);
+		m_bytes_to_engine += TileSize();
+
+		if(triangle_tiles > 1){
+			Pack(1, triangles, num_triangles);
+		}
+
+		std::vector<ray_packet_bounds_t> ray_bounds;
+		if(m_cull_tiles)
+		{
+			for(size_t rt = 0; rt < ray_tiles; rt++)
+			{
+				size_t ray_base = rt * m_rays_per_tile;
+				ray_bounds.push_back(RayPacketBounds(rays + ray_base, std::min(m_rays_per_tile, num_rays - ray_base)));
+			}
+		}
+
+		for(size_t tt = 0; tt < triangle_tiles; tt++)
+		{
+			Triangles* tile = m_tiles[tt % 2];
+			size_t triangle_base = tt * triangles_per_tile;
+			size_t triangle_count = std::min(triangles_per_tile, num_triangles - triangle_base);
+
+			tile_box_t triangle_bounds = m_cull_tiles ? TriangleTileBounds(triangles + triangle_base, triangle_count) : tile_box_t();
+
+			bool next_uploaded = !(tt + 1 < triangle_tiles);
+
+			for(size_t rt = 0; rt < ray_tiles; rt++)
+			{
+				if(m_cull_tiles && !MayIntersect(ray_bounds[rt], triangle_bounds))
+				{
+					m_culled_runs++;
+					continue;
+				}
+
+				size_t ray_base = rt * m_rays_per_tile;
+				size_t ray_count = std::min(m_rays_per_tile, num_rays - ray_base);
+
+				start = std::chrono::steady_clock::now();
+
+				m_tile_rays.SetRays(rays + ray_base, ray_count);
+
+				/* the first run against this tile also streams the next one into the other half of LMem */
+
+				bool upload_next = !next_uploaded;
+				next_uploaded = true;
+
+				max_actions_t* act = CreateIntersectionActions(m_maxfile, tile, Offset(tt), &m_tile_rays,
+						upload_next ? m_tiles[(tt + 1) % 2] : NULL, upload_next ? Offset(tt + 1) : 0, QUERY_ALL_HITS, m_result_encoding);
+				if(act == NULL){
+					return;
+				}
+
+				m_queue_seconds += Since(start);
+				m_bytes_to_engine += m_tile_rays.m_num_rays * sizeof(ray_t) + (upload_next ? TileSize() : 0);
+
+				start = std::chrono::steady_clock::now();
+
+				size_t slots_before = m_run.GetResults().m_total_slots_read;
+
+				m_run.Start(m_engine, act, m_result_encoding, tile->m_total_triangles, m_tile_rays.m_num_rays);
+				m_runs++;
+
+				/* this tile's host buffer was uploaded before the current run, so it can be reused for the tile after next while the run computes */
+
+				if(upload_next && (tt + 2) < triangle_tiles){
+					Pack(tt + 2, triangles, num_triangles);
+				}
+
+				m_run.Consume([&](const intersection_t* batch, size_t count)
+				{
+					std::chrono::steady_clock::time_point drain_start = std::chrono::steady_clock::now();
+
+					for(size_t i = 0; i < count; i++)
+					{
+						if(batch[i].ray < ray_count && batch[i].triangle < triangle_count)
+						{
+							intersection_t global;
+							global.ray = batch[i].ray + ray_base;
+							global.triangle = batch[i].triangle + triangle_base;
+							intersections.push_back(global);
+						}
+					}
+
+					m_drain_seconds += Since(drain_start);
+				});
+				m_run.Wait();
+
+				m_compute_seconds += Since(start);
+
+				/* the result slots, and one status slot */
+
+				m_bytes_from_engine += (m_run.GetResults().m_total_slots_read - slots_before) * 16 + 16;
+
+				max_actions_free(act);
+			}
+
+			/* every run against this tile was culled, so nothing carried the next one */
+
+			if(!next_uploaded)
+			{
+				start = std::chrono::steady_clock::now();
+				m_tiles[(tt + 1) % 2]->IntialiseTriangles(m_engine, Offset(tt + 1));
+				m_upload_seconds += Since(start);
+				m_bytes_to_engine += TileSize();
+
+				if((tt + 2) < triangle_tiles){
+					Pack(tt + 2, triangles, num_triangles);
+				}
+			}
+		}
+	}
+
+private:
+	int Offset(size_t tile) const
+	{
+		return (tile % 2) * m_tile_bursts;
+	}
+
+	void ResetCounters()
+	{
+		m_culled_runs = 0;
+		m_pack_seconds = 0;
+		m_upload_seconds = 0;
+		m_queue_seconds = 0;
+		m_compute_seconds = 0;
+		m_drain_seconds = 0;
+		m_bytes_to_engine = 0;
+		m_bytes_from_engine = 0;
+	}
+
+	static double Since(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	u_int64_t TileSize() const
+	{
+		return (u_int64_t)m_tiles[0]->m_total_bursts * (u_int64_t)m_tiles[0]->m_burst_size_in_bytes;
+	}
+
+	void Pack(size_t tile, const triangle_t* triangles, size_t num_triangles)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		size_t triangles_per_tile = TrianglesPerTile();
+		size_t base = tile * triangles_per_tile;
+		size_t count = std::min(triangles_per_tile, num_triangles - base);
+
+		m_tiles[tile % 2]->SetTriangles((triangle_t*)(triangles + base), count);
+
+		m_pack_seconds += Since(start);
+	}
+};
+
+#endif /* TILEDSCHEDULER_HPP_ */
@@ -0,0 +1,849 @@
+/*
+ * Benchmark.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <time.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "Maxfiles.h"
+#include "MaxSLiCInterface.h"
+#include "Types.h"
+#include "SoAScene.hpp"
+#include "TiledScheduler.hpp"
+#include "SceneSession.hpp"
+#include "MultiEngineScheduler.hpp"
+#include "RaySorter.hpp"
+#include "Verification/CPUIntersectionEngine.hpp"
+
+/* Sweeps a matrix of scenes (triangle count, ray count, hit density and ray coherence) over every backend - the CPU engines and the engine of the
+ * run rule this is built for - and writes the throughput and per stage latencies of each as JSON, so builds can be compared.
+ *
+ * Hit density is the number of triangles a primary ray hits on average. The triangles are scattered through a 2x2x2 box and sized so that their
+ * total area is density times the area the box presents to the camera. Primary rays are a raster of rays from a pinhole camera in scanline
+ * order, random rays go between random points around and inside the box, and shadow rays go from random points in the box towards a light.
+ *
+ * The engine backend streams the whole scene through the TiledScheduler on every repeat; engine_resident loads it into LMem once per configuration
+ * with a SceneSession, so its samples are the latency of a ray batch against a resident scene. engine_multi does the same across --engines engines
+ * with a MultiEngineScheduler, and is not run by default, as it needs that many cards.
+ *
+ * With --sort-rays, the rays of each configuration are put in coherent order by RaySorter before any backend sees them; the time the sort took is
+ * reported alongside each result, as sort_ms.
+ *
+ * cpu_threaded and engine skip the (ray tile, triangle tile) pairs that cannot intersect (see TileBounds), unless --no-cull is given; each result
+ * reports how many were skipped, as culled. The engine's ray tiles are as large as a run allows unless --ray-tile is given, and culling needs small,
+ * coherent ones, so it pays off with e.g. --sort-rays --ray-tile 1024. The generated triangles are in no spatial order, so every triangle tile spans
+ * most of the box and little is culled here; meshes, whose triangles are usually stored near their neighbours, cull more.
+ *
+ * The _edges variants of cpu_scalar, cpu_simd and cpu_threaded hold the triangles with their edges worked out once, at pack time, rather than in
+ * every test (see triangle_format_t), so compare with the plain backends to see what that saves. The engine's triangle format is fixed when its
+ * maxfile is built, and is reported as engine_triangle_format.
+ *
+ * --encoding sets how engine and engine_resident send their hits (see ResultEncoding); masks and deltas move fewer bytes than pairs when the hits are
+ * dense, which shows in bytes_moved.
+ *
+ * The first backend gives the reference hits for each configuration. The engine can differ from the CPU engines on rays that graze a triangle's
+ * plane, since the CPU test rejects near zero determinants, so a few mismatches on random rays are expected. */
+
+#ifndef RAYTRACER_RUNRULE
+#define RAYTRACER_RUNRULE "unknown"
+#endif
+
+enum ray_coherence_t
+{
+	COHERENCE_PRIMARY,
+	COHERENCE_RANDOM,
+	COHERENCE_SHADOW
+};
+
+static const char* CoherenceName(ray_coherence_t coherence)
+{
+	switch(coherence)
+	{
+	case COHERENCE_PRIMARY:	return "primary";
+	case COHERENCE_RANDOM:	return "random";
+	case COHERENCE_SHADOW:	return "shadow";
+	}
+	return "unknown";
+}
+
+struct benchmark_config_t
+{
+	size_t triangles;
+	size_t rays;
+	float density;
+	ray_coherence_t coherence;
+};
+
+/* the time each stage took in one repeat, in seconds. stages that do not apply to a backend are negative */
+
+enum benchmark_stage_t
+{
+	STAGE_PACK,
+	STAGE_UPLOAD,
+	STAGE_QUEUE,
+	STAGE_COMPUTE,
+	STAGE_DRAIN,
+	STAGE_TOTAL,
+	NUM_STAGES
+};
+
+static const char* stage_names[NUM_STAGES] = { "pack", "upload", "queue", "compute", "drain", "total" };
+
+struct benchmark_sample_t
+{
+	double seconds[NUM_STAGES];
+	size_t hits;
+	u_int64_t checksum;
+	u_int64_t bytes_moved;
+	size_t culled;
+
+	benchmark_sample_t()
+	{
+		for(int s = 0; s < NUM_STAGES; s++){
+			seconds[s] = -1;
+		}
+		hits = 0;
+		checksum = 0;
+		bytes_moved = 0;
+		culled = 0;
+	}
+};
+
+struct benchmark_result_t
+{
+	benchmark_config_t config;
+	std::string backend;
+	std::vector<benchmark_sample_t> samples;
+	bool matches_reference;
+	double sort_seconds;	/* negative if the rays were not sorted */
+};
+
+struct benchmark_options_t
+{
+	std::vector<size_t> triangles;
+	std::vector<size_t> rays;
+	std::vector<float> densities;
+	std::vector<ray_coherence_t> coherences;
+	std::vector<std::string> backends;
+	int repeats;
+	unsigned int seed;
+	double max_scalar_tests;
+	int engines;
+	bool sort_rays;
+	bool cull_tiles;
+	size_t ray_tile;
+	result_encoding_t encoding;
+	const char* output;
+
+	/* the TriangleFormat of the maxfile, or -1 if no engine backend is run */
+	int engine_triangle_format;
+};
+
+/* the objects that drive the engines, any of which are NULL if the backends that use them are not run */
+struct engine_backends_t
+{
+	TiledScheduler* scheduler;
+	SceneSession* session;
+	Rays* resident_rays;
+	MultiEngineScheduler* multi;
+};
+
+/* an order independent hash of a set of hits, so backends that return the same hits in a different order still match */
+static u_int64_t Checksum(const std::vector<intersection_t>& intersections)
+{
+	u_int64_t sum = 0;
+	for(size_t i = 0; i < intersections.size(); i++)
+	{
+		u_int64_t h = (((u_int64_t)intersections[i].ray) << 32) | intersections[i].triangle;
+		h *= 0x9E3779B97F4A7C15ULL;
+		sum += h ^ (h >> 29);
+	}
+	return sum;
+}
+
+static double Since(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void GenerateScene(const benchmark_config_t& config, unsigned int seed, std::vector<triangle_t>& triangles, std::vector<ray_t>& rays)
+{
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+	/* the box is x, y in [-1, 1] and z in [4, 6]. the camera at the origin sees it as a 2x2 square at z = 5 */
+
+	float area = (config.density * 4.0f) / std::max((size_t)1, config.triangles);
+	float edge = sqrtf((4.0f * area) / sqrtf(3.0f));
+
+	triangles.resize(config.triangles);
+	for(size_t i = 0; i < triangles.size(); i++)
+	{
+		vector3 centre(unit(rng), unit(rng), 5.0f + unit(rng));
+		float angle = unit(rng) * (float)M_PI;
+
+		vector3* vertices[3] = { &triangles[i].v0, &triangles[i].v1, &triangles[i].v2 };
+		for(int v = 0; v < 3; v++)
+		{
+			float a = angle + (v * 2.0f * (float)M_PI / 3.0f);
+			float radius = edge / sqrtf(3.0f);
+			*vertices[v] = vector3(centre.x + radius * cosf(a), centre.y + radius * sinf(a), centre.z + 0.1f * edge * unit(rng));
+		}
+	}
+
+	rays.resize(config.rays);
+
+	size_t width = (size_t)ceil(sqrt((double)config.rays));
+	vector3 light(0.5f, 0.5f, 0.0f);
+
+	for(size_t r = 0; r < rays.size(); r++)
+	{
+		ray_t& ray = rays[r];
+		ray.tmin = 0;
+		ray.tmax = FLT_MAX;
+
+		switch(config.coherence)
+		{
+		case COHERENCE_PRIMARY:
+		{
+			float x = (((r % width) + 0.5f) / width) * 2.0f - 1.0f;
+			float y = (((r / width) + 0.5f) / width) * 2.0f - 1.0f;
+			ray.origin = vector3(0, 0, 0);
+			ray.direction = vector3(x, y, 5.0f);
+			break;
+		}
+		case COHERENCE_RANDOM:
+		{
+			vector3 from(unit(rng) * 2.0f, unit(rng) * 2.0f, 5.0f + unit(rng) * 5.0f);
+			vector3 to(unit(rng), unit(rng), 5.0f + unit(rng));
+			ray.origin = from;
+			ray.direction = vector3(to.x - from.x, to.y - from.y, to.z - from.z);
+			break;
+		}
+		case COHERENCE_SHADOW:
+		{
+			/* the light is at t = 1, and tmin skips the surface the ray leaves */
+			ray.origin = vector3(unit(rng), unit(rng), 5.0f + unit(rng));
+			ray.direction = vector3(light.x - ray.origin.x, light.y - ray.origin.y, light.z - ray.origin.z);
+			ray.tmin = 1e-4f;
+			ray.tmax = 1.0f;
+			break;
+		}
+		}
+	}
+}
+
+static bool IsEdgesBackend(const std::string& backend)
+{
+	return backend == "cpu_scalar_edges" || backend == "cpu_simd_edges" || backend == "cpu_threaded_edges";
+}
+
+static bool IsCPUBackend(const std::string& backend)
+{
+	return backend == "cpu_scalar" || backend == "cpu_simd" || backend == "cpu_threaded" || backend == "cpu_bvh" || IsEdgesBackend(backend);
+}
+
+/* runs one repeat of a config on a CPU backend */
+static benchmark_sample_t RunCPU(const std::string& backend, std::vector<triangle_t>& triangles, std::vector<ray_t>& rays, WorkStealingPool& pool,
+		bool cull_tiles)
+{
+	benchmark_sample_t sample;
+	std::chrono::steady_clock::time_point total_start = std::chrono::steady_clock::now();
+
+	CPUIntersectionEngine engine;
+	engine.m_triangles = &triangles[0];
+	engine.m_num_triangles = triangles.size();
+	engine.m_rays = &rays[0];
+	engine.m_num_rays = rays.size();
+
+	/* the _edges variants are the same backends with the triangles held as edges */
+
+	std::string base = backend;
+	if(IsEdgesBackend(backend))
+	{
+		base = backend.substr(0, backend.size() - strlen("_edges"));
+		engine.m_triangle_format = TRIANGLE_FORMAT_EDGES;
+	}
+
+	TriangleSoA lanes;
+
+	if(base == "cpu_scalar")
+	{
+		engine.m_isa = ISA_SCALAR;
+	}
+	else if(backend == "cpu_bvh")
+	{
+		engine.m_mode = MODE_BVH;
+		engine.m_pool = &pool;
+	}
+	else
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		lanes.SetTriangles(&triangles[0], triangles.size(), engine.m_triangle_format);
+		engine.m_triangle_lanes = &lanes;
+		sample.seconds[STAGE_PACK] = Since(start);
+
+		if(base == "cpu_threaded")
+		{
+			engine.m_pool = &pool;
+			engine.m_cull_tiles = cull_tiles;
+		}
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	engine.DoIntersectionTests();
+	sample.seconds[STAGE_COMPUTE] = Since(start);
+
+	/* the hierarchy is built inside DoIntersectionTests, so is moved out of compute into pack */
+
+	if(backend == "cpu_bvh")
+	{
+		sample.seconds[STAGE_PACK] = engine.m_bvh_build_seconds;
+		sample.seconds[STAGE_COMPUTE] = engine.m_traversal_seconds;
+	}
+
+	sample.seconds[STAGE_TOTAL] = Since(total_start);
+	sample.hits = engine.m_intersections.size();
+	sample.checksum = Checksum(engine.m_intersections);
+	sample.culled = engine.m_culled_tiles;
+
+	return sample;
+}
+
+static benchmark_sample_t RunEngine(TiledScheduler& scheduler, std::vector<triangle_t>& triangles, std::vector<ray_t>& rays)
+{
+	benchmark_sample_t sample;
+	std::vector<intersection_t> intersections;
+
+	std::chrono::steady_clock::time_point total_start = std::chrono::steady_clock::now();
+	scheduler.Run(&triangles[0], triangles.size(), &rays[0], rays.size(), intersections);
+	sample.seconds[STAGE_TOTAL] = Since(total_start);
+
+	sample.seconds[STAGE_PACK] = scheduler.m_pack_seconds;
+	sample.seconds[STAGE_UPLOAD] = scheduler.m_upload_seconds;
+	sample.seconds[STAGE_QUEUE] = scheduler.m_queue_seconds;
+	sample.seconds[STAGE_COMPUTE] = scheduler.m_compute_seconds;
+	sample.seconds[STAGE_DRAIN] = scheduler.m_drain_seconds;
+
+	sample.hits = intersections.size();
+	sample.checksum = Checksum(intersections);
+	sample.bytes_moved = scheduler.m_bytes_to_engine + scheduler.m_bytes_from_engine;
+	sample.culled = scheduler.m_culled_runs;
+
+	return sample;
+}
+
+/* one batch of rays against a scene already resident in LMem, as a long lived session would run them. the upload is done once per configuration, by
+ * LoadScene, and is not part of the sample */
+static benchmark_sample_t RunResident(SceneSession& session, int scene, Rays& tile_rays, std::vector<ray_t>& rays)
+{
+	benchmark_sample_t sample;
+	std::vector<intersection_t> intersections;
+
+	std::chrono::steady_clock::time_point total_start = std::chrono::steady_clock::now();
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	tile_rays.SetRays(&rays[0], rays.size());
+	sample.seconds[STAGE_QUEUE] = Since(start);
+
+	size_t slots_before = session.GetRun().GetResults().m_total_slots_read;
+
+	start = std::chrono::steady_clock::now();
+	session.Intersect(scene, &tile_rays, intersections);
+	sample.seconds[STAGE_COMPUTE] = Since(start);
+
+	sample.seconds[STAGE_TOTAL] = Since(total_start);
+
+	sample.hits = intersections.size();
+	sample.checksum = Checksum(intersections);
+	/* the rays are sent once per triangle tile, and each run returns its result slots and one status slot */
+
+	u_int64_t runs = session.NumTiles(scene);
+	u_int64_t slots = session.GetRun().GetResults().m_total_slots_read - slots_before;
+	sample.bytes_moved = runs * (tile_rays.m_num_rays * sizeof(ray_t) + 16) + slots * 16;
+
+	return sample;
+}
+
+/* one run of the rays against a scene already spread across several engines by SetScene */
+static benchmark_sample_t RunMulti(MultiEngineScheduler& multi, std::vector<ray_t>& rays)
+{
+	benchmark_sample_t sample;
+	std::vector<intersection_t> intersections;
+
+	std::chrono::steady_clock::time_point total_start = std::chrono::steady_clock::now();
+	multi.Run(&rays[0], rays.size(), intersections);
+	sample.seconds[STAGE_COMPUTE] = Since(total_start);
+	sample.seconds[STAGE_TOTAL] = sample.seconds[STAGE_COMPUTE];
+
+	sample.hits = intersections.size();
+	sample.checksum = Checksum(intersections);
+
+	return sample;
+}
+
+/* nearest rank percentile of the samples of one stage, or -1 if the stage does not apply */
+static double Percentile(const std::vector<benchmark_sample_t>& samples, int stage, double percentile)
+{
+	std::vector<double> values;
+	for(size_t i = 0; i < samples.size(); i++)
+	{
+		if(samples[i].seconds[stage] >= 0){
+			values.push_back(samples[i].seconds[stage]);
+		}
+	}
+
+	if(values.empty()){
+		return -1;
+	}
+
+	std::sort(values.begin(), values.end());
+	size_t rank = (size_t)ceil((percentile / 100.0) * values.size());
+	return values[std::min(values.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+static void WriteNumber(FILE* file, double value)
+{
+	if(value < 0 || !std::isfinite(value)){
+		fprintf(file, "null");
+	}else{
+		fprintf(file, "%.6g", value);
+	}
+}
+
+static void WriteJSON(FILE* file, const benchmark_options_t& options, const std::vector<benchmark_result_t>& results, int threads)
+{
+	char timestamp[64];
+	time_t now = time(NULL);
+	strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+	fprintf(file, "{\n");
+	fprintf(file, "  \"benchmark\": \"RayTracer\",\n");
+	fprintf(file, "  \"format_version\": 1,\n");
+	fprintf(file, "  \"timestamp\": \"%s\",\n", timestamp);
+	fprintf(file, "  \"run_rule\": \"%s\",\n", RAYTRACER_RUNRULE);
+	fprintf(file, "  \"compiler\": \"%s\",\n", __VERSION__);
+	fprintf(file, "  \"isa\": \"%s\",\n", IntersectionISAName(DetectIntersectionISA()));
+	fprintf(file, "  \"threads\": %i,\n", threads);
+	fprintf(file, "  \"engines\": %i,\n", options.engines);
+	fprintf(file, "  \"repeats\": %i,\n", options.repeats);
+	fprintf(file, "  \"seed\": %u,\n", options.seed);
+	fprintf(file, "  \"cull_tiles\": %s,\n", options.cull_tiles ? "true" : "false");
+	fprintf(file, "  \"ray_tile\": %zu,\n", options.ray_tile);
+	fprintf(file, "  \"encoding\": \"%s\",\n", ResultEncodingName(options.encoding));
+	if(options.engine_triangle_format < 0){
+		fprintf(file, "  \"engine_triangle_format\": null,\n");
+	}else{
+		fprintf(file, "  \"engine_triangle_format\": \"%s\",\n", (options.engine_triangle_format == TRIANGLE_FORMAT_EDGES) ? "edges" : "vertices");
+	}
+	fprintf(file, "  \"results\": [");
+
+	for(size_t i = 0; i < results.size(); i++)
+	{
+		const benchmark_result_t& result = results[i];
+		const benchmark_sample_t& first = result.samples[0];
+
+		double total = Percentile(result.samples, STAGE_TOTAL, 50);
+		double compute = Percentile(result.samples, STAGE_COMPUTE, 50);
+		double tests = (double)result.config.rays * (double)result.config.triangles;
+
+		fprintf(file, "%s\n    {\n", (i > 0) ? "," : "");
+		fprintf(file, "      \"backend\": \"%s\",\n", result.backend.c_str());
+		fprintf(file, "      \"triangles\": %zu,\n", result.config.triangles);
+		fprintf(file, "      \"rays\": %zu,\n", result.config.rays);
+		fprintf(file, "      \"hit_density\": %g,\n", result.config.density);
+		fprintf(file, "      \"coherence\": \"%s\",\n", CoherenceName(result.config.coherence));
+		fprintf(file, "      \"hits\": %zu,\n", first.hits);
+		fprintf(file, "      \"hits_per_ray\": %.6g,\n", (double)first.hits / std::max((size_t)1, result.config.rays));
+		fprintf(file, "      \"matches_reference\": %s,\n", result.matches_reference ? "true" : "false");
+		fprintf(file, "      \"culled\": %zu,\n", first.culled);
+		fprintf(file, "      \"sort_ms\": ");
+		WriteNumber(file, (result.sort_seconds >= 0) ? result.sort_seconds * 1e3 : -1);
+		fprintf(file, ",\n");
+		fprintf(file, "      \"mrays_per_second\": ");
+		WriteNumber(file, (total > 0) ? (result.config.rays / total) / 1e6 : -1);
+		fprintf(file, ",\n      \"mtests_per_second\": ");
+		WriteNumber(file, (compute > 0) ? (tests / compute) / 1e6 : -1);
+		fprintf(file, ",\n      \"bytes_per_hit\": ");
+		WriteNumber(file, (first.bytes_moved > 0) ? (double)first.bytes_moved / std::max((size_t)1, first.hits) : -1);
+		fprintf(file, ",\n      \"stages_ms\": {");
+
+		bool first_stage = true;
+		for(int s = 0; s < NUM_STAGES; s++)
+		{
+			if(Percentile(result.samples, s, 50) < 0){
+				continue;
+			}
+
+			fprintf(file, "%s\n        \"%s\": { \"min\": ", first_stage ? "" : ",", stage_names[s]);
+			WriteNumber(file, Percentile(result.samples, s, 0) * 1e3);
+			fprintf(file, ", \"p50\": ");
+			WriteNumber(file, Percentile(result.samples, s, 50) * 1e3);
+			fprintf(file, ", \"p90\": ");
+			WriteNumber(file, Percentile(result.samples, s, 90) * 1e3);
+			fprintf(file, ", \"p99\": ");
+			WriteNumber(file, Percentile(result.samples, s, 99) * 1e3);
+			fprintf(file, ", \"max\": ");
+			WriteNumber(file, Percentile(result.samples, s, 100) * 1e3);
+			fprintf(file, " }");
+			first_stage = false;
+		}
+
+		fprintf(file, "\n      }\n    }");
+	}
+
+	fprintf(file, "\n  ]\n}\n");
+}
+
+template<typename T>
+static std::vector<T> ParseList(const char* list, T (*parse)(const char*))
+{
+	std::vector<T> values;
+	std::string item;
+	for(const char* c = list; ; c++)
+	{
+		if(*c == ',' || *c == '\0')
+		{
+			if(!item.empty()){
+				values.push_back(parse(item.c_str()));
+			}
+			item.clear();
+			if(*c == '\0'){
+				break;
+			}
+		}
+		else
+		{
+			item += *c;
+		}
+	}
+	return values;
+}
+
+static size_t ParseSize(const char* s){ return (size_t)strtoull(s, NULL, 10); }
+static float ParseFloat(const char* s){ return strtof(s, NULL); }
+static std::string ParseString(const char* s){ return std::string(s); }
+
+static ray_coherence_t ParseCoherence(const char* s)
+{
+	if(strcmp(s, "random") == 0){
+		return COHERENCE_RANDOM;
+	}
+	if(strcmp(s, "shadow") == 0){
+		return COHERENCE_SHADOW;
+	}
+	if(strcmp(s, "primary") != 0){
+		fprintf(stderr, "Unknown ray coherence %s, using primary.\n", s);
+	}
+	return COHERENCE_PRIMARY;
+}
+
+static result_encoding_t ParseEncoding(const char* s)
+{
+	if(strcmp(s, "masks") == 0){
+		return RESULT_ENCODING_MASKS;
+	}
+	if(strcmp(s, "deltas") == 0){
+		return RESULT_ENCODING_DELTAS;
+	}
+	if(strcmp(s, "pairs") != 0){
+		fprintf(stderr, "Unknown result encoding %s, using pairs.\n", s);
+	}
+	return RESULT_ENCODING_PAIRS;
+}
+
+/* runs every backend over every configuration */
+static void RunMatrix(const benchmark_options_t& options, const engine_backends_t& engines, WorkStealingPool& pool, std::vector<benchmark_result_t>& results)
+{
+	for(size_t t = 0; t < options.triangles.size(); t++){
+	for(size_t r = 0; r < options.rays.size(); r++){
+	for(size_t d = 0; d < options.densities.size(); d++){
+	for(size_t c = 0; c < options.coherences.size(); c++)
+	{
+		benchmark_config_t config;
+		config.triangles = options.triangles[t];
+		config.rays = options.rays[r];
+		config.density = options.densities[d];
+		config.coherence = options.coherences[c];
+
+		if(config.triangles == 0 || config.rays == 0){
+			continue;
+		}
+
+		std::vector<triangle_t> triangles;
+		std::vector<ray_t> rays;
+		GenerateScene(config, options.seed, triangles, rays);
+
+		/* the backends only report how many hits there are and a checksum of them, so they can all work on the sorted ids */
+
+		double sort_seconds = -1;
+		if(options.sort_rays)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			RaySorter sorter;
+			sorter.Sort(&rays[0], rays.size());
+			sort_seconds = Since(start);
+			rays.swap(sorter.m_sorted);
+		}
+
+		fprintf(stderr, "%zu triangles, %zu rays, density %g, %s rays\n", config.triangles, config.rays, config.density, CoherenceName(config.coherence));
+
+		/* the first backend to run gives the reference hits */
+
+		bool have_reference = false;
+		u_int64_t reference_checksum = 0;
+		size_t reference_hits = 0;
+
+		for(size_t b = 0; b < options.backends.size(); b++)
+		{
+			const std::string& backend = options.backends[b];
+
+			if((backend == "cpu_scalar" || backend == "cpu_scalar_edges") && ((double)config.rays * (double)config.triangles) > options.max_scalar_tests){
+				continue;
+			}
+
+			benchmark_result_t result;
+			result.config = config;
+			result.backend = backend;
+			result.sort_seconds = sort_seconds;
+
+			int scene = -1;
+			if(backend == "engine_resident")
+			{
+				scene = engines.session->LoadScene(&triangles[0], triangles.size());
+				if(scene < 0){
+					continue;
+				}
+			}
+			if(backend == "engine_multi" && !engines.multi->SetScene(&triangles[0], triangles.size())){
+				continue;
+			}
+
+			for(int i = 0; i < options.repeats; i++)
+			{
+				if(backend == "engine"){
+					result.samples.push_back(RunEngine(*engines.scheduler, triangles, rays));
+				}else if(backend == "engine_resident"){
+					result.samples.push_back(RunResident(*engines.session, scene, *engines.resident_rays, rays));
+				}else if(backend == "engine_multi"){
+					result.samples.push_back(RunMulti(*engines.multi, rays));
+				}else if(IsCPUBackend(backend)){
+					result.samples.push_back(RunCPU(backend, triangles, rays, pool, options.cull_tiles));
+				}else{
+					break;
+				}
+			}
+
+			if(scene >= 0){
+				engines.session->UnloadScene(scene);
+			}
+
+			if(result.samples.empty())
+			{
+				fprintf(stderr, "Unknown backend %s.\n", backend.c_str());
+				continue;
+			}
+
+			const benchmark_sample_t& sample = result.samples[0];
+			if(!have_reference)
+			{
+				have_reference = true;
+				reference_checksum = sample.checksum;
+				reference_hits = sample.hits;
+			}
+			result.matches_reference = (sample.hits == reference_hits) && (sample.checksum == reference_checksum);
+
+			fprintf(stderr, "\t%-14s %9.3f ms  %zu hits%s\n", backend.c_str(), Percentile(result.samples, STAGE_TOTAL, 50) * 1e3, sample.hits,
+					result.matches_reference ? "" : " (does not match the reference)");
+
+			results.push_back(result);
+		}
+	}
+	}
+	}
+	}
+}
+
+static void PrintUsage(const char* name)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  --triangles N,N,...   triangle counts (default 1000,8000)\n"
+		"  --rays N,N,...        ray counts (default 1000,8000)\n"
+		"  --density D,D,...     average triangles hit per primary ray (default 0.5,4)\n"
+		"  --coherence C,C,...   primary, random and/or shadow (default all)\n"
+		"  --backends B,B,...    cpu_scalar, cpu_simd, cpu_threaded, cpu_bvh, engine and/or\n"
+		"                        engine_resident (default all, and cpu_simd_edges), or\n"
+		"                        engine_multi, cpu_scalar_edges or cpu_threaded_edges\n"
+		"  --sort-rays           sort the rays by origin and direction before running them\n"
+		"  --no-cull             run every tile, even those no ray can hit\n"
+		"  --ray-tile N          rays per engine run (default the most a run allows)\n"
+		"  --encoding E          how the engine sends hits: pairs, masks or deltas (default pairs)\n"
+		"  --engines N           engines engine_multi spreads the rays over (default 2)\n"
+		"  --repeats N           repeats of each configuration (default 3)\n"
+		"  --seed N              scene generator seed (default 1)\n"
+		"  --max-scalar-tests N  skip cpu_scalar(_edges) above this many ray-triangle tests (default 2e8)\n"
+		"  --output FILE         write the JSON report to FILE rather than stdout\n", name);
+}
+
+int main(int argc, char** argv)
+{
+	benchmark_options_t options;
+	options.triangles = ParseList<size_t>("1000,8000", ParseSize);
+	options.rays = ParseList<size_t>("1000,8000", ParseSize);
+	options.densities = ParseList<float>("0.5,4", ParseFloat);
+	options.coherences = ParseList<ray_coherence_t>("primary,random,shadow", ParseCoherence);
+	options.backends = ParseList<std::string>("cpu_scalar,cpu_simd,cpu_simd_edges,cpu_threaded,cpu_bvh,engine,engine_resident", ParseString);
+	options.repeats = 3;
+	options.seed = 1;
+	options.max_scalar_tests = 2e8;
+	options.engines = 2;
+	options.sort_rays = false;
+	options.cull_tiles = true;
+	options.ray_tile = 0;
+	options.encoding = RESULT_ENCODING_PAIRS;
+	options.output = NULL;
+	options.engine_triangle_format = -1;
+
+	for(int i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "--sort-rays") == 0)
+		{
+			options.sort_rays = true;
+			continue;
+		}
+		if(strcmp(argv[i], "--no-cull") == 0)
+		{
+			options.cull_tiles = false;
+			continue;
+		}
+
+		const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+		if(value == NULL || strncmp(argv[i], "--", 2) != 0)
+		{
+			PrintUsage(argv[0]);
+			return 1;
+		}
+
+		if(strcmp(argv[i], "--triangles") == 0){
+			options.triangles = ParseList<size_t>(value, ParseSize);
+		}else if(strcmp(argv[i], "--rays") == 0){
+			options.rays = ParseList<size_t>(value, ParseSize);
+		}else if(strcmp(argv[i], "--density") == 0){
+			options.densities = ParseList<float>(value, ParseFloat);
+		}else if(strcmp(argv[i], "--coherence") == 0){
+			options.coherences = ParseList<ray_coherence_t>(value, ParseCoherence);
+		}else if(strcmp(argv[i], "--backends") == 0){
+			options.backends = ParseList<std::string>(value, ParseString);
+		}else if(strcmp(argv[i], "--repeats") == 0){
+			options.repeats = std::max(1, atoi(value));
+		}else if(strcmp(argv[i], "--seed") == 0){
+			options.seed = strtoul(value, NULL, 10);
+		}else if(strcmp(argv[i], "--max-scalar-tests") == 0){
+			options.max_scalar_tests = strtod(value, NULL);
+		}else if(strcmp(argv[i], "--ray-tile") == 0){
+			options.ray_tile = ParseSize(value);
+		}else if(strcmp(argv[i], "--encoding") == 0){
+			options.encoding = ParseEncoding(value);
+		}else if(strcmp(argv[i], "--engines") == 0){
+			options.engines = std::max(1, atoi(value));
+		}else if(strcmp(argv[i], "--output") == 0){
+			options.output = value;
+		}else{
+			PrintUsage(argv[0]);
+			return 1;
+		}
+		i++;
+	}
+
+	/* the simd backend is the same as the scalar one on cpus without vector units */
+
+	if(DetectIntersectionISA() == ISA_SCALAR){
+		options.backends.erase(std::remove(options.backends.begin(), options.backends.end(), "cpu_simd"), options.backends.end());
+		options.backends.erase(std::remove(options.backends.begin(), options.backends.end(), "cpu_simd_edges"), options.backends.end());
+	}
+
+	bool use_engine = std::find(options.backends.begin(), options.backends.end(), "engine") != options.backends.end() ||
+			std::find(options.backends.begin(), options.backends.end(), "engine_resident") != options.backends.end();
+	bool use_multi = std::find(options.backends.begin(), options.backends.end(), "engine_multi") != options.backends.end();
+
+	WorkStealingPool pool;
+	std::vector<benchmark_result_t> results;
+
+	engine_backends_t engines;
+	engines.scheduler = NULL;
+	engines.session = NULL;
+	engines.resident_rays = NULL;
+	engines.multi = NULL;
+
+	max_file_t* maxfile = NULL;
+	max_engine_t* engine = NULL;
+	if(use_engine || use_multi){
+		maxfile = RayTracer_init();
+		options.engine_triangle_format = (int)max_get_constant_uint64t(maxfile, "TriangleFormat");
+	}
+
+	if(use_multi){
+		engines.multi = new MultiEngineScheduler(maxfile, options.engines);
+	}
+
+	if(use_engine)
+	{
+		engine = max_load(maxfile, "*");
+
+		/* the session keeps its scenes above the scheduler's two tiles, and drains the engine's streams with the scheduler's run */
+
+		TiledScheduler scheduler(maxfile, engine, options.ray_tile);
+		scheduler.m_cull_tiles = options.cull_tiles;
+		scheduler.m_result_encoding = options.encoding;
+		SceneSession session(maxfile, engine, scheduler.GetRun(), scheduler.LMemSizeInBursts());
+		session.m_result_encoding = options.encoding;
+		Rays resident_rays(maxfile);
+
+		engines.scheduler = &scheduler;
+		engines.session = &session;
+		engines.resident_rays = &resident_rays;
+		RunMatrix(options, engines, pool, results);
+	}
+	else
+	{
+		RunMatrix(options, engines, pool, results);
+	}
+
+	delete engines.multi;
+
+	FILE* file = stdout;
+	if(options.output != NULL)
+	{
+		file = fopen(options.output, "w");
+		if(file == NULL)
+		{
+			fprintf(stderr, "Could not create %s.\n", options.output);
+			file = stdout;
+		}
+	}
+
+	WriteJSON(file, options, results, pool.NumWorkers());
+
+	if(file != stdout){
+		fclose(file);
+	}
+
+	if(use_engine){
+		max_unload(engine);
+	}
+
+	return 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * SceneConvert.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Maxfiles.h"
+#include "MaxSLiCInterface.h"
+#include "SceneFile.hpp"
+#include "MeshImporter.hpp"
+
+/* Converts an OBJ or PLY mesh to a scene file. With --dfe the triangles are written in the word layout of the RayTracer maxfile, so they can be
+ * uploaded straight from the mapped file */
+
+int main(int argc, char** argv)
+{
+	bool dfe_layout = false;
+	const char* files[2] = { NULL, NULL };
+	int num_files = 0;
+
+	for(int i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "--dfe") == 0){
+			dfe_layout = true;
+		}else if(num_files < 2){
+			files[num_files++] = argv[i];
+		}else{
+			num_files++;
+		}
+	}
+
+	if(num_files != 2)
+	{
+		printf("Usage: %s [--dfe] <mesh.obj|mesh.ply> <scene file>\n", argv[0]);
+		return 1;
+	}
+
+	scene_dfe_layout_t layout;
+	if(dfe_layout)
+	{
+		max_file_t* maxfile = RayTracer_init();
+		layout = scene_dfe_layout_t::FromMaxfile(maxfile);
+		RayTracer_free();
+	}
+
+	SceneFileWriter writer;
+	if(!writer.Open(files[1], dfe_layout ? &layout : NULL)){
+		return 1;
+	}
+
+	MeshImporter importer;
+	bool ok = importer.Import(files[0], writer);
+	ok = writer.Close(ok) && ok;
+
+	/* the incomplete file fails validation anyway, but is removed so it is not mistaken for a scene */
+
+	if(!ok){
+		remove(files[1]);
+	}
+
+	printf("%s: %zu vertices, %zu faces, %zu triangles%s\n", files[0], importer.m_num_vertices, importer.m_num_faces, importer.m_num_triangles,
+			ok ? "" : " (failed)");
+
+	return ok ? 0 : 1;
+}
@@ -11,30 +11,48 @@
 #include "Maxfiles.h"
 #include "MaxSLiCInterface.h"
 #include <errno.h>
+#include <limits.h>
+#include <vector>
+#include <algorithm>
 #include "Types.h"
+#include "SoAScene.hpp"
+#include "IndexedMesh.hpp"
+#include "Instrumentation.hpp"
 
 
 class Triangles
 {
 private:
 	triangle_t* m_triangles;
+	triangle_t* m_buffer;	/* allocated here. m_triangles points to this unless words packed elsewhere are in use */
 
 	max_file_t* m_maxfile;
 
 	int m_triangles_size_in_bytes;
 
+	/* the bursts changed since the triangles were last uploaded, as sorted, disjoint [first, end) ranges */
+	std::vector< std::pair<int, int> > m_dirty_bursts;
+
 public:
 	int m_total_triangles;
 	int m_total_bursts;
 	int m_total_words;
 
-	float m_triangles_per_word;
-	float m_word_width_in_bytes;
-	float m_burst_size_in_bytes;
+	/* a word is the triangles the kernel tests on one tick. in the per burst packing it is one burst, padded at the msb; in the continuous packing
+	 * it is exactly m_triangles_per_word triangles, so words (and so triangles) run on across burst boundaries */
+	int m_triangles_per_word;
+	int m_word_width_in_bytes;
+	int m_burst_size_in_bytes;
+
+	/* the format the maxfile was built to read the triangles in. SetTriangles converts to it, so callers always give vertices */
+	triangle_format_t m_format;
+	triangle_packing_t m_packing;
 
 	Triangles(max_file_t* maxfile, int triangle_count)
 	{
 		m_maxfile = maxfile;
+		m_format = (triangle_format_t)max_get_constant_uint64t(maxfile, "TriangleFormat");
+		m_packing = (triangle_packing_t)max_get_constant_uint64t(maxfile, "TrianglePacking");
 
 		/* some sanity checks */
 
@@ -43,68 +61,329 @@ public:
 			printf("Mismatch between typedef triangle_t on CPU and DFE");
 		}
 
-		/* compute how many triangles will fit in one word. words may not be a multiple of the triangle width so will include padding at the msb */
-
-		int word_width_in_bits = max_get_constant_uint64t(maxfile, "TrianglesInWidthInBits");
-		m_word_width_in_bytes = word_width_in_bits / 8;
-		float triangle_size_in_bytes = sizeof(triangle_t);
-
-		m_triangles_per_word = floor(m_word_width_in_bytes / triangle_size_in_bytes);
+		/* compute how many triangles will fit in one word. per burst, words may not be a multiple of the triangle width so will include padding at
+		 * the msb */
 
-		/* calculate the minimum number of words required to represent the triangle set size we desire. this may be changed later on to accomodate the number of bursts
-		 * required to read all the triangles */
-
-		m_total_words = ceil((float)triangle_count / m_triangles_per_word);
+		m_burst_size_in_bytes = max_get_burst_size(maxfile, NULL);
 
-		/* compute the number of bursts required to read all the words, and round it up. the word width may be a fraction, or multiple, of the burst width. the burst count
-		 * must always be an integer however, so if it is a fraction, more triangles will be read than are required */
+		if(m_packing == TRIANGLE_PACKING_CONTINUOUS)
+		{
+			m_triangles_per_word = max_get_constant_uint64t(maxfile, "TrianglesPerTick");
+			m_word_width_in_bytes = m_triangles_per_word * sizeof(triangle_t);
+		}
+		else
+		{
+			m_word_width_in_bytes = max_get_constant_uint64t(maxfile, "TrianglesInWidthInBits") / 8;
+			m_triangles_per_word = m_word_width_in_bytes / sizeof(triangle_t);
+		}
 
-		m_burst_size_in_bytes = max_get_burst_size(maxfile, NULL);
-		float words_per_burst = m_burst_size_in_bytes / m_word_width_in_bytes;
+		/* round the words needed up to a whole number of periods, the fewest bytes that are both whole words and whole bursts, so every word read is
+		 * whole and every pass of the kernel starts on a burst. per burst a period is one burst; continuously it is e.g. 16 words in 15 bursts. the
+		 * sizes are worked out in 64 bit integers, so are exact, and a set too large for its size in bytes to fit in an int is refused rather than
+		 * wrapped: it leaves an empty buffer, and larger scenes should be split into tiles (see TiledScheduler) */
 
-		m_total_bursts = (int)ceil((float)m_total_words / words_per_burst);
+		u_int64_t period_in_bytes = LeastCommonMultiple(m_word_width_in_bytes, m_burst_size_in_bytes);
+		u_int64_t words = ((u_int64_t)std::max(triangle_count, 0) + m_triangles_per_word - 1) / m_triangles_per_word;
+		u_int64_t periods = ((words * m_word_width_in_bytes) + period_in_bytes - 1) / period_in_bytes;
+		u_int64_t size_in_bytes = periods * period_in_bytes;
 
-		/* update the total number of bursts, words and triangles, to match the actual number that will be read by the burst count we have decided on */
+		if(size_in_bytes > INT_MAX)
+		{
+			printf("ERROR: %i triangles need %llu bytes, more than the %i one set of triangles can hold.\n", triangle_count,
+					(unsigned long long)size_in_bytes, INT_MAX);
+			size_in_bytes = 0;
+		}
 
-		m_total_words = m_total_bursts * words_per_burst;
+		m_total_bursts = (int)(size_in_bytes / m_burst_size_in_bytes);
+		m_total_words = (int)(size_in_bytes / m_word_width_in_bytes);
 		m_total_triangles = m_total_words * m_triangles_per_word;
 
-		m_triangles_size_in_bytes = m_total_bursts * m_burst_size_in_bytes;
+		m_triangles_size_in_bytes = (int)size_in_bytes;
 
 		/* and finally allocate space for the actual triangles. triangles will be stored in this array with the same layout as they have on the dfe */
 
-		m_triangles = (triangle_t*)malloc(m_triangles_size_in_bytes);
+		m_buffer = (triangle_t*)malloc(m_triangles_size_in_bytes);
+		m_triangles = m_buffer;
+	}
+
+	~Triangles()
+	{
+		free(m_buffer);
+	}
+
+	/* the most triangles a set of at most num_bursts bursts can hold, in whole periods, e.g. to size tiles to what one memory command can read */
+	int MaxTrianglesInBursts(int num_bursts) const
+	{
+		u_int64_t period_in_bytes = LeastCommonMultiple(m_word_width_in_bytes, m_burst_size_in_bytes);
+		u_int64_t periods = ((u_int64_t)num_bursts * m_burst_size_in_bytes) / period_in_bytes;
+		return (int)(periods * (period_in_bytes / m_word_width_in_bytes) * m_triangles_per_word);
 	}
 
 	/* returns a pointer into the triangles array, at which point m_triangles_per_word triangles should be copied in */
 	triangle_t* GetTrianglesWord(int word)
 	{
-		return (triangle_t*)(((char*)m_triangles) + ((int)m_word_width_in_bytes * word));
+		return (triangle_t*)(((char*)m_triangles) + (m_word_width_in_bytes * word));
 	}
 
 	triangle_t* GetTriangle(int triangle)
 	{
-		int word = floor((float)triangle/(float)m_triangles_per_word);
-		int offset = triangle % (int)m_triangles_per_word;
-		return (GetTrianglesWord(word) + offset);
+		int triangles_per_word = m_triangles_per_word;
+		return (GetTrianglesWord(triangle / triangles_per_word) + (triangle % triangles_per_word));
 	}
 
+	/* SetTriangles replaces the whole set, so marks every burst dirty; UpdateTriangles marks only the bursts of the triangles it changes */
 	void SetTriangles(triangle_t* triangles_src, int triangles_src_count)
 	{
-		for(int i = 0; i < triangles_src_count; i++)
+		if(triangles_src_count > m_total_triangles)
+		{
+			printf("ERROR: %i triangles do not fit in a buffer sized for %i.\n", triangles_src_count, m_total_triangles);
+			return;
+		}
+
+		/* step through the words rather than locating each triangle individually. the buffer may be reused for different triangle sets, so clear
+		 * it first - any triangles left over from a previous set would be tested as if they were part of this one */
+
+		m_triangles = m_buffer;
+		memset((char*)m_triangles, 0, m_triangles_size_in_bytes);
+
+		int triangles_per_word = m_triangles_per_word;
+		int i = 0;
+		for(int word = 0; i < triangles_src_count; word++)
 		{
-			*GetTriangle(i) = triangles_src[i];
+			triangle_t* dst = GetTrianglesWord(word);
+			if(m_format == TRIANGLE_FORMAT_EDGES)
+			{
+				triangle_edges_t* edges = (triangle_edges_t*)dst;
+				for(int j = 0; j < triangles_per_word && i < triangles_src_count; j++, i++)
+				{
+					edges[j] = TriangleEdges(triangles_src[i]);
+				}
+				continue;
+			}
+
+			for(int j = 0; j < triangles_per_word && i < triangles_src_count; j++, i++)
+			{
+				dst[j] = triangles_src[i];
+			}
 		}
+
+		MarkAllDirty();
+	}
+
+	/* packs a structure-of-arrays scene straight into the padded burst layout, zeroing the padding and any unused triangles */
+	void SetTriangles(const TriangleSoA& triangles_src)
+	{
+		if((int)triangles_src.m_count > m_total_triangles)
+		{
+			printf("ERROR: %i triangles do not fit in a buffer sized for %i.\n", (int)triangles_src.m_count, m_total_triangles);
+			return;
+		}
+
+		m_triangles = m_buffer;
+		triangles_src.PackWords(m_triangles, m_triangles_per_word, m_word_width_in_bytes, m_total_words, m_format);
+		MarkAllDirty();
+	}
+
+	/* expands count triangles of an indexed mesh, from first, straight into the padded burst layout, zeroing the padding and any unused triangles.
+	 * large ranges are expanded on several threads (see IndexedMesh::PackWords) */
+	void SetTriangles(const IndexedMesh& mesh, size_t first, size_t count)
+	{
+		if(first + count > mesh.NumTriangles() || (int)count > m_total_triangles)
+		{
+			printf("ERROR: triangles %zu to %zu of a mesh of %zu do not fit in a buffer sized for %i.\n", first, first + count, mesh.NumTriangles(),
+					m_total_triangles);
+			return;
+		}
+
+		m_triangles = m_buffer;
+		mesh.PackWords(m_triangles, first, count, m_triangles_per_word, m_word_width_in_bytes, m_total_words, m_format);
+		MarkAllDirty();
+	}
+
+	/* overwrites count triangles from first in place, converting them to the maxfile's format, and marks the bursts they are in dirty so UploadDirty
+	 * sends only those. returns false, changing nothing, if the range is outside the buffer or packed triangles from elsewhere are in use */
+	bool UpdateTriangles(int first, const triangle_t* triangles_src, int count)
+	{
+		if(m_triangles != m_buffer)
+		{
+			printf("ERROR: packed triangles from elsewhere are in use, so cannot be updated in place.\n");
+			return false;
+		}
+
+		if(first < 0 || count < 0 || first + count > m_total_triangles)
+		{
+			printf("ERROR: triangles %i to %i are outside a buffer of %i.\n", first, first + count, m_total_triangles);
+			return false;
+		}
+
+		for(int i = 0; i < count; i++)
+		{
+			triangle_t* dst = GetTriangle(first + i);
+			if(m_format == TRIANGLE_FORMAT_EDGES){
+				*(triangle_edges_t*)dst = TriangleEdges(triangles_src[i]);
+			}else{
+				*dst = triangles_src[i];
+			}
+		}
+
+		MarkDirty(first, count);
+		return true;
+	}
+
+	/* marks the bursts holding count triangles from first as changed, e.g. after they were written through GetTriangle */
+	void MarkDirty(int first, int count)
+	{
+		if(first < 0 || count <= 0){
+			return;
+		}
+
+		/* a word may straddle two bursts, so the range is widened out to whole bursts at both ends. the byte offsets are worked out in 64 bits, as
+		 * the word index times the word width can pass the largest int */
+
+		u_int64_t triangles_per_word = m_triangles_per_word;
+		u_int64_t word_width = m_word_width_in_bytes;
+		u_int64_t burst_size = m_burst_size_in_bytes;
+
+		u_int64_t first_byte = ((u_int64_t)first / triangles_per_word) * word_width;
+		u_int64_t end_byte = ((((u_int64_t)first + count - 1) / triangles_per_word) + 1) * word_width;
+
+		AddDirtyBursts((int)std::min((u_int64_t)m_total_bursts, first_byte / burst_size),
+				(int)std::min((u_int64_t)m_total_bursts, (end_byte + burst_size - 1) / burst_size));
+	}
+
+	void MarkAllDirty()
+	{
+		m_dirty_bursts.clear();
+		AddDirtyBursts(0, m_total_bursts);
+	}
+
+	/* the number of bursts UploadDirty would send */
+	int DirtyBursts() const
+	{
+		int bursts = 0;
+		for(size_t i = 0; i < m_dirty_bursts.size(); i++){
+			bursts += m_dirty_bursts[i].second - m_dirty_bursts[i].first;
+		}
+		return bursts;
+	}
+
+	/* uploads only the dirty bursts to the copy of the triangles in LMem at offset_in_bursts, one memoryInitialisation run per range, and marks them
+	 * clean. each run has a fixed cost, so ranges separated by max_gap_in_bursts or fewer clean bursts are sent as one. returns the bytes sent */
+	u_int64_t UploadDirty(max_engine_t* engine, int offset_in_bursts, int max_gap_in_bursts = 0)
+	{
+		INSTRUMENT_SCOPE("Triangles::UploadDirty");
+
+		u_int64_t burst_size = m_burst_size_in_bytes;
+		u_int64_t bytes = 0;
+
+		for(size_t i = 0; i < m_dirty_bursts.size(); )
+		{
+			int first = m_dirty_bursts[i].first;
+			int end = m_dirty_bursts[i].second;
+			for(i++; i < m_dirty_bursts.size() && m_dirty_bursts[i].first - end <= max_gap_in_bursts; i++){
+				end = m_dirty_bursts[i].second;
+			}
+
+			u_int64_t size = (u_int64_t)(end - first) * burst_size;
+
+			max_actions_t* init_act = max_actions_init(m_maxfile, "memoryInitialisation");
+			max_set_param_uint64t(init_act, "address", ((u_int64_t)offset_in_bursts + first) * burst_size);
+			max_set_param_uint64t(init_act, "size", size);
+			max_queue_input(init_act, "triangles_in", ((char*)m_triangles) + (first * burst_size), size);
+
+			max_run(engine, init_act);
+			max_actions_free(init_act);
+
+			bytes += size;
+		}
+
+		INSTRUMENT_COUNTER("Triangle bytes uploaded", bytes);
+
+		m_dirty_bursts.clear();
+		return bytes;
+	}
+
+	/* uses triangles already packed in the DFE layout (e.g. those of a mapped SceneFile) in place of the buffer, so they are uploaded without being
+	 * copied. The words must have the same layout, and cover at least the bursts this object was sized for; any triangles beyond those counted
+	 * by the command are never read. Packed triangles hold vertices, so cannot be used by a maxfile built for edges. Returns false, leaving the buffer
+	 * in use, if not */
+	bool UsePackedTriangles(void* words, size_t size_in_bytes, int triangles_per_word, int word_width_in_bytes)
+	{
+		if(m_format != TRIANGLE_FORMAT_VERTICES)
+		{
+			printf("ERROR: packed triangles hold vertices, but the maxfile reads triangles as edges.\n");
+			return false;
+		}
+
+		if(triangles_per_word != m_triangles_per_word || word_width_in_bytes != m_word_width_in_bytes)
+		{
+			printf("ERROR: packed triangles have %i triangles in %i byte words, expected %i in %i.\n", triangles_per_word, word_width_in_bytes,
+					m_triangles_per_word, m_word_width_in_bytes);
+			return false;
+		}
+
+		if(size_in_bytes < (size_t)m_triangles_size_in_bytes)
+		{
+			printf("ERROR: %zu bytes of packed triangles do not fill a buffer of %i.\n", size_in_bytes, m_triangles_size_in_bytes);
+			return false;
+		}
+
+		m_triangles = (triangle_t*)words;
+		return true;
 	}
 
 	void IntialiseTriangles(max_engine_t* engine, int offset_in_bursts)
 	{
+		INSTRUMENT_SCOPE("Triangles::IntialiseTriangles");
+		INSTRUMENT_COUNTER("Triangle bytes uploaded", m_triangles_size_in_bytes);
+
 		max_actions_t* init_act = max_actions_init(m_maxfile, "memoryInitialisation");
-		max_set_param_uint64t(init_act, "address", offset_in_bursts * m_burst_size_in_bytes);
+		max_set_param_uint64t(init_act, "address", (u_int64_t)offset_in_bursts * m_burst_size_in_bytes);
 		max_set_param_uint64t(init_act, "size", m_triangles_size_in_bytes);
 		max_queue_input(init_act,"triangles_in",m_triangles,m_triangles_size_in_bytes);
 
 		max_run(engine, init_act);
+
+		m_dirty_bursts.clear();
+	}
+
+	/* adds the upload of the triangles to LMem at offset_in_bursts to a default mode action set, so it is streamed in while that run computes */
+	void QueueTriangles(max_actions_t* actions, int offset_in_bursts)
+	{
+		INSTRUMENT_COUNTER("Triangle bytes queued", m_triangles_size_in_bytes);
+
+		max_queue_input(actions, "triangles_in", m_triangles, m_triangles_size_in_bytes);
+		max_lmem_linear(actions, "triangles_to_mem", (u_int64_t)offset_in_bursts * m_burst_size_in_bytes, m_triangles_size_in_bytes);
+
+		m_dirty_bursts.clear();
+	}
+
+private:
+	/* merges [first, end) into the dirty ranges, joining any it overlaps or touches */
+	void AddDirtyBursts(int first, int end)
+	{
+		if(first >= end){
+			return;
+		}
+
+		std::vector< std::pair<int, int> > merged;
+		merged.reserve(m_dirty_bursts.size() + 1);
+
+		size_t i = 0;
+		for(; i < m_dirty_bursts.size() && m_dirty_bursts[i].second < first; i++){
+			merged.push_back(m_dirty_bursts[i]);
+		}
+		for(; i < m_dirty_bursts.size() && m_dirty_bursts[i].first <= end; i++)
+		{
+			first = std::min(first, m_dirty_bursts[i].first);
+			end = std::max(end, m_dirty_bursts[i].second);
+		}
+		merged.push_back(std::make_pair(first, end));
+		for(; i < m_dirty_bursts.size(); i++){
+			merged.push_back(m_dirty_bursts[i]);
+		}
+
+		m_dirty_bursts.swap(merged);
 	}
 
 };
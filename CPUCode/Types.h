@@ -8,6 +8,9 @@
 #ifndef TYPES_H_
 #define TYPES_H_
 
+#include <string.h>
+#include <sys/types.h>
+
 struct vector3
 {
 	float x;
@@ -27,10 +30,13 @@ struct vector3
 	}
 };
 
+/* tmin and tmax bound the distances at which a hit counts for occlusion queries; the other query modes test the whole ray */
 struct ray_t
 {
 	struct vector3 origin;
 	struct vector3 direction;
+	float tmin;
+	float tmax;
 };
 
 struct triangle_t
@@ -40,16 +46,89 @@ struct triangle_t
 	struct vector3 v2;
 };
 
+/* How the engine's build expects triangles to be stored in LMem (the TriangleFormat constant of the maxfile). Vertices are triangle_t's. Edges are
+ * triangle_edges_t's, of the same size, with the edges from v0 worked out once when the triangles are packed rather than for every ray they are
+ * tested against. The subtractions are the ones the test would have done, so the hits are the same. Matches Triangle_Format_* in RayTracerKernel */
+
+enum triangle_format_t
+{
+	TRIANGLE_FORMAT_VERTICES = 0,
+	TRIANGLE_FORMAT_EDGES = 1
+};
+
+/* How the engine's build lays the triangles out in LMem (the TrianglePacking constant of the maxfile). Per burst, each burst holds a word of whole
+ * triangles and the rest of it is padding (24 bytes of every 384). Continuous, the triangles follow one another with no gaps, across burst
+ * boundaries, and the kernel cuts each tick's triangles out of the bursts as it reads them. Matches Triangle_Packing_* in RayTracerKernel */
+
+enum triangle_packing_t
+{
+	TRIANGLE_PACKING_PER_BURST = 0,
+	TRIANGLE_PACKING_CONTINUOUS = 1
+};
+
+/* the smallest number that is a multiple of both a and b, e.g. the fewest bytes that are both whole words and whole bursts */
+inline u_int64_t LeastCommonMultiple(u_int64_t a, u_int64_t b)
+{
+	u_int64_t x = a, y = b;
+	while(y != 0)
+	{
+		u_int64_t r = x % y;
+		x = y;
+		y = r;
+	}
+	return (x == 0) ? 0 : (a / x) * b;
+}
+
+struct triangle_edges_t
+{
+	struct vector3 v0;
+	struct vector3 e1;	/* v1 - v0 */
+	struct vector3 e2;	/* v2 - v0 */
+};
+
+inline triangle_edges_t TriangleEdges(const triangle_t& triangle)
+{
+	triangle_edges_t edges;
+	edges.v0 = triangle.v0;
+	edges.e1 = vector3(triangle.v1.x - triangle.v0.x, triangle.v1.y - triangle.v0.y, triangle.v1.z - triangle.v0.z);
+	edges.e2 = vector3(triangle.v2.x - triangle.v0.x, triangle.v2.y - triangle.v0.y, triangle.v2.z - triangle.v0.z);
+	return edges;
+}
+
 struct intersection_t
 {
 	u_int32_t ray;
 	u_int32_t triangle;
 
-	bool operator==(const intersection_t& rhs)
+	bool operator==(const intersection_t& rhs) const
 	{
 	    return memcmp(this, &rhs, sizeof(intersection_t)) == 0;
 	}
 };
 
+/* Closest hit mode returns one record per ray, in ray order, rather than every (ray, triangle) pair. The record is exactly one PCIe word; the ray
+ * is given by its position in the stream. Rays that hit nothing have triangle set to CLOSEST_HIT_NONE */
+
+#define CLOSEST_HIT_NONE 0xFFFFFFFF
+
+struct closest_hit_t
+{
+	u_int32_t triangle;
+	float t;
+	float u;
+	float v;
+
+	/* equally near hits go to the lower triangle index, so the choice does not depend on the order the triangles were tested in */
+	bool IsNearerThan(const closest_hit_t& other) const
+	{
+		if(triangle == CLOSEST_HIT_NONE){
+			return false;
+		}
+		if(other.triangle == CLOSEST_HIT_NONE){
+			return true;
+		}
+		return (t < other.t) || (t == other.t && triangle < other.triangle);
+	}
+};
 
 #endif /* TYPES_H_ */
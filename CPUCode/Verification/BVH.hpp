@@ -0,0 +1,574 @@
+/*
+ * BVH.hpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#ifndef BVH_HPP_
+#define BVH_HPP_
+
+#include <math.h>
+#include <float.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include "../Types.h"
+#include "../IndexedMesh.hpp"
+
+/* A bounding volume hierarchy over a triangle_t array, built with a binned surface area heuristic and traversed with an explicit stack.
+ *
+ * The hierarchy only ever culls: every triangle whose box the ray passes through is handed to the caller, which performs the real intersection
+ * test. To make sure the culling never rejects a triangle the Moller-Trumbore test would accept (it accepts points a rounding error outside the
+ * triangle), node boxes are padded by a small relative margin.
+ *
+ * When triangles move, Refit updates the boxes bottom-up without changing the tree, either for every node or only for the leaves holding the moved
+ * triangles and their ancestors. A refit tree gives the same hits, but as triangles move away from where the tree was built its boxes overlap more
+ * and traversal slows, so it should be rebuilt now and then. */
+
+#define BVH_BINS 16
+#define BVH_MAX_LEAF_SIZE 8
+#define BVH_STACK_SIZE 64
+
+struct bvh_node_t
+{
+	float bounds_min[3];
+	float bounds_max[3];
+	u_int32_t first;	//index of the first triangle for leaves, of the left child (right child follows) for interior nodes
+	u_int32_t count;	//number of triangles for leaves, 0 for interior nodes
+};
+
+class BVH
+{
+public:
+	std::vector<bvh_node_t> m_nodes;
+	std::vector<u_int32_t> m_indices;	//triangle ids, in leaf order
+
+	double m_build_seconds;
+	double m_refit_seconds;		//of the last refit
+	size_t m_num_triangles;
+	size_t m_depth;
+
+private:
+	struct aabb_t
+	{
+		float min[3];
+		float max[3];
+
+		void Reset()
+		{
+			for(int a = 0; a < 3; a++){
+				min[a] = FLT_MAX;
+				max[a] = -FLT_MAX;
+			}
+		}
+
+		void Grow(const aabb_t& b)
+		{
+			for(int a = 0; a < 3; a++){
+				min[a] = std::min(min[a], b.min[a]);
+				max[a] = std::max(max[a], b.max[a]);
+			}
+		}
+
+		void Grow(const float* p)
+		{
+			for(int a = 0; a < 3; a++){
+				min[a] = std::min(min[a], p[a]);
+				max[a] = std::max(max[a], p[a]);
+			}
+		}
+
+		float Area() const
+		{
+			if(min[0] > max[0]){
+				return 0.f;
+			}
+			float x = max[0] - min[0], y = max[1] - min[1], z = max[2] - min[2];
+			return 2.f * ((x * y) + (y * z) + (z * x));
+		}
+	};
+
+	struct bin_t
+	{
+		aabb_t bounds;
+		u_int32_t count;
+	};
+
+	std::vector<aabb_t> m_triangle_bounds;
+	std::vector<float> m_centroids;
+
+	/* kept from the build for refitting: the parent of each node (the root is its own), and the leaf each triangle is in */
+	std::vector<u_int32_t> m_parents;
+	std::vector<u_int32_t> m_leaf_of;
+	std::vector<u_int8_t> m_refit_marks;
+
+public:
+	BVH()
+	{
+		m_build_seconds = 0;
+		m_refit_seconds = 0;
+		m_num_triangles = 0;
+		m_depth = 0;
+	}
+
+	void Build(const triangle_t* triangles, size_t count)
+	{
+		BuildFrom(count, [&](size_t t) -> const triangle_t& { return triangles[t]; });
+	}
+
+	/* builds over an indexed mesh, reading each triangle's vertices through its indices */
+	void Build(const IndexedMesh& mesh)
+	{
+		BuildFrom(mesh.NumTriangles(), [&](size_t t){ return mesh.GetTriangle(t); });
+	}
+
+	/* get_triangle(t) returns triangle t, by value or by reference */
+	template<typename F>
+	void BuildFrom(size_t count, F get_triangle)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		m_num_triangles = count;
+		m_nodes.clear();
+		m_indices.resize(count);
+		m_triangle_bounds.resize(count);
+		m_centroids.resize(count * 3);
+
+		for(size_t i = 0; i < count; i++)
+		{
+			m_indices[i] = i;
+
+			const triangle_t& triangle = get_triangle(i);
+
+			aabb_t& b = m_triangle_bounds[i];
+			b.Reset();
+			b.Grow(&triangle.v0.x);
+			b.Grow(&triangle.v1.x);
+			b.Grow(&triangle.v2.x);
+
+			for(int a = 0; a < 3; a++){
+				m_centroids[(i * 3) + a] = 0.5f * (b.min[a] + b.max[a]);
+			}
+		}
+
+		m_nodes.reserve(count > 0 ? (2 * count) : 1);
+		m_nodes.push_back(bvh_node_t());
+		m_nodes[0].first = 0;
+		m_nodes[0].count = count;
+
+		/* nodes are split from an explicit work list rather than by recursion. the depth is capped so traversal can use a fixed size stack */
+
+		m_depth = 1;
+		std::vector< std::pair<u_int32_t, size_t> > work;
+		work.push_back(std::make_pair(0u, (size_t)1));
+		while(!work.empty())
+		{
+			u_int32_t node = work.back().first;
+			size_t depth = work.back().second;
+			work.pop_back();
+
+			m_depth = std::max(m_depth, depth);
+
+			if(Split(node, depth < (BVH_STACK_SIZE - 1)))
+			{
+				work.push_back(std::make_pair(m_nodes[node].first, depth + 1));
+				work.push_back(std::make_pair(m_nodes[node].first + 1, depth + 1));
+			}
+		}
+
+		m_triangle_bounds.clear();
+		m_centroids.clear();
+
+		m_parents.assign(m_nodes.size(), 0);
+		m_leaf_of.resize(count);
+		m_refit_marks.assign(m_nodes.size(), 0);
+		for(u_int32_t n = 0; n < m_nodes.size() && count > 0; n++)
+		{
+			if(m_nodes[n].count == 0)
+			{
+				m_parents[m_nodes[n].first] = n;
+				m_parents[m_nodes[n].first + 1] = n;
+				continue;
+			}
+			for(u_int32_t i = m_nodes[n].first; i < m_nodes[n].first + m_nodes[n].count; i++){
+				m_leaf_of[m_indices[i]] = n;
+			}
+		}
+
+		m_build_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	/* recomputes every box for the triangles' new positions. triangles must be the array the tree was built over (or one of the same size, in the
+	 * same order). children always come after their parent in m_nodes, so a single backwards pass is bottom-up */
+	void Refit(const triangle_t* triangles)
+	{
+		RefitFrom([&](size_t t) -> const triangle_t& { return triangles[t]; });
+	}
+
+	/* as Refit, for the tree of an indexed mesh whose vertices have moved */
+	void Refit(const IndexedMesh& mesh)
+	{
+		RefitFrom([&](size_t t){ return mesh.GetTriangle(t); });
+	}
+
+	template<typename F>
+	void RefitFrom(F get_triangle)
+	{
+		if(m_num_triangles == 0){
+			return;
+		}
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		for(size_t n = m_nodes.size(); n > 0; n--){
+			RefitNode(n - 1, get_triangle);
+		}
+
+		m_refit_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	/* as Refit, but only the boxes of the leaves holding the changed triangles, and of their ancestors, are recomputed. the rest of the triangles
+	 * must not have moved */
+	void Refit(const triangle_t* triangles, const u_int32_t* changed, size_t num_changed)
+	{
+		RefitFrom([&](size_t t) -> const triangle_t& { return triangles[t]; }, changed, num_changed);
+	}
+
+	void Refit(const IndexedMesh& mesh, const u_int32_t* changed, size_t num_changed)
+	{
+		RefitFrom([&](size_t t){ return mesh.GetTriangle(t); }, changed, num_changed);
+	}
+
+	template<typename F>
+	void RefitFrom(F get_triangle, const u_int32_t* changed, size_t num_changed)
+	{
+		if(m_num_triangles == 0){
+			return;
+		}
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		/* mark each changed leaf and its ancestors, stopping at the first already marked, then visit the marked nodes from the deepest index up */
+
+		std::vector<u_int32_t> nodes;
+		for(size_t i = 0; i < num_changed; i++)
+		{
+			if(changed[i] >= m_num_triangles){
+				continue;
+			}
+
+			u_int32_t n = m_leaf_of[changed[i]];
+			while(!m_refit_marks[n])
+			{
+				m_refit_marks[n] = 1;
+				nodes.push_back(n);
+				if(n == 0){
+					break;
+				}
+				n = m_parents[n];
+			}
+		}
+
+		std::sort(nodes.begin(), nodes.end());
+		for(size_t i = nodes.size(); i > 0; i--)
+		{
+			RefitNode(nodes[i - 1], get_triangle);
+			m_refit_marks[nodes[i - 1]] = 0;
+		}
+
+		m_refit_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	/* calls on_triangle(id) for every triangle whose (padded) bounds the ray passes through, for t >= 0 */
+	template<typename F>
+	void Traverse(const ray_t& ray, F on_triangle) const
+	{
+		TraverseRange(ray, INFINITY, [&](u_int32_t triangle){ on_triangle(triangle); return false; });
+	}
+
+	/* as Traverse, but only visits boxes the ray passes through between 0 and t_max, and stops as soon as on_triangle(id) returns true. returns
+	 * whether it was stopped */
+	template<typename F>
+	bool TraverseUntil(const ray_t& ray, float t_max, F on_triangle) const
+	{
+		return TraverseRange(ray, t_max, on_triangle);
+	}
+
+private:
+	template<typename F>
+	bool TraverseRange(const ray_t& ray, float t_max, F on_triangle) const
+	{
+		if(m_nodes.empty() || m_num_triangles == 0){
+			return false;
+		}
+
+		const float origin[3] = { ray.origin.x, ray.origin.y, ray.origin.z };
+		const float direction[3] = { ray.direction.x, ray.direction.y, ray.direction.z };
+		float inv_direction[3];
+		for(int a = 0; a < 3; a++){
+			inv_direction[a] = (direction[a] != 0.f) ? (1.f / direction[a]) : 0.f;
+		}
+
+		u_int32_t stack[BVH_STACK_SIZE];
+		int stack_size = 0;
+		stack[stack_size++] = 0;
+
+		while(stack_size > 0)
+		{
+			const bvh_node_t& node = m_nodes[stack[--stack_size]];
+
+			if(!RayHitsBox(node, origin, direction, inv_direction, t_max)){
+				continue;
+			}
+
+			if(node.count > 0)
+			{
+				for(u_int32_t i = node.first; i < node.first + node.count; i++)
+				{
+					if(on_triangle(m_indices[i])){
+						return true;
+					}
+				}
+			}
+			else
+			{
+				stack[stack_size++] = node.first;
+				stack[stack_size++] = node.first + 1;
+			}
+		}
+
+		return false;
+	}
+
+	static bool RayHitsBox(const bvh_node_t& node, const float* origin, const float* direction, const float* inv_direction, float t_max)
+	{
+		float t_near = 0.f;
+		float t_far = t_max;
+
+		for(int a = 0; a < 3; a++)
+		{
+			if(direction[a] == 0.f)
+			{
+				if(origin[a] < node.bounds_min[a] || origin[a] > node.bounds_max[a]){
+					return false;
+				}
+				continue;
+			}
+
+			float t0 = (node.bounds_min[a] - origin[a]) * inv_direction[a];
+			float t1 = (node.bounds_max[a] - origin[a]) * inv_direction[a];
+			if(t0 > t1){
+				std::swap(t0, t1);
+			}
+
+			t_near = std::max(t_near, t0);
+			t_far = std::min(t_far, t1);
+			if(t_near > t_far){
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	void SetBounds(u_int32_t node)
+	{
+		bvh_node_t& n = m_nodes[node];
+
+		aabb_t bounds;
+		bounds.Reset();
+		for(u_int32_t i = n.first; i < n.first + n.count; i++){
+			bounds.Grow(m_triangle_bounds[m_indices[i]]);
+		}
+
+		SetPaddedBounds(n, bounds);
+	}
+
+	/* leaves are bounded by their triangles, as in the build. interior boxes are the union of their (already padded) children's, so need no more
+	 * padding; they may be a little looser than a fresh build's */
+	template<typename F>
+	void RefitNode(u_int32_t node, F get_triangle)
+	{
+		bvh_node_t& n = m_nodes[node];
+
+		aabb_t bounds;
+		bounds.Reset();
+
+		if(n.count > 0)
+		{
+			for(u_int32_t i = n.first; i < n.first + n.count; i++)
+			{
+				const triangle_t& triangle = get_triangle(m_indices[i]);
+				bounds.Grow(&triangle.v0.x);
+				bounds.Grow(&triangle.v1.x);
+				bounds.Grow(&triangle.v2.x);
+			}
+			SetPaddedBounds(n, bounds);
+			return;
+		}
+
+		for(u_int32_t c = n.first; c < n.first + 2; c++)
+		{
+			for(int a = 0; a < 3; a++)
+			{
+				n.bounds_min[a] = (c == n.first) ? m_nodes[c].bounds_min[a] : std::min(n.bounds_min[a], m_nodes[c].bounds_min[a]);
+				n.bounds_max[a] = (c == n.first) ? m_nodes[c].bounds_max[a] : std::max(n.bounds_max[a], m_nodes[c].bounds_max[a]);
+			}
+		}
+	}
+
+	static void SetPaddedBounds(bvh_node_t& n, const aabb_t& bounds)
+	{
+		/* pad the box so that rounding in the slab test and in the triangle test can never cull a hit */
+		for(int a = 0; a < 3; a++)
+		{
+			float margin = 1e-5f * std::max(bounds.max[a] - bounds.min[a], std::max(fabsf(bounds.min[a]), fabsf(bounds.max[a]))) + FLT_MIN;
+			n.bounds_min[a] = bounds.min[a] - margin;
+			n.bounds_max[a] = bounds.max[a] + margin;
+		}
+	}
+
+	/* computes the node's bounds and, if it is worth it (and allowed), splits its triangles between two new children. returns true if the node
+	 * was split */
+	bool Split(u_int32_t node, bool allow_split)
+	{
+		SetBounds(node);
+
+		u_int32_t first = m_nodes[node].first;
+		u_int32_t count = m_nodes[node].count;
+
+		if(count <= 2 || !allow_split){
+			return false;
+		}
+
+		aabb_t centroid_bounds;
+		centroid_bounds.Reset();
+		for(u_int32_t i = first; i < first + count; i++){
+			centroid_bounds.Grow(&m_centroids[m_indices[i] * 3]);
+		}
+
+		/* find the cheapest binned split over all three axes */
+
+		float best_cost = FLT_MAX;
+		int best_axis = -1;
+		int best_bin = 0;
+
+		for(int a = 0; a < 3; a++)
+		{
+			float extent = centroid_bounds.max[a] - centroid_bounds.min[a];
+			if(extent <= 0.f){
+				continue;
+			}
+			float scale = BVH_BINS / extent;
+
+			bin_t bins[BVH_BINS];
+			for(int b = 0; b < BVH_BINS; b++){
+				bins[b].bounds.Reset();
+				bins[b].count = 0;
+			}
+
+			for(u_int32_t i = first; i < first + count; i++)
+			{
+				u_int32_t id = m_indices[i];
+				int b = std::min(BVH_BINS - 1, (int)((m_centroids[(id * 3) + a] - centroid_bounds.min[a]) * scale));
+				bins[b].count++;
+				bins[b].bounds.Grow(m_triangle_bounds[id]);
+			}
+
+			/* sweep from the right to get the cost of everything above each plane, then from the left */
+
+			float right_area[BVH_BINS];
+			u_int32_t right_count[BVH_BINS];
+			aabb_t right;
+			right.Reset();
+			u_int32_t right_total = 0;
+			for(int b = BVH_BINS - 1; b > 0; b--)
+			{
+				right.Grow(bins[b].bounds);
+				right_total += bins[b].count;
+				right_area[b] = right.Area();
+				right_count[b] = right_total;
+			}
+
+			aabb_t left;
+			left.Reset();
+			u_int32_t left_total = 0;
+			for(int b = 0; b < BVH_BINS - 1; b++)
+			{
+				left.Grow(bins[b].bounds);
+				left_total += bins[b].count;
+
+				float cost = (left_total * left.Area()) + (right_count[b + 1] * right_area[b + 1]);
+				if(left_total > 0 && right_count[b + 1] > 0 && cost < best_cost)
+				{
+					best_cost = cost;
+					best_axis = a;
+					best_bin = b;
+				}
+			}
+		}
+
+		const bvh_node_t& n = m_nodes[node];
+		aabb_t node_bounds;
+		for(int a = 0; a < 3; a++){
+			node_bounds.min[a] = n.bounds_min[a];
+			node_bounds.max[a] = n.bounds_max[a];
+		}
+		float leaf_cost = count * node_bounds.Area();
+
+		u_int32_t split;
+
+		if(best_axis >= 0 && (best_cost < leaf_cost || count > BVH_MAX_LEAF_SIZE))
+		{
+			float extent = centroid_bounds.max[best_axis] - centroid_bounds.min[best_axis];
+			float scale = BVH_BINS / extent;
+			float axis_min = centroid_bounds.min[best_axis];
+
+			u_int32_t* begin = &m_indices[first];
+			u_int32_t* middle = std::partition(begin, begin + count, [&](u_int32_t id)
+			{
+				return std::min(BVH_BINS - 1, (int)((m_centroids[(id * 3) + best_axis] - axis_min) * scale)) <= best_bin;
+			});
+			split = middle - begin;
+		}
+		else if(count > BVH_MAX_LEAF_SIZE)
+		{
+			/* all centroids coincide (or no split helps) but the leaf would be too big, so split by count along the widest axis */
+
+			int axis = 0;
+			for(int a = 1; a < 3; a++){
+				if((centroid_bounds.max[a] - centroid_bounds.min[a]) > (centroid_bounds.max[axis] - centroid_bounds.min[axis])){
+					axis = a;
+				}
+			}
+
+			u_int32_t* begin = &m_indices[first];
+			split = count / 2;
+			std::nth_element(begin, begin + split, begin + count, [&](u_int32_t x, u_int32_t y)
+			{
+				return m_centroids[(x * 3) + axis] < m_centroids[(y * 3) + axis];
+			});
+		}
+		else
+		{
+			return false;
+		}
+
+		u_int32_t left = m_nodes.size();
+		m_nodes.push_back(bvh_node_t());
+		m_nodes.push_back(bvh_node_t());
+
+		m_nodes[left].first = first;
+		m_nodes[left].count = split;
+		m_nodes[left + 1].first = first + split;
+		m_nodes[left + 1].count = count - split;
+
+		m_nodes[node].first = left;
+		m_nodes[node].count = 0;
+
+		return true;
+	}
+};
+
+#endif /* BVH_HPP_ */
@@ -0,0 +1,300 @@
+/*
+ * BatchIntersectionKernel.hpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#ifndef BATCHINTERSECTIONKERNEL_HPP_
+#define BATCHINTERSECTIONKERNEL_HPP_
+
+#include <math.h>
+#include <vector>
+#include "../Types.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BATCH_KERNEL_X86
+#endif
+
+/* Tests one ray against many triangles at once, 4 (SSE), 8 (AVX2) or 16 (AVX-512) triangles per instruction. The arithmetic is exactly that of the scalar
+ * Moller-Trumbore test in CPUIntersectionEngine - same operations, same order, true division and no fused multiply-add - so the hit sets are bit-identical.
+ * The instruction set is picked at runtime, so the binary does not need to be built for the machine it runs on. */
+
+enum intersection_isa_t
+{
+	ISA_SCALAR,
+	ISA_SSE,
+	ISA_AVX2,
+	ISA_AVX512
+};
+
+inline const char* IntersectionISAName(intersection_isa_t isa)
+{
+	switch(isa)
+	{
+	case ISA_SSE:		return "SSE";
+	case ISA_AVX2:		return "AVX2";
+	case ISA_AVX512:	return "AVX-512";
+	default:			return "Scalar";
+	}
+}
+
+inline intersection_isa_t DetectIntersectionISA()
+{
+#ifdef BATCH_KERNEL_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f")){
+		return ISA_AVX512;
+	}
+	if(__builtin_cpu_supports("avx2")){
+		return ISA_AVX2;
+	}
+	if(__builtin_cpu_supports("sse2")){
+		return ISA_SSE;
+	}
+#endif
+	return ISA_SCALAR;
+}
+
+/* The scalar test compares floats against a double epsilon. This returns the largest float strictly below epsilon, so that (det < epsilon) in double
+ * precision is the same as (det <= bound) in single precision, and (t > epsilon) the same as (t > bound) */
+inline float LowerFloatBound(double epsilon)
+{
+	float bound = (float)epsilon;
+	if((double)bound >= epsilon){
+		bound = nextafterf(bound, 0.f);
+	}
+	return bound;
+}
+
+/* Triangle vertices split into one array per component (see TriangleSoA). The arrays must be 64 byte aligned and hold padded_count elements, where
+ * padded_count is a multiple of TRIANGLE_LANES_ALIGNMENT, and the padding must be zero (degenerate triangles can never be hit). In the edges format,
+ * v1 and v2 hold the edges e1 and e2, and the kernels skip the subtractions that would make them */
+
+#define TRIANGLE_LANES_ALIGNMENT 16
+
+struct triangle_lanes_t
+{
+	const float* v0x; const float* v0y; const float* v0z;
+	const float* v1x; const float* v1y; const float* v1z;
+	const float* v2x; const float* v2y; const float* v2z;
+
+	size_t count;
+	size_t padded_count;
+
+	size_t base;	//index of the first triangle in the lanes, added to the reported triangle ids
+
+	triangle_format_t format;
+};
+
+/* a view of triangles [begin, end) of the given lanes. begin must be a multiple of TRIANGLE_LANES_ALIGNMENT to keep the loads aligned */
+inline triangle_lanes_t TriangleLanesRange(const triangle_lanes_t& lanes, size_t begin, size_t end)
+{
+	triangle_lanes_t range = lanes;
+	range.v0x += begin; range.v0y += begin; range.v0z += begin;
+	range.v1x += begin; range.v1y += begin; range.v1z += begin;
+	range.v2x += begin; range.v2y += begin; range.v2z += begin;
+	range.count = end - begin;
+	range.padded_count = ((range.count + TRIANGLE_LANES_ALIGNMENT - 1) / TRIANGLE_LANES_ALIGNMENT) * TRIANGLE_LANES_ALIGNMENT;
+	range.base = lanes.base + begin;
+	return range;
+}
+
+/* pushes the hits in a block of triangles, given as a bitmask of lanes, in ascending triangle order */
+inline void PushHits(unsigned int mask, u_int32_t ray, const triangle_lanes_t& tris, size_t first_triangle, std::vector<intersection_t>& intersections)
+{
+	while(mask)
+	{
+		size_t triangle = first_triangle + __builtin_ctz(mask);
+		mask &= mask - 1;
+
+		if(triangle < tris.count)
+		{
+			intersection_t result;
+			result.ray = ray;
+			result.triangle = tris.base + triangle;
+			intersections.push_back(result);
+		}
+	}
+}
+
+#ifdef BATCH_KERNEL_X86
+
+template<bool EDGES>
+__attribute__((target("sse2")))
+inline void IntersectRaySSE(const triangle_lanes_t& tris, const ray_t& ray, u_int32_t ray_index, float epsilon, std::vector<intersection_t>& intersections)
+{
+	const __m128 ox = _mm_set1_ps(ray.origin.x), oy = _mm_set1_ps(ray.origin.y), oz = _mm_set1_ps(ray.origin.z);
+	const __m128 dx = _mm_set1_ps(ray.direction.x), dy = _mm_set1_ps(ray.direction.y), dz = _mm_set1_ps(ray.direction.z);
+	const __m128 eps = _mm_set1_ps(epsilon), neg_eps = _mm_set1_ps(-epsilon);
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f);
+
+	for(size_t i = 0; i < tris.padded_count; i += 4)
+	{
+		__m128 v0x = _mm_load_ps(tris.v0x + i), v0y = _mm_load_ps(tris.v0y + i), v0z = _mm_load_ps(tris.v0z + i);
+
+		//e1 = V2 - V1, e2 = V3 - V1, unless the lanes hold them already
+		__m128 e1x = _mm_load_ps(tris.v1x + i), e1y = _mm_load_ps(tris.v1y + i), e1z = _mm_load_ps(tris.v1z + i);
+		__m128 e2x = _mm_load_ps(tris.v2x + i), e2y = _mm_load_ps(tris.v2y + i), e2z = _mm_load_ps(tris.v2z + i);
+		if(!EDGES)
+		{
+			e1x = _mm_sub_ps(e1x, v0x); e1y = _mm_sub_ps(e1y, v0y); e1z = _mm_sub_ps(e1z, v0z);
+			e2x = _mm_sub_ps(e2x, v0x); e2y = _mm_sub_ps(e2y, v0y); e2z = _mm_sub_ps(e2z, v0z);
+		}
+
+		//P = CROSS(D, e2)
+		__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+		__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+		__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+
+		//det = DOT(e1, P)
+		__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+		__m128 miss = _mm_and_ps(_mm_cmpge_ps(det, neg_eps), _mm_cmple_ps(det, eps));
+		__m128 inv_det = _mm_div_ps(one, det);
+
+		//T = SUB(O, V1)
+		__m128 tx = _mm_sub_ps(ox, v0x), ty = _mm_sub_ps(oy, v0y), tz = _mm_sub_ps(oz, v0z);
+
+		__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inv_det);
+		miss = _mm_or_ps(miss, _mm_or_ps(_mm_cmplt_ps(u, zero), _mm_cmpgt_ps(u, one)));
+
+		//Q = CROSS(T, e1)
+		__m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+		__m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+		__m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+
+		__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv_det);
+		miss = _mm_or_ps(miss, _mm_or_ps(_mm_cmplt_ps(v, zero), _mm_cmpgt_ps(_mm_add_ps(u, v), one)));
+
+		__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+		__m128 hit = _mm_andnot_ps(miss, _mm_cmpgt_ps(t, eps));
+
+		PushHits(_mm_movemask_ps(hit), ray_index, tris, i, intersections);
+	}
+}
+
+template<bool EDGES>
+__attribute__((target("avx2")))
+inline void IntersectRayAVX2(const triangle_lanes_t& tris, const ray_t& ray, u_int32_t ray_index, float epsilon, std::vector<intersection_t>& intersections)
+{
+	const __m256 ox = _mm256_set1_ps(ray.origin.x), oy = _mm256_set1_ps(ray.origin.y), oz = _mm256_set1_ps(ray.origin.z);
+	const __m256 dx = _mm256_set1_ps(ray.direction.x), dy = _mm256_set1_ps(ray.direction.y), dz = _mm256_set1_ps(ray.direction.z);
+	const __m256 eps = _mm256_set1_ps(epsilon), neg_eps = _mm256_set1_ps(-epsilon);
+	const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.f);
+
+	for(size_t i = 0; i < tris.padded_count; i += 8)
+	{
+		__m256 v0x = _mm256_load_ps(tris.v0x + i), v0y = _mm256_load_ps(tris.v0y + i), v0z = _mm256_load_ps(tris.v0z + i);
+
+		__m256 e1x = _mm256_load_ps(tris.v1x + i), e1y = _mm256_load_ps(tris.v1y + i), e1z = _mm256_load_ps(tris.v1z + i);
+		__m256 e2x = _mm256_load_ps(tris.v2x + i), e2y = _mm256_load_ps(tris.v2y + i), e2z = _mm256_load_ps(tris.v2z + i);
+		if(!EDGES)
+		{
+			e1x = _mm256_sub_ps(e1x, v0x); e1y = _mm256_sub_ps(e1y, v0y); e1z = _mm256_sub_ps(e1z, v0z);
+			e2x = _mm256_sub_ps(e2x, v0x); e2y = _mm256_sub_ps(e2y, v0y); e2z = _mm256_sub_ps(e2z, v0z);
+		}
+
+		__m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+		__m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+		__m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+
+		__m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+		__m256 miss = _mm256_and_ps(_mm256_cmp_ps(det, neg_eps, _CMP_GE_OQ), _mm256_cmp_ps(det, eps, _CMP_LE_OQ));
+		__m256 inv_det = _mm256_div_ps(one, det);
+
+		__m256 tx = _mm256_sub_ps(ox, v0x), ty = _mm256_sub_ps(oy, v0y), tz = _mm256_sub_ps(oz, v0z);
+
+		__m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px), _mm256_mul_ps(ty, py)), _mm256_mul_ps(tz, pz)), inv_det);
+		miss = _mm256_or_ps(miss, _mm256_or_ps(_mm256_cmp_ps(u, zero, _CMP_LT_OQ), _mm256_cmp_ps(u, one, _CMP_GT_OQ)));
+
+		__m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(tz, e1y));
+		__m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(tx, e1z));
+		__m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(ty, e1x));
+
+		__m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), inv_det);
+		miss = _mm256_or_ps(miss, _mm256_or_ps(_mm256_cmp_ps(v, zero, _CMP_LT_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_GT_OQ)));
+
+		__m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), inv_det);
+		__m256 hit = _mm256_andnot_ps(miss, _mm256_cmp_ps(t, eps, _CMP_GT_OQ));
+
+		PushHits(_mm256_movemask_ps(hit), ray_index, tris, i, intersections);
+	}
+}
+
+template<bool EDGES>
+__attribute__((target("avx512f")))
+inline void IntersectRayAVX512(const triangle_lanes_t& tris, const ray_t& ray, u_int32_t ray_index, float epsilon, std::vector<intersection_t>& intersections)
+{
+	const __m512 ox = _mm512_set1_ps(ray.origin.x), oy = _mm512_set1_ps(ray.origin.y), oz = _mm512_set1_ps(ray.origin.z);
+	const __m512 dx = _mm512_set1_ps(ray.direction.x), dy = _mm512_set1_ps(ray.direction.y), dz = _mm512_set1_ps(ray.direction.z);
+	const __m512 eps = _mm512_set1_ps(epsilon), neg_eps = _mm512_set1_ps(-epsilon);
+	const __m512 zero = _mm512_setzero_ps(), one = _mm512_set1_ps(1.f);
+
+	for(size_t i = 0; i < tris.padded_count; i += 16)
+	{
+		__m512 v0x = _mm512_load_ps(tris.v0x + i), v0y = _mm512_load_ps(tris.v0y + i), v0z = _mm512_load_ps(tris.v0z + i);
+
+		__m512 e1x = _mm512_load_ps(tris.v1x + i), e1y = _mm512_load_ps(tris.v1y + i), e1z = _mm512_load_ps(tris.v1z + i);
+		__m512 e2x = _mm512_load_ps(tris.v2x + i), e2y = _mm512_load_ps(tris.v2y + i), e2z = _mm512_load_ps(tris.v2z + i);
+		if(!EDGES)
+		{
+			e1x = _mm512_sub_ps(e1x, v0x); e1y = _mm512_sub_ps(e1y, v0y); e1z = _mm512_sub_ps(e1z, v0z);
+			e2x = _mm512_sub_ps(e2x, v0x); e2y = _mm512_sub_ps(e2y, v0y); e2z = _mm512_sub_ps(e2z, v0z);
+		}
+
+		__m512 px = _mm512_sub_ps(_mm512_mul_ps(dy, e2z), _mm512_mul_ps(dz, e2y));
+		__m512 py = _mm512_sub_ps(_mm512_mul_ps(dz, e2x), _mm512_mul_ps(dx, e2z));
+		__m512 pz = _mm512_sub_ps(_mm512_mul_ps(dx, e2y), _mm512_mul_ps(dy, e2x));
+
+		__m512 det = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(e1x, px), _mm512_mul_ps(e1y, py)), _mm512_mul_ps(e1z, pz));
+		__mmask16 miss = _mm512_cmp_ps_mask(det, neg_eps, _CMP_GE_OQ) & _mm512_cmp_ps_mask(det, eps, _CMP_LE_OQ);
+		__m512 inv_det = _mm512_div_ps(one, det);
+
+		__m512 tx = _mm512_sub_ps(ox, v0x), ty = _mm512_sub_ps(oy, v0y), tz = _mm512_sub_ps(oz, v0z);
+
+		__m512 u = _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(tx, px), _mm512_mul_ps(ty, py)), _mm512_mul_ps(tz, pz)), inv_det);
+		miss |= _mm512_cmp_ps_mask(u, zero, _CMP_LT_OQ) | _mm512_cmp_ps_mask(u, one, _CMP_GT_OQ);
+
+		__m512 qx = _mm512_sub_ps(_mm512_mul_ps(ty, e1z), _mm512_mul_ps(tz, e1y));
+		__m512 qy = _mm512_sub_ps(_mm512_mul_ps(tz, e1x), _mm512_mul_ps(tx, e1z));
+		__m512 qz = _mm512_sub_ps(_mm512_mul_ps(tx, e1y), _mm512_mul_ps(ty, e1x));
+
+		__m512 v = _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, qx), _mm512_mul_ps(dy, qy)), _mm512_mul_ps(dz, qz)), inv_det);
+		miss |= _mm512_cmp_ps_mask(v, zero, _CMP_LT_OQ) | _mm512_cmp_ps_mask(_mm512_add_ps(u, v), one, _CMP_GT_OQ);
+
+		__m512 t = _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(e2x, qx), _mm512_mul_ps(e2y, qy)), _mm512_mul_ps(e2z, qz)), inv_det);
+		__mmask16 hit = _mm512_cmp_ps_mask(t, eps, _CMP_GT_OQ) & ~miss;
+
+		PushHits(hit, ray_index, tris, i, intersections);
+	}
+}
+
+#endif /* BATCH_KERNEL_X86 */
+
+/* Tests the ray against every triangle in tris with the requested instruction set, appending (ray_index, triangle) for each hit. Returns false if the
+ * instruction set is not available in this build (the caller should then fall back to the scalar test) */
+inline bool IntersectRayBatch(intersection_isa_t isa, const triangle_lanes_t& tris, const ray_t& ray, u_int32_t ray_index, float epsilon, std::vector<intersection_t>& intersections)
+{
+#ifdef BATCH_KERNEL_X86
+	bool edges = (tris.format == TRIANGLE_FORMAT_EDGES);
+
+	switch(isa)
+	{
+	case ISA_AVX512:
+		edges ? IntersectRayAVX512<true>(tris, ray, ray_index, epsilon, intersections) : IntersectRayAVX512<false>(tris, ray, ray_index, epsilon, intersections);
+		return true;
+	case ISA_AVX2:
+		edges ? IntersectRayAVX2<true>(tris, ray, ray_index, epsilon, intersections) : IntersectRayAVX2<false>(tris, ray, ray_index, epsilon, intersections);
+		return true;
+	case ISA_SSE:
+		edges ? IntersectRaySSE<true>(tris, ray, ray_index, epsilon, intersections) : IntersectRaySSE<false>(tris, ray, ray_index, epsilon, intersections);
+		return true;
+	default:
+		break;
+	}
+#endif
+	return false;
+}
+
+#endif /* BATCHINTERSECTIONKERNEL_HPP_ */
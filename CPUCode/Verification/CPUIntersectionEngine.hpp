@@ -9,28 +9,170 @@
 #define CPUINTERSECTIONENGINE_HPP_
 
 #include "Types.h"
+#include "BatchIntersectionKernel.hpp"
+#include "WorkStealingPool.hpp"
+#include "BVH.hpp"
+#include "../SoAScene.hpp"
+#include "../RaySorter.hpp"
+#include "../TileBounds.hpp"
+#include "../ResultEncoding.hpp"
+#include <algorithm>
+#include <atomic>
 
 #define EPSILON 0.000001
 
+enum intersection_mode_t
+{
+	MODE_BRUTE_FORCE,	//every ray against every triangle
+	MODE_BVH			//rays traverse a bounding volume hierarchy and are only tested against the triangles in the leaves they reach
+};
+
 class CPUIntersectionEngine
 {
 public:
 	triangle_t* m_triangles;
 	size_t m_num_triangles;
 
+	/* if set, the triangles are read from this indexed mesh, through its indices, rather than from m_triangles; m_num_triangles must be its
+	 * NumTriangles(). the hits are the same as for the expanded triangles */
+	const IndexedMesh* m_mesh;
+
+	/* optional structure-of-arrays copy of the triangles for the batch kernels. if NULL, one is built from the triangles when needed */
+	const TriangleSoA* m_triangle_lanes;
+
 	ray_t* m_rays;
 	size_t m_num_rays;
 
 	std::vector<intersection_t> m_intersections;
 
+	/* filled by DoClosestHitTests, one per ray */
+	std::vector<closest_hit_t> m_closest_hits;
+
+	/* filled by DoOcclusionTests: bit (r % 64) of word (r / 64) is set if ray r is blocked */
+	std::vector<u_int64_t> m_occlusion;
+
+	/* the instruction set used by DoIntersectionTests. defaults to the best one the cpu supports; the results are the same whichever is used */
+	intersection_isa_t m_isa;
+
+	/* if set, DoIntersectionTests splits the rays x triangles space into tiles of this size and runs them on the pool. the triangle tile size must
+	 * be a multiple of TRIANGLE_LANES_ALIGNMENT */
+	WorkStealingPool* m_pool;
+	size_t m_rays_per_tile;
+	size_t m_triangles_per_tile;
+
+	/* MODE_BVH gives the same hits as MODE_BRUTE_FORCE. if m_bvh is NULL a hierarchy is built over the triangles when the tests are run */
+	intersection_mode_t m_mode;
+	const BVH* m_bvh;
+
+	double m_bvh_build_seconds;
+	double m_traversal_seconds;
+
+	/* if set, DoIntersectionTests sorts the rays by origin and direction (see RaySorter) so that the rays of a tile or packet are coherent, and
+	 * maps the hits back to the original ray ids. the hits are then in the sorted order of the rays rather than in ray order */
+	bool m_sort_rays;
+
+	/* if set, DoParallelIntersectionTests skips tiles whose rays cannot reach any of its triangles (see TileBounds). the hits are the same. off by
+	 * default, as this engine is the reference the others are verified against. m_culled_tiles counts the tiles skipped by the last tests */
+	bool m_cull_tiles;
+	size_t m_culled_tiles;
+
+	/* the format the brute force tests hold the triangles in. in the edges format, each triangle's edges are worked out once per DoIntersectionTests
+	 * rather than once per ray, as the engine's edges build does; the hits are the same. m_triangle_lanes is used only if it is in this format */
+	triangle_format_t m_triangle_format;
+
+private:
+	RaySorter m_sorter;
+
+	struct tile_segment_t
+	{
+		int worker;
+		size_t begin;
+		size_t end;
+	};
+
 public:
+	CPUIntersectionEngine()
+	{
+		m_triangles = NULL;
+		m_num_triangles = 0;
+		m_mesh = NULL;
+		m_triangle_lanes = NULL;
+		m_rays = NULL;
+		m_num_rays = 0;
+		m_isa = DetectIntersectionISA();
+		m_pool = NULL;
+		m_rays_per_tile = 64;
+		m_triangles_per_tile = 4096;
+		m_mode = MODE_BRUTE_FORCE;
+		m_bvh = NULL;
+		m_bvh_build_seconds = 0;
+		m_traversal_seconds = 0;
+		m_sort_rays = false;
+		m_cull_tiles = false;
+		m_culled_tiles = 0;
+		m_triangle_format = TRIANGLE_FORMAT_VERTICES;
+	}
+
 	void DoIntersectionTests()
 	{
+		if(m_sort_rays)
+		{
+			ray_t* rays = m_rays;
+			m_sorter.Sort(rays, m_num_rays);
+			m_rays = m_sorter.m_sorted.empty() ? rays : &m_sorter.m_sorted[0];
+
+			size_t first = m_intersections.size();
+			DoUnsortedIntersectionTests();
+
+			/* the scalar fallback of the batch tests clears the hits */
+
+			m_rays = rays;
+			first = std::min(first, m_intersections.size());
+			m_sorter.RemapIntersections(m_intersections.data() + first, m_intersections.size() - first);
+		}
+		else
+		{
+			DoUnsortedIntersectionTests();
+		}
+	}
+
+	/* encodes m_intersections as a run of the engine with the given layout would send them (see ResultEncoding), so the engine's encoded stream
+	 * can be checked against the reference as well as the hits decoded from it */
+	bool EncodeIntersections(result_encoding_t encoding, const result_layout_t& layout, std::vector<u_int32_t>& units) const
+	{
+		return EncodeResults(encoding, layout, m_intersections.empty() ? NULL : &m_intersections[0], m_intersections.size(), units);
+	}
+
+	void DoUnsortedIntersectionTests()
+	{
+		if(m_mode == MODE_BVH)
+		{
+			DoBVHIntersectionTests();
+		}
+		else if(m_pool != NULL)
+		{
+			DoParallelIntersectionTests();
+		}
+		else if(m_isa == ISA_SCALAR)
+		{
+			DoScalarIntersectionTests();
+		}
+		else
+		{
+			DoBatchIntersectionTests();
+		}
+	}
+
+	void DoScalarIntersectionTests()
+	{
+		std::vector<triangle_edges_t> edges;
+		PrepareEdges(edges);
+
 		for(uint r = 0; r < m_num_rays; r++)
 		{
 			for(uint t = 0; t < m_num_triangles; t++)
 			{
-				if(CheckIntersection(m_triangles[t], m_rays[r]))
+				if(CheckIntersection(t, edges, m_rays[r]))
 				{
 					intersection_t result;
 					result.ray = r;
@@ -41,12 +183,423 @@ public:
 		}
 	}
 
+	void DoBatchIntersectionTests()
+	{
+		TriangleSoA local_lanes;
+		triangle_lanes_t tris = PrepareLanes(local_lanes);
+
+		float epsilon = LowerFloatBound(EPSILON);
+
+		for(uint r = 0; r < m_num_rays; r++)
+		{
+			if(!IntersectRayBatch(m_isa, tris, m_rays[r], r, epsilon, m_intersections))
+			{
+				m_isa = ISA_SCALAR;
+				m_intersections.clear();
+				DoScalarIntersectionTests();
+				return;
+			}
+		}
+	}
+
+	/* Each tile is a block of rays against a block of triangles. Workers append hits to their own buffers and note where each tile's hits went;
+	 * the segments are then concatenated in tile order, and a stable sort by ray within each block of rays puts the hits in the same order as the
+	 * single threaded loops (ray major, ascending triangle). */
+	void DoParallelIntersectionTests()
+	{
+		TriangleSoA local_lanes;
+		std::vector<triangle_edges_t> edges;
+
+		triangle_lanes_t tris = local_lanes.GetLanes();
+		if(m_isa != ISA_SCALAR){
+			tris = PrepareLanes(local_lanes);
+		}else{
+			PrepareEdges(edges);
+		}
+		float epsilon = LowerFloatBound(EPSILON);
+
+		size_t triangles_per_tile = ((m_triangles_per_tile + TRIANGLE_LANES_ALIGNMENT - 1) / TRIANGLE_LANES_ALIGNMENT) * TRIANGLE_LANES_ALIGNMENT;
+		size_t rays_per_tile = (m_rays_per_tile > 0) ? m_rays_per_tile : 1;
+
+		size_t ray_tiles = (m_num_rays + rays_per_tile - 1) / rays_per_tile;
+		size_t triangle_tiles = (m_num_triangles + triangles_per_tile - 1) / triangles_per_tile;
+
+		std::vector< std::vector<intersection_t> > worker_results(m_pool->NumWorkers());
+		std::vector<tile_segment_t> segments(ray_tiles * triangle_tiles);
+
+		intersection_isa_t isa = m_isa;
+
+		std::vector<ray_packet_bounds_t> ray_bounds;
+		std::vector<tile_box_t> triangle_bounds;
+		if(m_cull_tiles)
+		{
+			for(size_t rt = 0; rt < ray_tiles; rt++)
+			{
+				size_t ray_begin = rt * rays_per_tile;
+				ray_bounds.push_back(RayPacketBounds(m_rays + ray_begin, std::min(rays_per_tile, m_num_rays - ray_begin)));
+			}
+			for(size_t tt = 0; tt < triangle_tiles; tt++)
+			{
+				size_t triangle_begin = tt * triangles_per_tile;
+				triangle_bounds.push_back(TileBoundsOf(triangle_begin, std::min(triangles_per_tile, m_num_triangles - triangle_begin)));
+			}
+		}
+
+		std::atomic<size_t> culled(0);
+
+		m_pool->ParallelFor(segments.size(), [&](size_t tile, int worker)
+		{
+			size_t ray_begin = (tile / triangle_tiles) * rays_per_tile;
+			size_t ray_end = std::min(ray_begin + rays_per_tile, m_num_rays);
+			size_t triangle_begin = (tile % triangle_tiles) * triangles_per_tile;
+			size_t triangle_end = std::min(triangle_begin + triangles_per_tile, m_num_triangles);
+
+			std::vector<intersection_t>& results = worker_results[worker];
+
+			tile_segment_t& segment = segments[tile];
+			segment.worker = worker;
+			segment.begin = results.size();
+			segment.end = results.size();
+
+			if(m_cull_tiles && !MayIntersect(ray_bounds[tile / triangle_tiles], triangle_bounds[tile % triangle_tiles]))
+			{
+				culled++;
+				return;
+			}
+
+			triangle_lanes_t range = TriangleLanesRange(tris, triangle_begin, triangle_end);
+
+			for(size_t r = ray_begin; r < ray_end; r++)
+			{
+				if(isa != ISA_SCALAR && IntersectRayBatch(isa, range, m_rays[r], r, epsilon, results)){
+					continue;
+				}
+
+				for(size_t t = triangle_begin; t < triangle_end; t++)
+				{
+					if(CheckIntersection(t, edges, m_rays[r]))
+					{
+						intersection_t result;
+						result.ray = r;
+						result.triangle = t;
+						results.push_back(result);
+					}
+				}
+			}
+
+			segment.end = results.size();
+		});
+
+		m_culled_tiles = culled.load();
+
+		size_t total = 0;
+		for(size_t i = 0; i < worker_results.size(); i++){
+			total += worker_results[i].size();
+		}
+		m_intersections.reserve(m_intersections.size() + total);
+
+		for(size_t rt = 0; rt < ray_tiles; rt++)
+		{
+			size_t block_begin = m_intersections.size();
+
+			for(size_t tt = 0; tt < triangle_tiles; tt++)
+			{
+				const tile_segment_t& segment = segments[(rt * triangle_tiles) + tt];
+				const std::vector<intersection_t>& results = worker_results[segment.worker];
+				m_intersections.insert(m_intersections.end(), results.begin() + segment.begin, results.begin() + segment.end);
+			}
+
+			if(triangle_tiles > 1){
+				std::stable_sort(m_intersections.begin() + block_begin, m_intersections.end(), CompareRay);
+			}
+		}
+	}
+
+	/* Tests each ray only against the triangles in the BVH leaves it reaches. The candidates of one ray are tested with the scalar test and the hits
+	 * sorted by triangle, so the results (and their order) are the same as the brute force loops. Rays are split into tiles over the pool, if set. */
+	void DoBVHIntersectionTests()
+	{
+		BVH local_bvh;
+		const BVH* bvh = m_bvh;
+		if(bvh == NULL)
+		{
+			BuildBVH(local_bvh);
+			bvh = &local_bvh;
+		}
+		m_bvh_build_seconds = bvh->m_build_seconds;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		size_t rays_per_tile = (m_rays_per_tile > 0) ? m_rays_per_tile : 1;
+		size_t ray_tiles = (m_num_rays + rays_per_tile - 1) / rays_per_tile;
+		std::vector< std::vector<intersection_t> > tile_results(ray_tiles);
+
+		std::function<void(size_t, int)> job = [&](size_t tile, int)
+		{
+			std::vector<intersection_t>& results = tile_results[tile];
+			std::vector<u_int32_t> hits;
+
+			size_t ray_end = std::min((tile + 1) * rays_per_tile, m_num_rays);
+			for(size_t r = tile * rays_per_tile; r < ray_end; r++)
+			{
+				hits.clear();
+				bvh->Traverse(m_rays[r], [&](u_int32_t t)
+				{
+					if(CheckIntersection(Triangle(t), m_rays[r])){
+						hits.push_back(t);
+					}
+				});
+				std::sort(hits.begin(), hits.end());
+
+				for(size_t i = 0; i < hits.size(); i++)
+				{
+					intersection_t result;
+					result.ray = r;
+					result.triangle = hits[i];
+					results.push_back(result);
+				}
+			}
+		};
+
+		if(m_pool != NULL)
+		{
+			m_pool->ParallelFor(ray_tiles, job);
+		}
+		else
+		{
+			for(size_t tile = 0; tile < ray_tiles; tile++){
+				job(tile, 0);
+			}
+		}
+
+		for(size_t tile = 0; tile < ray_tiles; tile++){
+			m_intersections.insert(m_intersections.end(), tile_results[tile].begin(), tile_results[tile].end());
+		}
+
+		m_traversal_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	/* For each ray, finds the nearest triangle it hits, along with the t, u and v of the hit. Uses the BVH in MODE_BVH, and splits the rays into
+	 * tiles over the pool, if set. */
+	void DoClosestHitTests()
+	{
+		closest_hit_t none;
+		none.triangle = CLOSEST_HIT_NONE;
+		none.t = 0;
+		none.u = 0;
+		none.v = 0;
+		m_closest_hits.assign(m_num_rays, none);
+
+		BVH local_bvh;
+		const BVH* bvh = PrepareBVH(local_bvh);
+
+		RunRayTiles(m_rays_per_tile, [&](size_t ray_begin, size_t ray_end)
+		{
+			for(size_t r = ray_begin; r < ray_end; r++)
+			{
+				closest_hit_t& closest = m_closest_hits[r];
+				if(bvh != NULL)
+				{
+					bvh->Traverse(m_rays[r], [&](u_int32_t t){ KeepClosest(closest, t, m_rays[r]); });
+				}
+				else
+				{
+					for(size_t t = 0; t < m_num_triangles; t++){
+						KeepClosest(closest, t, m_rays[r]);
+					}
+				}
+			}
+		});
+	}
+
+	/* For each ray, finds whether any triangle blocks it between its tmin and tmax. Each ray stops at the first such triangle, and in MODE_BVH
+	 * only visits the boxes it passes through before tmax. The result is a bit per ray in m_occlusion, laid out as the DFE sends it. */
+	void DoOcclusionTests()
+	{
+		m_occlusion.assign((m_num_rays + 63) / 64, 0);
+
+		BVH local_bvh;
+		const BVH* bvh = PrepareBVH(local_bvh);
+
+		/* tiles are whole words of the mask, so no two workers write the same word */
+
+		size_t rays_per_tile = std::max((size_t)64, ((m_rays_per_tile + 63) / 64) * 64);
+
+		RunRayTiles(rays_per_tile, [&](size_t ray_begin, size_t ray_end)
+		{
+			for(size_t r = ray_begin; r < ray_end; r++)
+			{
+				const ray_t& ray = m_rays[r];
+				bool occluded = false;
+
+				if(bvh != NULL)
+				{
+					occluded = bvh->TraverseUntil(ray, ray.tmax, [&](u_int32_t t){ return Occludes(t, ray); });
+				}
+				else
+				{
+					for(size_t t = 0; t < m_num_triangles && !occluded; t++){
+						occluded = Occludes(t, ray);
+					}
+				}
+
+				if(occluded){
+					m_occlusion[r / 64] |= ((u_int64_t)1) << (r % 64);
+				}
+			}
+		});
+	}
+
+	bool IsOccluded(size_t ray) const
+	{
+		return (m_occlusion[ray / 64] >> (ray % 64)) & 1;
+	}
+
+	void PrintBVHSummary()
+	{
+		printf("BVH: built in %.3f ms, traversal %.3f ms (%.3f Mrays/s)\n", m_bvh_build_seconds * 1e3, m_traversal_seconds * 1e3,
+				(m_traversal_seconds > 0) ? (m_num_rays / m_traversal_seconds) / 1e6 : 0.0);
+	}
+
 private:
+	static bool CompareRay(const intersection_t& a, const intersection_t& b)
+	{
+		return a.ray < b.ray;
+	}
+
 	bool CheckIntersection(triangle_t t, ray_t r)
 	{
 		return triangle_intersection(t.v0, t.v1, t.v2, r.origin, r.direction) > 0;
 	}
 
+	/* tests triangle t from its edges, if PrepareEdges made them, otherwise from its vertices */
+	bool CheckIntersection(size_t t, const std::vector<triangle_edges_t>& edges, const ray_t& r)
+	{
+		if(edges.empty()){
+			return CheckIntersection(Triangle(t), r);
+		}
+		return edge_intersection(edges[t].v0, edges[t].e1, edges[t].e2, r.origin, r.direction) > 0;
+	}
+
+	/* in the edges format works out the edges of every triangle, once, into edges. otherwise leaves it empty */
+	void PrepareEdges(std::vector<triangle_edges_t>& edges)
+	{
+		if(m_triangle_format != TRIANGLE_FORMAT_EDGES){
+			return;
+		}
+
+		edges.resize(m_num_triangles);
+		for(size_t t = 0; t < m_num_triangles; t++){
+			edges[t] = TriangleEdges(Triangle(t));
+		}
+	}
+
+	/* returns the lanes of m_triangle_lanes if it is in the format of the tests, otherwise fills local_lanes from the triangles and returns those */
+	triangle_lanes_t PrepareLanes(TriangleSoA& local_lanes)
+	{
+		if(m_triangle_lanes != NULL && m_triangle_lanes->m_format == m_triangle_format){
+			return m_triangle_lanes->GetLanes();
+		}
+
+		if(m_mesh != NULL){
+			local_lanes.SetTriangles(*m_mesh, m_triangle_format);
+		}else{
+			local_lanes.SetTriangles(m_triangles, m_num_triangles, m_triangle_format);
+		}
+		return local_lanes.GetLanes();
+	}
+
+	triangle_t Triangle(size_t t) const
+	{
+		return (m_mesh != NULL) ? m_mesh->GetTriangle(t) : m_triangles[t];
+	}
+
+	tile_box_t TileBoundsOf(size_t first, size_t count) const
+	{
+		if(m_mesh == NULL){
+			return TriangleTileBounds(m_triangles + first, count);
+		}
+
+		tile_box_t box = TriangleTileBounds(NULL, 0);
+		box.empty = (count == 0);
+		for(size_t t = first; t < first + count; t++)
+		{
+			triangle_t triangle = m_mesh->GetTriangle(t);
+			ExtendBox(box.lower, box.upper, triangle.v0);
+			ExtendBox(box.lower, box.upper, triangle.v1);
+			ExtendBox(box.lower, box.upper, triangle.v2);
+		}
+		return box;
+	}
+
+	void BuildBVH(BVH& bvh) const
+	{
+		if(m_mesh != NULL){
+			bvh.Build(*m_mesh);
+		}else{
+			bvh.Build(m_triangles, m_num_triangles);
+		}
+	}
+
+	/* in MODE_BVH returns the hierarchy to use, building one in local_bvh if none was given. otherwise returns NULL */
+	const BVH* PrepareBVH(BVH& local_bvh)
+	{
+		if(m_mode != MODE_BVH){
+			return NULL;
+		}
+
+		const BVH* bvh = m_bvh;
+		if(bvh == NULL)
+		{
+			BuildBVH(local_bvh);
+			bvh = &local_bvh;
+		}
+		m_bvh_build_seconds = bvh->m_build_seconds;
+		return bvh;
+	}
+
+	/* calls job(ray_begin, ray_end) for each tile of rays, on the pool if set */
+	void RunRayTiles(size_t rays_per_tile, std::function<void(size_t, size_t)> job)
+	{
+		rays_per_tile = (rays_per_tile > 0) ? rays_per_tile : 1;
+		size_t ray_tiles = (m_num_rays + rays_per_tile - 1) / rays_per_tile;
+
+		std::function<void(size_t, int)> tile_job = [&](size_t tile, int)
+		{
+			job(tile * rays_per_tile, std::min((tile + 1) * rays_per_tile, m_num_rays));
+		};
+
+		if(m_pool != NULL)
+		{
+			m_pool->ParallelFor(ray_tiles, tile_job);
+		}
+		else
+		{
+			for(size_t tile = 0; tile < ray_tiles; tile++){
+				tile_job(tile, 0);
+			}
+		}
+	}
+
+	bool Occludes(u_int32_t triangle, const ray_t& r)
+	{
+		triangle_t t = Triangle(triangle);
+
+		float distance;
+		return triangle_intersection(t.v0, t.v1, t.v2, r.origin, r.direction, &distance) > 0 && distance >= r.tmin && distance <= r.tmax;
+	}
+
+	void KeepClosest(closest_hit_t& closest, u_int32_t triangle, const ray_t& r)
+	{
+		triangle_t t = Triangle(triangle);
+
+		closest_hit_t hit;
+		hit.triangle = triangle;
+		if(triangle_intersection(t.v0, t.v1, t.v2, r.origin, r.direction, &hit.t, &hit.u, &hit.v) > 0 && hit.IsNearerThan(closest)){
+			closest = hit;
+		}
+	}
+
 	//Thanks: http://rosettacode.org/wiki/Vector_products#C.2B.2B
 	float DOT(vector3 lhs,  vector3 rhs )
 	{
@@ -77,16 +630,29 @@ private:
 							   const vector3   V2,
 							   const vector3   V3,
 							   const vector3    O,  //Ray origin
-							   const vector3    D)  //Ray direction
+							   const vector3    D,  //Ray direction
+						   float* t_out = NULL, //Optional, filled in on a hit
+						   float* u_out = NULL,
+						   float* v_out = NULL)
+	{
+	  //Find vectors for two edges sharing V1
+	  return edge_intersection(V1, SUB(V2, V1), SUB(V3, V1), O, D, t_out, u_out, v_out);
+	}
+
+	//The same test, with the edges sharing V1 given
+	int edge_intersection( const vector3   V1,  // Triangle vertex
+						   const vector3   e1,  //Edge1, V2 - V1
+						   const vector3   e2,  //Edge2, V3 - V1
+						   const vector3    O,  //Ray origin
+						   const vector3    D,  //Ray direction
+						   float* t_out = NULL, //Optional, filled in on a hit
+						   float* u_out = NULL,
+						   float* v_out = NULL)
 	{
-	  vector3 e1, e2;  //Edge1, Edge2
 	  vector3 P, Q, T;
 	  float det, inv_det, u, v;
 	  float t;
 
-	  //Find vectors for two edges sharing V1
-	  e1 = SUB(V2, V1);
-	  e2 = SUB(V3, V1);
 	  //Begin calculating determinant - also used to calculate u parameter
 	  P = CROSS(D, e2);
 	  //if determinant is near zero, ray lies in plane of triangle
@@ -114,6 +680,9 @@ private:
 	  t = DOT(e2, Q) * inv_det;
 
 	  if(t > EPSILON) { //ray intersection
+		if(t_out) *t_out = t;
+		if(u_out) *u_out = u;
+		if(v_out) *v_out = v;
 		return 1;
 	  }
 
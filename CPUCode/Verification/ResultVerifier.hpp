@@ -0,0 +1,400 @@
+/*
+ * ResultVerifier.hpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#ifndef RESULTVERIFIER_HPP_
+#define RESULTVERIFIER_HPP_
+
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include "../Types.h"
+#include "../ResultEncoding.hpp"
+
+/* Compares two sets of (ray, triangle) hits. Each hit is turned into a 64 bit key (ray in the top half), both key sets are radix sorted and then
+ * walked together once, so the comparison is linear in the number of hits. Hits missing from the actual set, extra hits that the reference does
+ * not have, and duplicates on either side are all counted, and the first few of each kept for printing. */
+
+#define VERIFIER_MAX_SAMPLES 16
+
+struct verification_report_t
+{
+	size_t expected;
+	size_t actual;
+
+	size_t missing;
+	size_t extra;
+	size_t expected_duplicates;
+	size_t actual_duplicates;
+
+	std::vector<intersection_t> missing_samples;
+	std::vector<intersection_t> extra_samples;
+	std::vector<intersection_t> duplicate_samples;
+
+	bool Passed() const
+	{
+		return (missing == 0) && (extra == 0) && (expected_duplicates == 0) && (actual_duplicates == 0);
+	}
+
+	void Print() const
+	{
+		printf("Verification: %zu expected, %zu actual\n", expected, actual);
+		printf("\tMissing: %zu\n", missing);
+		for(size_t i = 0; i < missing_samples.size(); i++){
+			printf("\t\t(%u, %u)\n", missing_samples[i].ray, missing_samples[i].triangle);
+		}
+		printf("\tExtra: %zu\n", extra);
+		for(size_t i = 0; i < extra_samples.size(); i++){
+			printf("\t\t(%u, %u)\n", extra_samples[i].ray, extra_samples[i].triangle);
+		}
+		printf("\tDuplicates: %zu expected, %zu actual\n", expected_duplicates, actual_duplicates);
+		for(size_t i = 0; i < duplicate_samples.size(); i++){
+			printf("\t\t(%u, %u)\n", duplicate_samples[i].ray, duplicate_samples[i].triangle);
+		}
+		printf("\t%s\n", Passed() ? "PASSED" : "FAILED");
+	}
+};
+
+/* Closest hit results are compared ray by ray. Two hits on different triangles are accepted if their distances agree within the tolerance, as
+ * coincident or abutting triangles may legitimately resolve either way. */
+struct closest_verification_report_t
+{
+	size_t rays;
+
+	size_t missing;		//the reference hit something, the actual result did not
+	size_t extra;		//the actual result hit something, the reference did not
+	size_t different;	//both hit, but different triangles at different distances
+	size_t inaccurate;	//both hit the same triangle, but t, u or v differ by more than the tolerance
+
+	float max_error;
+
+	std::vector<u_int32_t> samples;	//rays with any of the above
+
+	bool Passed() const
+	{
+		return (missing == 0) && (extra == 0) && (different == 0) && (inaccurate == 0);
+	}
+
+	void Print() const
+	{
+		printf("Closest hit verification: %zu rays\n", rays);
+		printf("\tMissing: %zu\n", missing);
+		printf("\tExtra: %zu\n", extra);
+		printf("\tDifferent triangle: %zu\n", different);
+		printf("\tInaccurate: %zu (largest error %g)\n", inaccurate, max_error);
+		for(size_t i = 0; i < samples.size(); i++){
+			printf("\t\tRay %u\n", samples[i]);
+		}
+		printf("\t%s\n", Passed() ? "PASSED" : "FAILED");
+	}
+};
+
+/* Occlusion results are bit masks, one bit per ray, and are compared a word at a time */
+struct occlusion_verification_report_t
+{
+	size_t rays;
+	size_t occluded;		//rays the reference says are blocked
+
+	size_t false_occluded;	//blocked in the actual result but not the reference
+	size_t false_visible;	//blocked in the reference but not the actual result
+
+	std::vector<u_int32_t> samples;
+
+	bool Passed() const
+	{
+		return (false_occluded == 0) && (false_visible == 0);
+	}
+
+	void Print() const
+	{
+		printf("Occlusion verification: %zu rays, %zu occluded\n", rays, occluded);
+		printf("\tWrongly occluded: %zu\n", false_occluded);
+		printf("\tWrongly visible: %zu\n", false_visible);
+		for(size_t i = 0; i < samples.size(); i++){
+			printf("\t\tRay %u\n", samples[i]);
+		}
+		printf("\t%s\n", Passed() ? "PASSED" : "FAILED");
+	}
+};
+
+/* An encoded result stream (see ResultEncoding) is compared word for word, padding included */
+struct encoding_verification_report_t
+{
+	const char* encoding;
+	size_t expected_words;
+	size_t actual_words;
+
+	size_t different;
+	size_t first_difference;
+
+	bool Passed() const
+	{
+		return (expected_words == actual_words) && (different == 0);
+	}
+
+	void Print() const
+	{
+		printf("Encoded results verification (%s): %zu bytes expected, %zu actual\n", encoding, expected_words * sizeof(u_int32_t),
+				actual_words * sizeof(u_int32_t));
+		printf("\tDifferent words: %zu\n", different);
+		if(different > 0){
+			printf("\t\tFirst at word %zu\n", first_difference);
+		}
+		printf("\t%s\n", Passed() ? "PASSED" : "FAILED");
+	}
+};
+
+class ResultVerifier
+{
+public:
+	static u_int64_t Key(const intersection_t& intersection)
+	{
+		return (((u_int64_t)intersection.ray) << 32) | intersection.triangle;
+	}
+
+	static intersection_t FromKey(u_int64_t key)
+	{
+		intersection_t intersection;
+		intersection.ray = (u_int32_t)(key >> 32);
+		intersection.triangle = (u_int32_t)key;
+		return intersection;
+	}
+
+	/* LSD radix sort, 16 bits per pass. passes whose digit is the same for every key are skipped, which for typical ray and triangle counts leaves
+	 * two or three of the four */
+	static void RadixSort(std::vector<u_int64_t>& keys)
+	{
+		std::vector<u_int64_t> scratch(keys.size());
+		std::vector<size_t> counts(1 << 16);
+
+		for(int shift = 0; shift < 64; shift += 16)
+		{
+			std::fill(counts.begin(), counts.end(), 0);
+			for(size_t i = 0; i < keys.size(); i++){
+				counts[(keys[i] >> shift) & 0xFFFF]++;
+			}
+
+			if(keys.empty() || counts[(keys[0] >> shift) & 0xFFFF] == keys.size()){
+				continue;
+			}
+
+			size_t offset = 0;
+			for(size_t d = 0; d < counts.size(); d++)
+			{
+				size_t count = counts[d];
+				counts[d] = offset;
+				offset += count;
+			}
+
+			for(size_t i = 0; i < keys.size(); i++){
+				scratch[counts[(keys[i] >> shift) & 0xFFFF]++] = keys[i];
+			}
+			keys.swap(scratch);
+		}
+	}
+
+	static verification_report_t Compare(const std::vector<intersection_t>& expected, const std::vector<intersection_t>& actual)
+	{
+		return Compare(expected.empty() ? NULL : &expected[0], expected.size(), actual.empty() ? NULL : &actual[0], actual.size());
+	}
+
+	static verification_report_t Compare(const intersection_t* expected, size_t expected_count, const intersection_t* actual, size_t actual_count)
+	{
+		verification_report_t report;
+		report.expected = expected_count;
+		report.actual = actual_count;
+		report.missing = 0;
+		report.extra = 0;
+		report.expected_duplicates = 0;
+		report.actual_duplicates = 0;
+
+		std::vector<u_int64_t> e(expected_count), a(actual_count);
+		for(size_t i = 0; i < expected_count; i++){
+			e[i] = Key(expected[i]);
+		}
+		for(size_t i = 0; i < actual_count; i++){
+			a[i] = Key(actual[i]);
+		}
+
+		RadixSort(e);
+		RadixSort(a);
+
+		size_t i = 0, j = 0;
+		while(i < e.size() || j < a.size())
+		{
+			/* collapse runs of equal keys on each side first, counting the repeats as duplicates */
+
+			if(i > 0 && i < e.size() && e[i] == e[i - 1])
+			{
+				report.expected_duplicates++;
+				i++;
+				continue;
+			}
+			if(j > 0 && j < a.size() && a[j] == a[j - 1])
+			{
+				report.actual_duplicates++;
+				Sample(report.duplicate_samples, a[j]);
+				j++;
+				continue;
+			}
+
+			if(j == a.size() || (i < e.size() && e[i] < a[j]))
+			{
+				report.missing++;
+				Sample(report.missing_samples, e[i]);
+				i++;
+			}
+			else if(i == e.size() || a[j] < e[i])
+			{
+				report.extra++;
+				Sample(report.extra_samples, a[j]);
+				j++;
+			}
+			else
+			{
+				i++;
+				j++;
+			}
+		}
+
+		return report;
+	}
+
+	static encoding_verification_report_t CompareEncoded(result_encoding_t encoding, const std::vector<u_int32_t>& expected,
+			const std::vector<u_int32_t>& actual)
+	{
+		encoding_verification_report_t report;
+		report.encoding = ResultEncodingName(encoding);
+		report.expected_words = expected.size();
+		report.actual_words = actual.size();
+		report.different = 0;
+		report.first_difference = 0;
+
+		for(size_t i = 0; i < std::min(expected.size(), actual.size()); i++)
+		{
+			if(expected[i] != actual[i])
+			{
+				if(report.different == 0){
+					report.first_difference = i;
+				}
+				report.different++;
+			}
+		}
+
+		return report;
+	}
+
+	/* expected and actual hold one record per ray. the tolerance is relative, to the larger of the magnitudes compared and 1 */
+	static closest_verification_report_t CompareClosest(const std::vector<closest_hit_t>& expected, const std::vector<closest_hit_t>& actual,
+			float tolerance = 1e-4f)
+	{
+		closest_verification_report_t report;
+		report.rays = expected.size();
+		report.missing = 0;
+		report.extra = 0;
+		report.different = 0;
+		report.inaccurate = 0;
+		report.max_error = 0;
+
+		if(actual.size() != expected.size()){
+			printf("Closest hit verification: %zu results for %zu rays\n", actual.size(), expected.size());
+		}
+
+		for(size_t r = 0; r < expected.size(); r++)
+		{
+			const closest_hit_t& e = expected[r];
+			closest_hit_t a;
+			if(r < actual.size())
+			{
+				a = actual[r];
+			}
+			else
+			{
+				a.triangle = CLOSEST_HIT_NONE;
+				a.t = a.u = a.v = 0;
+			}
+
+			bool mismatch = false;
+
+			if(e.triangle == CLOSEST_HIT_NONE || a.triangle == CLOSEST_HIT_NONE)
+			{
+				if(e.triangle != a.triangle)
+				{
+					(e.triangle == CLOSEST_HIT_NONE) ? report.extra++ : report.missing++;
+					mismatch = true;
+				}
+			}
+			else if(e.triangle != a.triangle)
+			{
+				if(Error(e.t, a.t) > tolerance)
+				{
+					report.different++;
+					mismatch = true;
+				}
+			}
+			else
+			{
+				float error = std::max(Error(e.t, a.t), std::max(Error(e.u, a.u), Error(e.v, a.v)));
+				report.max_error = std::max(report.max_error, error);
+				if(error > tolerance)
+				{
+					report.inaccurate++;
+					mismatch = true;
+				}
+			}
+
+			if(mismatch && report.samples.size() < VERIFIER_MAX_SAMPLES){
+				report.samples.push_back(r);
+			}
+		}
+
+		return report;
+	}
+
+	/* bit (r % 64) of word (r / 64) is ray r. bits beyond num_rays are ignored */
+	static occlusion_verification_report_t CompareOcclusion(const std::vector<u_int64_t>& expected, const std::vector<u_int64_t>& actual,
+			size_t num_rays)
+	{
+		occlusion_verification_report_t report;
+		report.rays = num_rays;
+		report.occluded = 0;
+		report.false_occluded = 0;
+		report.false_visible = 0;
+
+		for(size_t w = 0; w < (num_rays + 63) / 64; w++)
+		{
+			u_int64_t valid = (num_rays - w * 64 >= 64) ? ~(u_int64_t)0 : ((((u_int64_t)1) << (num_rays - w * 64)) - 1);
+			u_int64_t e = ((w < expected.size()) ? expected[w] : 0) & valid;
+			u_int64_t a = ((w < actual.size()) ? actual[w] : 0) & valid;
+
+			report.occluded += __builtin_popcountll(e);
+			report.false_occluded += __builtin_popcountll(a & ~e);
+			report.false_visible += __builtin_popcountll(e & ~a);
+
+			for(u_int64_t wrong = a ^ e; wrong != 0 && report.samples.size() < VERIFIER_MAX_SAMPLES; wrong &= wrong - 1){
+				report.samples.push_back(w * 64 + __builtin_ctzll(wrong));
+			}
+		}
+
+		return report;
+	}
+
+private:
+	static float Error(float expected, float actual)
+	{
+		return fabsf(expected - actual) / std::max(1.f, std::max(fabsf(expected), fabsf(actual)));
+	}
+
+	static void Sample(std::vector<intersection_t>& samples, u_int64_t key)
+	{
+		if(samples.size() < VERIFIER_MAX_SAMPLES){
+			samples.push_back(FromKey(key));
+		}
+	}
+};
+
+#endif /* RESULTVERIFIER_HPP_ */
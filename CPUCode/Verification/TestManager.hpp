@@ -8,8 +8,12 @@
 #ifndef TESTMANAGER_HPP_
 #define TESTMANAGER_HPP_
 
+#include <stdlib.h>
+#include <unistd.h>
 #include "CPUIntersectionEngine.hpp"
-#include <algorithm>    // std::find
+#include "ResultVerifier.hpp"
+#include "../Triangles.hpp"
+#include "../SceneFile.hpp"
 
 class TestManager
 {
@@ -18,6 +22,8 @@ public:
 	size_t m_triangles_size;
 	size_t m_triangle_count;
 
+	TriangleSoA m_triangle_lanes;
+
 	ray_t* m_rays;
 	size_t m_rays_count;
 	size_t m_rays_size;
@@ -46,6 +52,8 @@ public:
 		}
 
 
+		m_triangle_lanes.SetTriangles(m_triangles, m_triangle_count);
+
 		/* prepare some rays */
 
 		m_rays_count = 15; //5 intersection tests
@@ -64,43 +72,229 @@ public:
 				m_rays[i].direction.z = 1;
 				m_rays[i].direction.x = 100;
 			}
+
+			/* the triangles are at distance 1 along the rays that hit them, so for occlusion queries every other ray stops short of them */
+
+			m_rays[i].tmin = 0;
+			m_rays[i].tmax = (i % 2) ? 0.5f : 2.0f;
 		}
 
 	}
 
 	bool CheckResults(Results& results)
 	{
+		return CheckResults(results.m_intersections);
+	}
+
+	bool CheckResults(const std::vector<intersection_t>& dfe_intersections)
+	{
+		WorkStealingPool pool;
 		CPUIntersectionEngine cpu_engine;
-		cpu_engine.m_num_rays = m_rays_count;
-		cpu_engine.m_rays = m_rays;
-		cpu_engine.m_num_triangles = m_triangle_count;
-		cpu_engine.m_triangles = m_triangles;
+		SetupEngine(cpu_engine, pool);
+
+		printf("Running CPU intersection tests (%s, %i threads)...", IntersectionISAName(cpu_engine.m_isa), pool.NumWorkers());
+		cpu_engine.DoIntersectionTests();
+		printf("Done.\n");
+
+		verification_report_t report = ResultVerifier::Compare(cpu_engine.m_intersections, dfe_intersections);
+		report.Print();
+
+		return report.Passed();
+	}
+
+	/* dfe_units holds the words of an all hits run with the given encoding, as read from results_out. both the words and the hits decoded from them
+	 * are checked against the CPU's */
+	bool CheckEncodedResults(result_encoding_t encoding, const result_layout_t& layout, const std::vector<u_int32_t>& dfe_units)
+	{
+		WorkStealingPool pool;
+		CPUIntersectionEngine cpu_engine;
+		SetupEngine(cpu_engine, pool);
+
+		printf("Running CPU intersection tests (%s encoding)...", ResultEncodingName(encoding));
+		cpu_engine.DoIntersectionTests();
+		printf("Done.\n");
+
+		std::vector<u_int32_t> cpu_units;
+		cpu_engine.EncodeIntersections(encoding, layout, cpu_units);
+
+		encoding_verification_report_t encoding_report = ResultVerifier::CompareEncoded(encoding, cpu_units, dfe_units);
+		encoding_report.Print();
+
+		ResultDecoder decoder;
+		decoder.Begin(encoding, layout);
+
+		std::vector<intersection_t> dfe_intersections;
+		decoder.Decode(dfe_units.empty() ? NULL : &dfe_units[0], dfe_units.size() / 2, dfe_intersections);
+
+		verification_report_t report = ResultVerifier::Compare(cpu_engine.m_intersections, dfe_intersections);
+		report.Print();
+
+		return encoding_report.Passed() && report.Passed();
+	}
+
+	/* dfe_hits holds one closest hit record per test ray */
+	bool CheckClosestHits(const std::vector<closest_hit_t>& dfe_hits)
+	{
+		WorkStealingPool pool;
+		CPUIntersectionEngine cpu_engine;
+		SetupEngine(cpu_engine, pool);
+
+		printf("Running CPU closest hit tests (%i threads)...", pool.NumWorkers());
+		cpu_engine.DoClosestHitTests();
+		printf("Done.\n");
+
+		closest_verification_report_t report = ResultVerifier::CompareClosest(cpu_engine.m_closest_hits, dfe_hits);
+		report.Print();
+
+		return report.Passed();
+	}
+
+	/* dfe_mask holds a bit per test ray, as read by Occlusion */
+	bool CheckOcclusion(const std::vector<u_int64_t>& dfe_mask)
+	{
+		WorkStealingPool pool;
+		CPUIntersectionEngine cpu_engine;
+		SetupEngine(cpu_engine, pool);
+
+		printf("Running CPU occlusion tests (%i threads)...", pool.NumWorkers());
+		cpu_engine.DoOcclusionTests();
+		printf("Done.\n");
+
+		occlusion_verification_report_t report = ResultVerifier::CompareOcclusion(cpu_engine.m_occlusion, dfe_mask, m_rays_count);
+		report.Print();
+
+		return report.Passed();
+	}
 
-		printf("Running CPU intersection tests...");
+	/* checks a hierarchy over the test triangles (e.g. one refit after they moved) by comparing the hits found through it with brute force */
+	bool CheckBVH(const BVH& bvh)
+	{
+		WorkStealingPool pool;
+		CPUIntersectionEngine cpu_engine;
+		SetupEngine(cpu_engine, pool);
 		cpu_engine.DoIntersectionTests();
+
+		CPUIntersectionEngine bvh_engine;
+		SetupEngine(bvh_engine, pool);
+		bvh_engine.m_mode = MODE_BVH;
+		bvh_engine.m_bvh = &bvh;
+
+		printf("Running CPU intersection tests through the BVH...");
+		bvh_engine.DoIntersectionTests();
 		printf("Done.\n");
 
-		if(results.m_intersections.size() == cpu_engine.m_intersections.size())
+		verification_report_t report = ResultVerifier::Compare(cpu_engine.m_intersections, bvh_engine.m_intersections);
+		report.Print();
+
+		return report.Passed();
+	}
+
+	/* checks that the CPU engine, reading the triangles through an indexed mesh of them, finds the same hits as from the triangles, both by brute
+	 * force and through a BVH built over the mesh */
+	bool CheckMesh(const IndexedMesh& mesh)
+	{
+		WorkStealingPool pool;
+		CPUIntersectionEngine cpu_engine;
+		SetupEngine(cpu_engine, pool);
+		cpu_engine.DoIntersectionTests();
+
+		bool passed = true;
+		intersection_mode_t modes[2] = { MODE_BRUTE_FORCE, MODE_BVH };
+		for(int m = 0; m < 2; m++)
 		{
-			printf("1. Counts match.\n");
-		}else
+			CPUIntersectionEngine mesh_engine;
+			SetupEngine(mesh_engine, pool);
+			mesh_engine.m_triangles = NULL;
+			mesh_engine.m_triangle_lanes = NULL;
+			mesh_engine.m_mesh = &mesh;
+			mesh_engine.m_num_triangles = mesh.NumTriangles();
+			mesh_engine.m_mode = modes[m];
+
+			printf("Running CPU intersection tests on the indexed mesh%s...", (modes[m] == MODE_BVH) ? " through a BVH" : "");
+			mesh_engine.DoIntersectionTests();
+			printf("Done.\n");
+
+			verification_report_t report = ResultVerifier::Compare(cpu_engine.m_intersections, mesh_engine.m_intersections);
+			report.Print();
+
+			passed = report.Passed() && passed;
+		}
+		return passed;
+	}
+
+	/* writes the test triangles and rays to a scene file in the maxfile's word layout, as SceneConvert --dfe does, maps it, and checks that the
+	 * triangles used in place through UsePackedTriangles are byte for byte those SetTriangles packs, and that the rays come back unchanged */
+	bool CheckSceneFile(max_file_t* maxfile)
+	{
+		Triangles packed(maxfile, m_triangle_count);
+		if(packed.m_format != TRIANGLE_FORMAT_VERTICES)
 		{
-			printf("1. ERROR: Counts do not match. %i vs. %i\n", cpu_engine.m_intersections.size(), results.m_intersections.size());
+			printf("\tscene files hold vertices, so the round trip is not checked for a maxfile built for edges\n");
+			return true;
+		}
 
+		char filename[] = "/tmp/RayTracerSceneXXXXXX";
+		int fd = mkstemp(filename);
+		if(fd < 0)
+		{
+			printf("ERROR: could not create a temporary scene file.\n");
+			return false;
 		}
+		close(fd);
 
-		for(uint i = 0; i < cpu_engine.m_intersections.size(); i++)
+		scene_dfe_layout_t layout = scene_dfe_layout_t::FromMaxfile(maxfile);
+
+		SceneFileWriter writer;
+		bool passed = writer.Open(filename, &layout);
+		if(passed)
 		{
-			if(std::find(results.m_intersections.begin(), results.m_intersections.end(), cpu_engine.m_intersections[i])==results.m_intersections.end())
-			{
-				printf("2. ERROR: Result not found (%i, %i)!\n", cpu_engine.m_intersections[i].ray, cpu_engine.m_intersections[i].triangle);
-			}
+			writer.AddTriangles(m_triangles, m_triangle_count);
+			writer.AddRays(m_rays, m_rays_count);
+			passed = writer.Close();
 		}
 
-		printf("2. All results accounted for.\n");
+		SceneFile file;
+		passed = passed && file.Open(filename);
+		unlink(filename);
+
+		if(!passed){
+			return false;
+		}
+
+		Triangles reference(maxfile, m_triangle_count);
+		reference.SetTriangles(m_triangles, m_triangle_count);
+
+		passed = file.NumTriangles() == m_triangle_count && file.NumRays() == m_rays_count &&
+				packed.UsePackedTriangles(file.GetTriangleWords(), file.GetTrianglesSize(), file.m_header.triangles_per_word,
+						file.m_header.word_width_in_bytes);
+
+		size_t size = (size_t)reference.m_total_bursts * reference.m_burst_size_in_bytes;
+		passed = passed && memcmp(packed.GetTrianglesWord(0), reference.GetTrianglesWord(0), size) == 0;
+		passed = passed && memcmp(file.GetRays(), m_rays, m_rays_count * sizeof(ray_t)) == 0;
 
+		printf("\t%zu triangles and %zu rays mapped from %zu bytes of packed triangles\n", file.NumTriangles(), file.NumRays(),
+				file.GetTrianglesSize());
+		printf("\t%s\n", passed ? "PASSED" : "FAILED");
 
-		return false;
+		return passed;
+	}
+
+	/* replaces count of the test triangles from first, so the checks that follow are against the new ones */
+	void UpdateTriangles(size_t first, const triangle_t* triangles, size_t count)
+	{
+		memcpy(m_triangles + first, triangles, count * sizeof(triangle_t));
+		m_triangle_lanes.SetTriangles(m_triangles, m_triangle_count);
+	}
+
+private:
+	void SetupEngine(CPUIntersectionEngine& cpu_engine, WorkStealingPool& pool)
+	{
+		cpu_engine.m_num_rays = m_rays_count;
+		cpu_engine.m_rays = m_rays;
+		cpu_engine.m_num_triangles = m_triangle_count;
+		cpu_engine.m_triangles = m_triangles;
+		cpu_engine.m_triangle_lanes = &m_triangle_lanes;
+		cpu_engine.m_pool = &pool;
 	}
 
 };
@@ -0,0 +1,196 @@
+/*
+ * WorkStealingPool.hpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: sfriston
+ */
+
+#ifndef WORKSTEALINGPOOL_HPP_
+#define WORKSTEALINGPOOL_HPP_
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/* A fixed set of worker threads, each with its own queue of task indices. ParallelFor hands each worker a contiguous run of tasks; a worker takes
+ * from the back of its own queue and, once that is empty, steals from the front of the others, so uneven tiles (e.g. ones with many hits) do not
+ * leave cores idle. Tasks are identified by index and the worker running them is passed in, so callers can keep per-worker state without locking. */
+
+class WorkStealingPool
+{
+private:
+	struct worker_queue_t
+	{
+		std::mutex lock;
+		std::deque<size_t> tasks;
+	};
+
+	std::vector<std::thread> m_threads;
+	std::vector<worker_queue_t*> m_queues;
+
+	std::mutex m_lock;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+
+	const std::function<void(size_t, int)>* m_job;
+	size_t m_generation;
+	size_t m_remaining;
+	size_t m_active;
+	bool m_stop;
+
+public:
+	/* num_workers of 0 sizes the pool to the machine */
+	WorkStealingPool(int num_workers = 0)
+	{
+		if(num_workers <= 0){
+			num_workers = std::thread::hardware_concurrency();
+		}
+		if(num_workers <= 0){
+			num_workers = 1;
+		}
+
+		m_job = NULL;
+		m_generation = 0;
+		m_remaining = 0;
+		m_active = 0;
+		m_stop = false;
+
+		for(int i = 0; i < num_workers; i++){
+			m_queues.push_back(new worker_queue_t());
+		}
+		for(int i = 0; i < num_workers; i++){
+			m_threads.push_back(std::thread(&WorkStealingPool::WorkerLoop, this, i));
+		}
+	}
+
+	~WorkStealingPool()
+	{
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+
+		for(size_t i = 0; i < m_threads.size(); i++){
+			m_threads[i].join();
+		}
+		for(size_t i = 0; i < m_queues.size(); i++){
+			delete m_queues[i];
+		}
+	}
+
+	int NumWorkers() const
+	{
+		return (int)m_queues.size();
+	}
+
+	/* runs job(task, worker) for every task in [0, num_tasks) and returns once all have completed */
+	void ParallelFor(size_t num_tasks, const std::function<void(size_t, int)>& job)
+	{
+		if(num_tasks == 0){
+			return;
+		}
+
+		size_t workers = m_queues.size();
+		for(size_t w = 0; w < workers; w++)
+		{
+			std::lock_guard<std::mutex> guard(m_queues[w]->lock);
+			for(size_t task = (w * num_tasks) / workers; task < ((w + 1) * num_tasks) / workers; task++){
+				m_queues[w]->tasks.push_back(task);
+			}
+		}
+
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_job = &job;
+		m_remaining = num_tasks;
+		m_generation++;
+		m_wake.notify_all();
+
+		/* wait for the workers to leave the job too, so none of them can pick up the next job's tasks while holding this one */
+		while(m_remaining > 0 || m_active > 0){
+			m_done.wait(lock);
+		}
+		m_job = NULL;
+	}
+
+private:
+	bool NextTask(int worker, size_t& task)
+	{
+		{
+			worker_queue_t* own = m_queues[worker];
+			std::lock_guard<std::mutex> guard(own->lock);
+			if(!own->tasks.empty())
+			{
+				task = own->tasks.back();
+				own->tasks.pop_back();
+				return true;
+			}
+		}
+
+		for(size_t i = 1; i < m_queues.size(); i++)
+		{
+			worker_queue_t* victim = m_queues[(worker + i) % m_queues.size()];
+			std::lock_guard<std::mutex> guard(victim->lock);
+			if(!victim->tasks.empty())
+			{
+				task = victim->tasks.front();
+				victim->tasks.pop_front();
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void WorkerLoop(int worker)
+	{
+		size_t seen_generation = 0;
+
+		while(true)
+		{
+			const std::function<void(size_t, int)>* job;
+			{
+				std::unique_lock<std::mutex> lock(m_lock);
+				while(!m_stop && m_generation == seen_generation){
+					m_wake.wait(lock);
+				}
+				if(m_stop){
+					return;
+				}
+				seen_generation = m_generation;
+				job = m_job;
+				if(job == NULL){
+					continue;
+				}
+				m_active++;
+			}
+
+			/* all of this generation's tasks were queued before the wake, so once every queue is empty this worker is done with it */
+
+			size_t task;
+			size_t completed = 0;
+			while(NextTask(worker, task))
+			{
+				(*job)(task, worker);
+				completed++;
+			}
+
+			{
+				std::lock_guard<std::mutex> guard(m_lock);
+				m_remaining -= completed;
+				m_active--;
+				if(m_remaining == 0 && m_active == 0){
+					m_done.notify_all();
+				}
+			}
+		}
+	}
+
+	WorkStealingPool(const WorkStealingPool&);
+	WorkStealingPool& operator=(const WorkStealingPool&);
+};
+
+#endif /* WORKSTEALINGPOOL_HPP_ */
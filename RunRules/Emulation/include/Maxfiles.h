@@ -0,0 +1,4 @@
+/** Emulation run rule: the RayTracer maxfile is modelled in software by CPUCode/Emulator */ 
+
+
+#include "RayTracer.h"
@@ -0,0 +1,32 @@
+/**\file */
+#ifndef SLIC_DECLARATIONS_RayTracer_H
+#define SLIC_DECLARATIONS_RayTracer_H
+#include "MaxSLiCInterface.h"
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* The declarations of the generated RayTracer.h the host code uses, for the emulated maxfile. Only the dynamic interface is emulated. */
+
+#define RayTracer_RaysWordWidthInBits (512)
+#define RayTracer_RaysPerTick (2)
+#define RayTracer_TriangleWidthInBytes (36)
+#define RayTracer_RaysPerWord (2)
+#define RayTracer_TrianglesInWidthInBits (3072)
+#define RayTracer_PCIE_ALIGNMENT (16)
+#define RayTracer_TrianglesPerTick (10)
+#define RayTracer_MaxBurstsPerCommand (128)
+
+/**
+ * \brief Initialise a maxfile.
+ */
+max_file_t* RayTracer_init(void);
+
+/* Free statically allocated maxfile data */
+void RayTracer_free(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* SLIC_DECLARATIONS_RayTracer_H */